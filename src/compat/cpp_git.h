@@ -21,6 +21,8 @@
 #define CPP_GIT_H
 
 #include <cstdarg>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
 #include <memory>
 #include <cstring>
@@ -40,6 +42,17 @@ namespace git
 		return QVersionNumber(major, minor, rev);
 	}
 
+	/* the bytes libgit2 holds in the object caches of every repository, ptrdiff_t is the size of the ssize_t it expects */
+	inline size_t cached_memory()
+	{
+		std::ptrdiff_t current = 0;
+		std::ptrdiff_t allowed = 0;
+		if (git_libgit2_opts(GIT_OPT_GET_CACHED_MEMORY, &current, &allowed) != 0)
+			return 0;
+
+		return static_cast<size_t>(current);
+	}
+
 	class libgit_error : public std::exception
 	{
 	public:
@@ -92,11 +105,79 @@ namespace git
 		}
 	};
 
+	class blob
+	{
+	public:
+		blob(git_blob *ptr) : ptr(ptr) {}
+
+		blob(const blob &) = delete;
+		blob &operator=(const blob &) = delete;
+
+		blob(blob &&other) noexcept
+		{
+			ptr = other.ptr;
+			other.ptr = nullptr;
+		}
+
+		blob &operator=(blob &&other) noexcept
+		{
+			if (this != &other) {
+				if (ptr != nullptr)
+					git_blob_free(ptr);
+
+				ptr = other.ptr;
+				other.ptr = nullptr;
+			}
+
+			return *this;
+		}
+
+		~blob()
+		{
+			if (ptr != nullptr)
+				git_blob_free(ptr);
+		}
+
+		const void *rawcontent() const
+		{
+			return git_blob_rawcontent(ptr);
+		}
+
+		uint64_t rawsize() const
+		{
+			return git_blob_rawsize(ptr);
+		}
+
+		bool is_binary() const
+		{
+			return git_blob_is_binary(ptr) != 0;
+		}
+
+		git_blob *_ptr() const
+		{
+			return ptr;
+		}
+
+	private:
+		git_blob *ptr;
+	};
+
 	class patch
 	{
 	public:
 		patch(git_patch *ptr) : ptr(ptr) {}
 
+		static patch from_blobs(const blob &old_blob, const char *old_path, const blob &new_blob, const char *new_path,
+				const git_diff_options *opts)
+		{
+			git_patch *patch_ptr;
+			int err = git_patch_from_blobs(&patch_ptr, old_blob._ptr(), old_path, new_blob._ptr(), new_path, opts);
+			if (err != 0)
+				throw libgit_error(err);
+
+			return git::patch(patch_ptr);
+		}
+
 		patch(const patch &) = delete;
 		patch &operator=(const patch &) = delete;
 
@@ -154,6 +235,18 @@ namespace git
 			return line;
 		}
 
+		const git_diff_delta *get_delta()
+		{
+			return git_patch_get_delta(ptr);
+		}
+
+		void line_stats(size_t *total_context, size_t *total_additions, size_t *total_deletions)
+		{
+			int err = git_patch_line_stats(total_context, total_additions, total_deletions, ptr);
+			if (err != 0)
+				throw libgit_error(err);
+		}
+
 		git_patch *_ptr() const
 		{
 			return ptr;
@@ -538,6 +631,59 @@ namespace git
 		git_reference *ptr;
 	};
 
+	class odb
+	{
+	public:
+		odb(git_odb *ptr) : ptr(ptr) {}
+
+		odb(const odb &) = delete;
+		odb &operator=(const odb &) = delete;
+
+		odb(odb &&other) noexcept
+		{
+			ptr = other.ptr;
+			other.ptr = nullptr;
+		}
+
+		odb &operator=(odb &&other) noexcept
+		{
+			if (this != &other) {
+				if (ptr != nullptr)
+					git_odb_free(ptr);
+
+				ptr = other.ptr;
+				other.ptr = nullptr;
+			}
+
+			return *this;
+		}
+
+		~odb()
+		{
+			if (ptr != nullptr)
+				git_odb_free(ptr);
+		}
+
+		/* reads only the header of the object, so nothing is parsed or cached, GIT_OBJ_BAD if it is missing */
+		git_otype read_type(const git_oid *oid) const
+		{
+			size_t len;
+			git_otype type;
+			if (git_odb_read_header(&len, &type, ptr, oid) != 0)
+				return GIT_OBJ_BAD;
+
+			return type;
+		}
+
+		git_odb *_ptr() const
+		{
+			return ptr;
+		}
+
+	private:
+		git_odb *ptr;
+	};
+
 	class repository
 	{
 	public:
@@ -563,6 +709,21 @@ namespace git
 			return ptr;
 		}
 
+		const char *commondir() const
+		{
+			return git_repository_commondir(ptr);
+		}
+
+		git::odb odb() const
+		{
+			git_odb *odb;
+			int err = git_repository_odb(&odb, ptr);
+			if (err != 0)
+				throw libgit_error(err);
+
+			return git::odb(odb);
+		}
+
 		git::commit commit_lookup(const git_oid *oid) const
 		{
 			git_commit *commit;
@@ -573,6 +734,16 @@ namespace git
 			return git::commit(commit);
 		}
 
+		git::blob blob_lookup(const git_oid *oid) const
+		{
+			git_blob *blob;
+			int err = git_blob_lookup(&blob, ptr, oid);
+			if (err != 0)
+				throw libgit_error(err);
+
+			return git::blob(blob);
+		}
+
 		git::diff diff_tree_to_tree(const git::tree &old_tree, const git::tree &new_tree, const git_diff_options *opts) const
 		{
 			git_diff *diff;
@@ -687,4 +858,44 @@ namespace git
 	};
 }
 
+/*!
+ * \struct git_oid_ref_hash
+ * \brief Structure for computing hashes of git_oid
+ */
+struct git_oid_ref_hash
+{
+	/*!
+	 * \brief Compute the hash of a git_oid
+	 * \param x The git_oid to hash
+	 * \return The hash of x
+	 */
+	size_t operator()(const git_oid &x) const
+	{
+		size_t hash = 0;
+		for (int i = 0; i < GIT_OID_RAWSZ; i++)
+			hash ^= std::hash<unsigned char>{}(x.id[i]) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+		return hash;
+	}
+};
+
+/*!
+ * \struct git_oid_ref_cmp
+ * \brief Structure for comparing git_oid
+ */
+struct git_oid_ref_cmp
+{
+	/*!
+	 * \brief Compare two git_oids
+	 * \param lhs The first git_oid to compare
+	 * \param rhs The second git_oid to compare
+	 * \return Boolean comparison result
+	 */
+	bool operator()(const git_oid &lhs, const git_oid &rhs) const
+	{
+		for (size_t i = 0; i < GIT_OID_RAWSZ; i++)
+			if (lhs.id[i] != rhs.id[i]) return false;
+		return true;
+	}
+};
+
 #endif /* CPP_GIT_H */
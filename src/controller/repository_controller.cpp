@@ -16,14 +16,16 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <chrono>
 #include <iterator>
+#include <numeric>
 #include <functional>
 
 #include <QApplication>
-#include <QFontDatabase>
 
 #include "util/reef_string.h"
+#include "util/trace.h"
 
 #include "repository_controller.h"
 
@@ -33,17 +35,108 @@ repository_controller::repository_controller(std::string &dir, std::function<voi
 	prefs(),
 	clist(refs, repo, prefs),
 	glist(),
-	clist_model(*this),
 	r_model(*this),
-	diff(nullptr),
-	patch(nullptr),
+	dworker(dir),
 	cfile_model(*this),
+	row_arena(preferences::row_arena_block_size, preferences::row_arena_huge_pages),
 	update_status_func(update_status_func)
-{}
+{
+	reload_timer.setSingleShot(true);
+	reload_timer.setInterval(preferences::reload_delay);
+	connect(&reload_timer, &QTimer::timeout, this, &repository_controller::handle_reload_timeout);
+
+	build_ref_labels();
+}
+
+uint64_t repository_controller::num_commit_rows() const
+{
+	return clist_items.size();
+}
+
+repository_controller::commit_row repository_controller::get_commit_row(uint64_t row) const
+{
+	const commit_item &item = clist_items[row];
+	return { item.graph, &get_row_text(row * 2, item.refs), &get_row_text(row * 2 + 1, item.summary) };
+}
+
+std::vector<memory_usage> repository_controller::get_memory_usage() const
+{
+	std::vector<memory_usage> usage;
+	usage.push_back(refs.get_memory_usage());
+
+	size_t labels_bytes = hash_table_memory(ref_labels);
+	for (const auto &label : ref_labels)
+		labels_bytes += string_memory(label.second);
+	usage.push_back({ "ref_labels", labels_bytes, ref_labels.size() });
+	usage.push_back({ "ref_tree", vector_memory(ref_items), ref_items.size() });
+
+	usage.push_back(clist.get_memory_usage());
+	usage.push_back(glist.get_memory_usage());
+
+	/* the graph and text of the rows are in row_arena */
+	usage.push_back({ "commit_rows", vector_memory(clist_items) + row_arena.get_stats().reserved_bytes, clist_items.size() });
+
+	/* each cached text is in a list node with two pointers */
+	size_t texts_bytes = hash_table_memory(row_text_index);
+	for (const row_text &text : row_texts)
+		texts_bytes += sizeof(row_text) + sizeof(void *) * 2 + text.text.capacity() * sizeof(QChar);
+	usage.push_back({ "row_text_cache", texts_bytes, row_texts.size() });
+
+	size_t files_bytes = vector_memory(cfile_items) + vector_memory(cfile_stats) + vector_memory(sorted_cfiles) + vector_memory(cfile_tree_items);
+	for (const diff_file &file : cfile_items)
+		files_bytes += string_memory(file.old_path) + string_memory(file.new_path) + vector_memory(file.other_old_ids);
+	usage.push_back({ "commit_files", files_bytes, cfile_items.size() });
+
+	usage.push_back(dworker.get_cache_memory_usage());
+
+	/* libgit2 does not count the objects it caches */
+	usage.push_back({ "libgit2_cache", git::cached_memory(), 0 });
+
+	return usage;
+}
+
+/* returns the decoded text, which stays valid until the cache is next used */
+const QString &repository_controller::get_row_text(uint64_t key, span<const char> text) const
+{
+	static const QString empty_text;
+	if (text.empty())
+		return empty_text;
+
+	auto it = row_text_index.find(key);
+	if (it != row_text_index.end()) {
+		row_texts.splice(row_texts.begin(), row_texts, it->second);
+		return it->second->text;
+	}
+
+	QChar buf[preferences::max_line_length];
+	size_t size = 0;
+	add_utf8_str_to_buf(buf, text.data(), text.size(), size);
+
+	row_texts.push_front({ key, QString(buf, static_cast<int>(size)) });
+	row_text_index.emplace(key, row_texts.begin());
+
+	if (row_texts.size() > preferences::row_text_cache_size) {
+		row_text_index.erase(row_texts.back().key);
+		row_texts.pop_back();
+	}
+
+	return row_texts.front().text;
+}
+
+span<const char> repository_controller::copy_row_text(const char *text, size_t length)
+{
+	/* enough bytes for the longest line that can be shown, whatever the characters are */
+	length = std::min(length, size_t(preferences::max_line_length) * 4);
+
+	char *memory = row_arena.allocate<char>(length);
+	memcpy(memory, text, length);
+	return span<const char>(memory, length);
+}
 
-QAbstractItemModel *repository_controller::get_commit_model()
+void repository_controller::clear_row_texts()
 {
-	return &clist_model;
+	row_texts.clear();
+	row_text_index.clear();
 }
 
 QAbstractItemModel *repository_controller::get_ref_model()
@@ -56,315 +149,435 @@ QAbstractItemModel *repository_controller::get_commit_file_model()
 	return &cfile_model;
 }
 
-void repository_controller::insert_ref(const char *ref_name, ref_item *parent, std::map<QString, ref_item> &map, ref_map::refs_ordered_map::iterator ref_iter)
+/* appends the children of parent to ref_items, the caller is responsible for linking them to parent */
+uint32_t repository_controller::add_ref_item_children(uint32_t parent, uint32_t begin, uint32_t end, uint32_t name_begin)
 {
-	const char *ptr = strchr(ref_name, '/');
-	if (ptr != nullptr) {
-		QString name = QString::fromUtf8(ref_name, ptr - ref_name);
-		ref_item item((QString(name)), parent);
-		auto it = map.insert(std::make_pair(name, std::move(item))).first;
-		insert_ref(ptr + 1, &it->second, it->second.children_map, ref_iter);
-	} else {
-		QString name = QString::fromUtf8(ref_name);
-		ref_item item((QString(name)), ref_iter, parent);
-		map.insert(std::make_pair(name, std::move(item)));
+	return add_name_tree_children(ref_items, parent, begin, end, name_begin, [this] (uint32_t i) {
+		const ref_map::ref &ref = refs.refs[i];
+		return name_tree_name{ ref.name, ref.name_len };
+	});
+}
+
+QString repository_controller::ref_item_name(const name_tree_item &item) const
+{
+	const char *name = refs.refs[item.begin].name;
+	return QString::fromUtf8(name + item.name_begin, item.name_end - item.name_begin);
+}
+
+Qt::CheckState repository_controller::ref_item_check_state(const name_tree_item &item) const
+{
+	const size_t num_active = refs.count_active_refs(item.begin, item.end);
+	if (num_active == 0)
+		return Qt::Unchecked;
+	else if (num_active == item.end - item.begin)
+		return Qt::Checked;
+	else
+		return Qt::PartiallyChecked;
+}
+
+void repository_controller::display_refs()
+{
+	ref_items.clear();
+
+	/* only the top level is created here, the rest is loaded by ref_model::fetchMore as nodes are expanded */
+	num_top_level_ref_items = add_ref_item_children(name_tree_no_parent, 0, refs.refs.size(), sizeof("refs/") - 1);
+}
+
+void repository_controller::build_ref_labels()
+{
+	ref_labels.clear();
+
+	/* the refs pointing to the same commit are next to each other in refs_by_target */
+	ref_map::target_iterator it = refs.refs_by_target.cbegin();
+	while (it != refs.refs_by_target.cend()) {
+		const git_oid &target = refs.refs[*it].target;
+		update_ref_label(target);
+
+		it = refs.find_target(target).second;
 	}
 }
 
-void repository_controller::convert_ref_items_to_vectors()
+/* updates the labels of the commits pointed to by the refs in [begin, end) after they were toggled */
+void repository_controller::update_ref_labels(uint32_t begin, uint32_t end)
 {
-	ref_items_vec.insert(
-			ref_items_vec.begin(),
-			std::make_move_iterator(ref_items_map.begin()),
-			std::make_move_iterator(ref_items_map.end()));
+	/* rebuilding is cheaper than looking up the targets one by one once most of the refs changed */
+	if ((end - begin) * 2 > refs.refs.size()) {
+		build_ref_labels();
+		return;
+	}
 
-	ref_items_map.clear();
+	std::vector<git_oid> targets;
+	targets.reserve(end - begin);
+	for (uint32_t i = begin; i < end; i++)
+		targets.push_back(refs.refs[i].target);
 
-	for (auto &it : ref_items_vec)
-		it.second.convert_to_vector();
+	std::sort(targets.begin(), targets.end(), [] (const git_oid &lhs, const git_oid &rhs) {
+		return git_oid_cmp(&lhs, &rhs) < 0;
+	});
+	targets.erase(std::unique(targets.begin(), targets.end(), [] (const git_oid &lhs, const git_oid &rhs) {
+		return git_oid_equal(&lhs, &rhs);
+	}), targets.end());
+
+	for (const git_oid &target : targets)
+		update_ref_label(target);
 }
 
-void repository_controller::display_refs()
+void repository_controller::update_ref_label(const git_oid &target)
 {
-	for (ref_map::refs_ordered_map::iterator it = refs.refs_ordered.begin(); it != refs.refs_ordered.end(); it++)
-		insert_ref(it->first + sizeof("refs/") - 1, nullptr, ref_items_map, it);
+	std::string label;
+
+	auto ref_range = refs.find_target(target);
+	for (auto it = ref_range.first; it != ref_range.second; it++) {
+		if (!refs.is_ref_active(*it))
+			/* ref is not active, don't show it */
+			continue;
+
+		if (!label.empty())
+			label += ' ';
+
+		label += refs.refs[*it].shorthand();
+	}
 
-	convert_ref_items_to_vectors();
+	if (label.empty())
+		ref_labels.erase(target);
+	else
+		ref_labels[target] = std::move(label);
 }
 
-void repository_controller::display_commits()
+void repository_controller::add_commit_rows(const std::vector<git::commit> &commits, const graph_rows &rows)
 {
-	size_t i = 0;
-	auto last_event_loop_time = std::chrono::steady_clock::now();
+	TRACE_SCOPE("repository_controller::add_commit_rows");
 
-	while (!clist.empty()) {
-		struct commit_graph_info graph;
-		git::commit commit = clist.get_next_commit(graph);
+	if (commits.empty())
+		return;
 
-		graph_char graph_buf[preferences::max_line_length];
-		size_t graph_size = glist.compute_graph(graph, graph_buf);
+	const size_t old_graph_width = graph_width;
 
-		QChar refs_buf[preferences::max_line_length];
-		size_t refs_size = 0;
+	for (size_t i = 0; i < commits.size(); i++) {
+		const git::commit &commit = commits[i];
 
-		if (refs.refs.count(*commit.id()) > 0) {
-			auto ref_range = refs.refs.equal_range(*commit.id());
-			for (auto &it = ref_range.first; it != ref_range.second; it++) {
-				if (!it->second.second)
-					/* ref is not active, don't show it */
-					continue;
+		const size_t graph_begin = i > 0 ? rows.row_ends[i - 1] : 0;
+		const size_t graph_size = rows.row_ends[i] - graph_begin;
+		graph_width = std::max(graph_width, graph_size);
+		graph_char *graph_str_memory = row_arena.allocate<graph_char>(graph_size);
+		memcpy(graph_str_memory, rows.chars.data() + graph_begin, graph_size * sizeof(graph_char));
 
-				add_utf8_str_to_buf(refs_buf, it->second.first.shorthand(), refs_size);
-			}
-		}
+		/* the text is kept as UTF-8 and only decoded when its row is shown, the label is
+		 * copied as the table entry is replaced when its refs are toggled */
+		const auto ref_label = ref_labels.find(*commit.id());
+		const span<const char> refs_text = ref_label != ref_labels.end() ?
+				copy_row_text(ref_label->second.data(), ref_label->second.size()) : span<const char>();
 
-		QChar summary_buf[preferences::max_line_length];
-		size_t summary_size = 0;
 		const char *summary = commit.summary();
-		add_utf8_str_to_buf(summary_buf, summary, summary_size);
+		const span<const char> summary_text = copy_row_text(summary, summary != nullptr ? strlen(summary) : 0);
 
-		char *graph_str_memory = block_alloc.allocate<char>(graph_size * sizeof(graph_char));
-		memcpy(graph_str_memory, graph_buf, graph_size * sizeof(graph_char));
+		clist_items.push_back({ *commit.id(), span<const graph_char>(graph_str_memory, graph_size), refs_text, summary_text });
+	}
 
-		QChar *refs_str_memory = block_alloc.allocate<QChar>(refs_size);
-		memcpy(refs_str_memory, refs_buf, refs_size * sizeof(QChar));
+	emit commit_rows_changed(clist_items.size());
 
-		QChar *summary_str_memory = block_alloc.allocate<QChar>(summary_size);
-		memcpy(summary_str_memory, summary_buf, summary_size * sizeof(QChar));
+	if (graph_width != old_graph_width)
+		emit graph_width_changed(graph_width);
+}
 
-		clist_model.beginInsertRows(QModelIndex(), clist_items.size(), clist_items.size());
+void repository_controller::display_commits()
+{
+	size_t i = 0;
+	auto last_event_loop_time = std::chrono::steady_clock::now();
+
+	/* commits are walked in batches, the graph of each batch is laid out on another
+	 * thread while the next batch is walked and the batch is then added to the model at once */
+	std::vector<git::commit> commits;
+	std::vector<commit_graph_info> graphs;
+	std::vector<git::commit> laid_out_commits;
+	graph_layout layout(glist);
 
-		clist_items.emplace_back(*commit.id(),
-				QByteArray::fromRawData(graph_str_memory, graph_size * sizeof(graph_char)),
-				QString::fromRawData(refs_str_memory, refs_size),
-				QString::fromRawData(summary_str_memory, summary_size));
+	display_in_progress = true;
+	display_cancelled = false;
 
-		clist_model.endInsertRows();
+	while (!clist.empty()) {
+		graphs.emplace_back();
+		commits.push_back(clist.get_next_commit(graphs.back()));
 
-		i++;
 		const auto now = std::chrono::steady_clock::now();
 		const long duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_event_loop_time).count();
 
 		if (duration > preferences::window_update_interval) {
+			add_commit_rows(laid_out_commits, layout.wait());
+			i += laid_out_commits.size();
+			laid_out_commits = std::move(commits);
+			commits.clear();
+
 			update_status_func(QString::number(i));
 			qApp->processEvents();
-			last_event_loop_time = now;
+			last_event_loop_time = std::chrono::steady_clock::now();
+
+			/* a reload was requested while processing events, the rows shown so far are thrown away */
+			if (display_cancelled) {
+				display_in_progress = false;
+				return;
+			}
+
+			/* the layout only starts after the events are processed, as they can change the lane policy of glist */
+			layout.start(std::move(graphs));
+			graphs.clear();
 		}
 	}
+
+	add_commit_rows(laid_out_commits, layout.wait());
+	layout.start(std::move(graphs));
+	add_commit_rows(commits, layout.wait());
+	display_in_progress = false;
 }
 
 void repository_controller::reload_commits()
 {
+	/* the commit list cannot be reset while it is being walked, so wait for the walk to stop */
+	if (display_in_progress) {
+		request_reload();
+		return;
+	}
+
+	reload_timer.stop();
+
 	clist.initialize(refs);
 	glist.initialize();
 
-	clist_model.beginRemoveRows(QModelIndex(), 0, clist_items.size() - 1);
-
-	clist_items.clear();
-	block_alloc.clear();
+	if (!clist_items.empty()) {
+		/* the view lets go of the rows before their memory is freed */
+		clist_items.clear();
+		emit commit_rows_changed(0);
+		clear_row_texts();
+		row_arena.clear();
+	}
 
-	clist_model.endRemoveRows();
+	graph_width = 0;
+	emit graph_width_changed(graph_width);
 
 	display_commits();
 }
 
-void repository_controller::handle_commit_table_row_changed(const QModelIndex &current, const QModelIndex &previous)
+void repository_controller::request_reload()
 {
-	(void) previous;
-
-	cfile_model.beginRemoveRows(QModelIndex(), 0, cfile_items.size() - 1);
-	cfile_items.clear();
-	cfile_model.endRemoveRows();
+	if (display_in_progress)
+		display_cancelled = true;
 
-	if (!current.isValid()) {
-		commit_info_text_changed(QString());
-		return;
-	}
+	/* restarting the timer pushes the reload back until the changes stop */
+	reload_timer.start();
+}
 
-	git_oid *oid = &clist_items[current.row()].commit_id;
-	git::commit commit = clist.get_commit_by_id(oid);
+void repository_controller::handle_reload_timeout()
+{
+	/* the timer can fire from the event processing of a walk that was cancelled but has not returned yet */
+	if (display_in_progress)
+		reload_timer.start();
+	else
+		reload_commits();
+}
 
-	commit_info_text_changed(QString(commit.message()));
+size_t repository_controller::set_refs_active_matching(const std::string &pattern, ref_pattern_syntax syntax, bool is_active)
+{
+	const size_t num_matched = refs.set_refs_active_matching(pattern, syntax, is_active);
+	if (num_matched == 0)
+		return 0;
 
-	git::tree tree_a = commit.tree();
-	git::tree tree_b(nullptr);
-	if (commit.parentcount() != 0)
-		tree_b = commit.parent(0).tree();
+	build_ref_labels();
+	r_model.emit_all_check_states_changed();
+	request_reload();
 
-	diff = repo.diff_tree_to_tree(tree_b, tree_a, nullptr);
+	return num_matched;
+}
 
-	const auto file_cb = [this](const git_diff_delta *delta, float progress) {
-		(void) progress;
+/* the new policy takes effect on the next call to reload_commits */
+void repository_controller::set_graph_lane_policy(graph_lane_policy policy)
+{
+	prefs.lane_policy = policy;
+	glist.set_lane_policy(policy);
+}
 
-		cfile_model.beginInsertRows(QModelIndex(), cfile_items.size(), cfile_items.size());
-		cfile_items.push_back(delta);
-		cfile_model.endInsertRows();
+/* the new setting takes effect on the next diff that is requested */
+void repository_controller::set_find_similar(bool find_similar)
+{
+	prefs.find_similar = find_similar;
+	dworker.set_find_similar(find_similar);
+}
 
-		return 0;
-	};
-	diff._foreach(file_cb, nullptr, nullptr, nullptr);
+/* the new setting takes effect on the next diff that is requested */
+void repository_controller::set_combined_diff(bool combined_diff)
+{
+	prefs.combined_diff = combined_diff;
+	dworker.set_combined(combined_diff);
 }
 
-void repository_controller::handle_file_list_row_changed(const QModelIndex &current, const QModelIndex &previous)
+void repository_controller::handle_commit_row_changed(int64_t row)
 {
-	(void) previous;
-	if (current.isValid()) {
-		int idx = current.row();
-		patch = diff.get_patch(idx);
-
-		QString text;
-		for (size_t i = 0; i < patch.num_hunks(); i++) {
-			const git_diff_hunk *hunk = patch.get_hunk(i);
-			text = text.append(hunk->header);
-			for (int j = 0; j < patch.num_lines_in_hunk(i); j++) {
-				const git_diff_line *line = patch.get_line_in_hunk(i, j);
-				text = text.append(QString::fromUtf8(line->content, line->content_len));
-			}
-		}
+	clear_file_rows();
 
-		diff_view_text_changed(text);
-		diff_view_visible(true);
-	} else {
-		diff_view_visible(false);
+	if (row < 0 || static_cast<uint64_t>(row) >= clist_items.size()) {
+		dworker.cancel();
+		commit_info_text_changed(QString());
+		return;
 	}
-}
 
-repository_controller::commit_item::commit_item(const git_oid &commit_id, QByteArray &&graph, QString &&refs, QString &&summary) :
-	commit_id(commit_id),
-	graph(std::move(graph)),
-	refs(std::move(refs)),
-	summary(std::move(summary))
-{}
-
-repository_controller::commit_item::commit_item(commit_item &&other) noexcept :
-	commit_id(other.commit_id),
-	graph(std::move(other.graph)),
-	refs(std::move(other.refs)),
-	summary(std::move(other.summary))
-{}
+	git_oid *oid = &clist_items[row].commit_id;
+	git::commit commit = clist.get_commit_by_id(oid);
 
-repository_controller::commit_item &repository_controller::commit_item::operator=(commit_item &&other) noexcept
-{
-	commit_id = other.commit_id;
-	graph = std::move(other.graph);
-	refs = std::move(other.refs);
-	summary = std::move(other.summary);
+	commit_info_text_changed(QString(commit.message()));
 
-	return *this;
+	/* the files are added to the list as the worker finds them, followed by their stats */
+	diff_row = row;
+	diff_commit_id = *oid;
+	diff_generation = dworker.request_diff(*oid, [this] (uint64_t generation, std::vector<diff_file> &&files, bool finished) {
+		QMetaObject::invokeMethod(this, [this, generation, files = std::move(files), finished] () mutable {
+			add_file_rows(generation, std::move(files), finished);
+		}, Qt::QueuedConnection);
+	}, [this] (uint64_t generation, size_t first_index, std::vector<diff_stats> &&stats) {
+		QMetaObject::invokeMethod(this, [this, generation, first_index, stats = std::move(stats)] () mutable {
+			add_file_stats(generation, first_index, std::move(stats));
+		}, Qt::QueuedConnection);
+	});
 }
 
-commit_model::commit_model(repository_controller &repo_ctrl, QObject *parent) :
-	QAbstractTableModel(parent),
-	repo_ctrl(repo_ctrl)
-{}
-
-int commit_model::rowCount(const QModelIndex &parent) const
+void repository_controller::clear_file_rows()
 {
-	(void)parent;
-	return repo_ctrl.clist_items.size();
-}
+	const int num_rows = cfile_model.rowCount();
+	if (num_rows > 0)
+		cfile_model.beginRemoveRows(QModelIndex(), 0, num_rows - 1);
 
-int commit_model::columnCount(const QModelIndex &parent) const
-{
-	(void)parent;
-	return 3;
+	cfile_items.clear();
+	cfile_stats.clear();
+	cfile_tree_built = false;
+	sorted_cfiles.clear();
+	cfile_tree_items.clear();
+	num_top_level_cfile_tree_items = 0;
+
+	if (num_rows > 0)
+		cfile_model.endRemoveRows();
 }
 
-QVariant commit_model::data(const QModelIndex &index, int role) const
+void repository_controller::add_file_rows(uint64_t generation, std::vector<diff_file> &&files, bool finished)
 {
-	if (!index.isValid())
-		return QVariant();
+	TRACE_SCOPE("repository_controller::add_file_rows");
 
-	if (role == Qt::DisplayRole) {
-		switch (index.column()) {
-		case 0:
-			return repo_ctrl.clist_items[index.row()].graph;
-		case 1:
-			return repo_ctrl.clist_items[index.row()].refs;
-		case 2:
-			return repo_ctrl.clist_items[index.row()].summary;
+	/* the selection changed since this diff was requested */
+	if (generation != diff_generation)
+		return;
+
+	if (!finished) {
+		/* the whole batch is added at once so that huge diffs do not insert rows one by one */
+		if (!files.empty()) {
+			cfile_model.beginInsertRows(QModelIndex(), cfile_items.size(), cfile_items.size() + files.size() - 1);
+			cfile_items.insert(cfile_items.end(), std::make_move_iterator(files.begin()), std::make_move_iterator(files.end()));
+			cfile_model.endInsertRows();
 		}
+
+		return;
 	}
 
-	if (role == Qt::FontRole) {
-		switch (index.column()) {
-		case 0:
-			return QFontDatabase::systemFont(QFontDatabase::FixedFont);
-		}
+	/* the flat list shown while the files streamed in is replaced by the tree */
+	if (!cfile_items.empty()) {
+		cfile_model.beginRemoveRows(QModelIndex(), 0, cfile_items.size() - 1);
+		cfile_tree_built = true;
+		cfile_model.endRemoveRows();
 	}
 
-	return QVariant();
-}
+	cfile_tree_built = true;
+	cfile_items.insert(cfile_items.end(), std::make_move_iterator(files.begin()), std::make_move_iterator(files.end()));
 
-QVariant commit_model::headerData(int section, Qt::Orientation orientation, int role) const
-{
-	if (role == Qt::DisplayRole && orientation == Qt::Horizontal) {
-		switch (section) {
-		case 0:
-			return QString(tr("Graph"));
-		case 1:
-			return QString(tr("Refs"));
-		case 2:
-			return QString(tr("Summary"));
-		}
+	/* the top level is not reachable from the model until its size is set below */
+	const uint32_t num_top_level = build_cfile_tree();
+	if (num_top_level > 0) {
+		cfile_model.beginInsertRows(QModelIndex(), 0, num_top_level - 1);
+		num_top_level_cfile_tree_items = num_top_level;
+		cfile_model.endInsertRows();
 	}
 
-	return QVariant();
+	update_status_func(tr("%n file(s) changed", nullptr, static_cast<int>(cfile_items.size())));
+
+	/* warm the cache with the commits around the selection while the user looks at this one */
+	std::vector<git_oid> neighbours;
+	for (size_t distance = 1; distance <= preferences::diff_prefetch_distance; distance++) {
+		if (diff_row + distance < clist_items.size())
+			neighbours.push_back(clist_items[diff_row + distance].commit_id);
+		if (diff_row >= distance)
+			neighbours.push_back(clist_items[diff_row - distance].commit_id);
+	}
+
+	dworker.prefetch_diffs(std::move(neighbours));
 }
 
-repository_controller::ref_item::ref_item(QString &&name, ref_item *parent) :
-	name(std::move(name)),
-	parent(parent)
-{}
+void repository_controller::add_file_stats(uint64_t generation, size_t first_index, std::vector<diff_stats> &&stats)
+{
+	TRACE_SCOPE("repository_controller::add_file_stats");
 
-repository_controller::ref_item::ref_item(QString &&name, ref_map::refs_ordered_map::iterator ref_iter, ref_item *parent) :
-	name(std::move(name)),
-	ref_iter(ref_iter),
-	parent(parent)
-{}
+	if (generation != diff_generation || first_index + stats.size() > cfile_items.size())
+		return;
 
-repository_controller::ref_item::ref_item(ref_item &&other) noexcept :
-	name(std::move(other.name)),
-	ref_iter(other.ref_iter),
-	children_map(std::move(other.children_map)),
-	children_vec(std::move(other.children_vec)),
-	parent(other.parent)
-{}
+	if (cfile_stats.empty())
+		cfile_stats.resize(cfile_items.size());
 
-repository_controller::ref_item &repository_controller::ref_item::operator=(ref_item &&other) noexcept
+	std::copy(stats.begin(), stats.end(), cfile_stats.begin() + first_index);
+	cfile_model.emit_loaded_data_changed();
+}
+
+void repository_controller::handle_file_list_row_changed(const QModelIndex &current, const QModelIndex &previous)
 {
-	name = std::move(other.name);
-	ref_iter = other.ref_iter;
-	children_map = std::move(other.children_map);
-	children_vec = std::move(other.children_vec);
-	parent = other.parent;
+	(void) previous;
+
+	/* directories have no patch to show */
+	const size_t file_index = cfile_index(current);
+	if (file_index != SIZE_MAX) {
+		patch_generation = dworker.request_patch(diff_commit_id, file_index, cfile_items[file_index], [this] (uint64_t generation, std::shared_ptr<const diff_patch> patch) {
+			QMetaObject::invokeMethod(this, [this, generation, patch] () {
+				TRACE_SCOPE("repository_controller::show_patch");
 
-	return *this;
+				if (generation != patch_generation)
+					return;
+
+				diff_view_patch_changed(patch);
+				diff_view_visible(true);
+			}, Qt::QueuedConnection);
+		});
+	} else {
+		diff_view_visible(false);
+	}
 }
 
-void repository_controller::ref_item::convert_to_vector()
+/* sorts the changed files by path and creates the top level of their tree, returns the number of top level nodes */
+uint32_t repository_controller::build_cfile_tree()
 {
-	/* if there is only one child collapse the hierarchy */
-	while (children_map.size() == 1) {
-		std::pair<QString, ref_item> pair = std::move(*std::make_move_iterator(children_map.begin()));
-		name = name + "/" + pair.second.name;
-		ref_iter = std::move(pair.second.ref_iter);
-		children_map = std::move(pair.second.children_map);
-	}
+	sorted_cfiles.resize(cfile_items.size());
+	std::iota(sorted_cfiles.begin(), sorted_cfiles.end(), 0);
+	std::sort(sorted_cfiles.begin(), sorted_cfiles.end(), [this] (uint32_t lhs, uint32_t rhs) {
+		return cfile_items[lhs].new_path < cfile_items[rhs].new_path;
+	});
+
+	/* only the top level is created here, the rest is loaded by commit_file_model::fetchMore */
+	cfile_tree_items.clear();
+	return add_cfile_tree_children(name_tree_no_parent, 0, sorted_cfiles.size(), 0);
+}
 
-	/* move and convert the children */
-	children_vec.insert(
-			children_vec.begin(),
-			std::make_move_iterator(children_map.begin()),
-			std::make_move_iterator(children_map.end()));
+/* appends the children of parent to cfile_tree_items, the caller is responsible for linking them to parent */
+uint32_t repository_controller::add_cfile_tree_children(uint32_t parent, uint32_t begin, uint32_t end, uint32_t name_begin)
+{
+	return add_name_tree_children(cfile_tree_items, parent, begin, end, name_begin, [this] (uint32_t i) {
+		const std::string &path = cfile_items[sorted_cfiles[i]].new_path;
+		return name_tree_name{ path.data(), static_cast<uint32_t>(path.size()) };
+	});
+}
 
-	children_map.clear();
+/* returns the index in cfile_items of the file at index, or SIZE_MAX if index is not a file */
+size_t repository_controller::cfile_index(const QModelIndex &index) const
+{
+	if (!index.isValid())
+		return SIZE_MAX;
 
-	for (size_t i = 0; i < children_vec.size(); i++) {
-		children_vec[i].second.index_in_parent = i;
-		children_vec[i].second.parent = this;
-		children_vec[i].second.convert_to_vector();
-	}
+	if (!cfile_tree_built)
+		return index.internalId();
+
+	/* directories with a single file are merged into it, so a node with one file is always that file */
+	const name_tree_item &item = cfile_tree_items[index.internalId()];
+	return item.has_children() ? SIZE_MAX : sorted_cfiles[item.begin];
 }
 
 ref_model::ref_model(repository_controller &repo_ctrl, QObject *parent) :
@@ -375,9 +588,9 @@ ref_model::ref_model(repository_controller &repo_ctrl, QObject *parent) :
 int ref_model::rowCount(const QModelIndex &parent) const
 {
 	if (parent.isValid())
-		return static_cast<repository_controller::ref_item *>(parent.internalPointer())->children_vec.size();
+		return repo_ctrl.ref_items[parent.internalId()].num_children;
 	else
-		return repo_ctrl.ref_items_vec.size();
+		return repo_ctrl.num_top_level_ref_items;
 }
 
 int ref_model::columnCount(const QModelIndex &parent) const
@@ -391,16 +604,16 @@ QVariant ref_model::data(const QModelIndex &index, int role) const
 	if (!index.isValid())
 		return QVariant();
 
-	auto item = static_cast<repository_controller::ref_item *>(index.internalPointer());
+	const name_tree_item &item = repo_ctrl.ref_items[index.internalId()];
 
 	if (role == Qt::CheckStateRole) {
-		return item->checked;
+		return repo_ctrl.ref_item_check_state(item);
 	}
 
 	if (role == Qt::DisplayRole) {
 		switch (index.column()) {
 		case 0:
-			return item->name;
+			return repo_ctrl.ref_item_name(item);
 		}
 	}
 
@@ -415,57 +628,14 @@ bool ref_model::setData(const QModelIndex &index, const QVariant &value, int rol
 	if (role == Qt::CheckStateRole) {
 		Qt::CheckState state = value.value<Qt::CheckState>();
 
-		/* set the check state for all of the child items recursively */
-		std::function<void(const QModelIndex)> set_children = [this, state, &set_children] (const QModelIndex &index) {
-			auto item = static_cast<repository_controller::ref_item *>(index.internalPointer());
-			item->checked = state;
-			if (item->children_vec.size() == 0)
-				repo_ctrl.refs.set_ref_active(item->ref_iter, state == Qt::Checked);
-
-			for (size_t i = 0; i < item->children_vec.size(); i++)
-				set_children(ref_model::index(i, 0, index));
-
-			int rows = rowCount(index);
-			if (rows > 0)
-				emit dataChanged(
-						ref_model::index(0, 0, index),
-						ref_model::index(rows - 1, 0, index),
-						{ Qt::CheckStateRole });
-		};
-
-		set_children(index);
-
-		/* iterate up through the parents and set the check state */
-		QModelIndex index_it = index;
-		while (true) {
-			auto item = static_cast<repository_controller::ref_item *>(index_it.internalPointer());
-			if (item->parent != nullptr) {
-				Qt::CheckState new_parent_state = item->checked;
-				for (auto &it : item->parent->children_vec) {
-					if (new_parent_state != it.second.checked) {
-						new_parent_state = Qt::PartiallyChecked;
-						break;
-					}
-				}
-
-				if (new_parent_state != item->parent->checked) {
-					item->parent->checked = new_parent_state;
-					index_it = parent(index_it);
-					emit dataChanged(
-							ref_model::index(0, 0, index),
-							ref_model::index(0, 0, index),
-							{ Qt::CheckStateRole });
-				} else {
-					/* parent didn't change, short circuit */
-					break;
-				}
-			} else {
-				/* no more parents */
-				break;
-			}
-		}
+		/* the check state of every node is worked out from the refs, so only the refs need to change */
+		const name_tree_item &item = repo_ctrl.ref_items[index.internalId()];
+		repo_ctrl.refs.set_refs_active(item.begin, item.end, state == Qt::Checked);
+		repo_ctrl.update_ref_labels(item.begin, item.end);
+
+		emit_check_state_changed(index);
 
-		repo_ctrl.reload_commits();
+		repo_ctrl.request_reload();
 
 		return true;
 	}
@@ -473,6 +643,38 @@ bool ref_model::setData(const QModelIndex &index, const QVariant &value, int rol
 	return false;
 }
 
+void ref_model::emit_check_state_changed(const QModelIndex &index)
+{
+	/* update the children that have been loaded */
+	std::function<void(const QModelIndex &)> emit_children = [this, &emit_children] (const QModelIndex &index) {
+		const name_tree_item &item = repo_ctrl.ref_items[index.internalId()];
+		if (item.num_children == 0)
+			return;
+
+		emit dataChanged(
+				ref_model::index(0, 0, index),
+				ref_model::index(item.num_children - 1, 0, index),
+				{ Qt::CheckStateRole });
+
+		for (uint32_t i = 0; i < item.num_children; i++)
+			emit_children(ref_model::index(i, 0, index));
+	};
+
+	emit dataChanged(index, index, { Qt::CheckStateRole });
+	emit_children(index);
+
+	/* update the parents */
+	for (QModelIndex index_it = parent(index); index_it.isValid(); index_it = parent(index_it))
+		emit dataChanged(index_it, index_it, { Qt::CheckStateRole });
+}
+
+void ref_model::emit_all_check_states_changed()
+{
+	/* the top level nodes have no parents, so this updates each of them and their loaded children */
+	for (uint32_t i = 0; i < repo_ctrl.num_top_level_ref_items; i++)
+		emit_check_state_changed(index(i, 0));
+}
+
 QVariant ref_model::headerData(int section, Qt::Orientation orientation, int role) const
 {
 	(void)section;
@@ -484,7 +686,7 @@ QVariant ref_model::headerData(int section, Qt::Orientation orientation, int rol
 Qt::ItemFlags ref_model::flags(const QModelIndex &index) const
 {
 	if (index.isValid()) {
-		if (rowCount(index) == 0)
+		if (!hasChildren(index))
 			return Qt::ItemIsEnabled | Qt::ItemIsUserCheckable;
 		else
 			return Qt::ItemIsEnabled | Qt::ItemIsUserCheckable | Qt::ItemIsAutoTristate;
@@ -499,11 +701,8 @@ QModelIndex ref_model::index(int row, int column, const QModelIndex &parent) con
 	if (!hasIndex(row, column, parent))
 		return QModelIndex();
 
-	std::vector<std::pair<QString, repository_controller::ref_item>> &vec = parent.isValid() ?
-			static_cast<repository_controller::ref_item *>(parent.internalPointer())->children_vec :
-			repo_ctrl.ref_items_vec;
-
-	return createIndex(row, column, &vec[row].second);
+	const uint32_t first_child = parent.isValid() ? repo_ctrl.ref_items[parent.internalId()].first_child : 0;
+	return createIndex(row, column, (quintptr)(first_child + row));
 }
 
 QModelIndex ref_model::parent(const QModelIndex &index) const
@@ -511,23 +710,72 @@ QModelIndex ref_model::parent(const QModelIndex &index) const
 	if (!index.isValid())
 		return QModelIndex();
 
-	repository_controller::ref_item *item = static_cast<repository_controller::ref_item *>(index.internalPointer());
-	if (item->parent == nullptr)
+	const name_tree_item &item = repo_ctrl.ref_items[index.internalId()];
+	if (item.parent == name_tree_no_parent)
 		return QModelIndex();
 	else
-		return createIndex(item->index_in_parent, 0, item->parent);
+		return createIndex(repo_ctrl.ref_items[item.parent].index_in_parent, 0, (quintptr)item.parent);
+}
+
+bool ref_model::hasChildren(const QModelIndex &parent) const
+{
+	if (parent.isValid())
+		return repo_ctrl.ref_items[parent.internalId()].has_children();
+	else
+		return repo_ctrl.num_top_level_ref_items > 0;
+}
+
+bool ref_model::canFetchMore(const QModelIndex &parent) const
+{
+	if (!parent.isValid())
+		return false;
+
+	const name_tree_item &item = repo_ctrl.ref_items[parent.internalId()];
+	return item.has_children() && !item.children_loaded;
+}
+
+void ref_model::fetchMore(const QModelIndex &parent)
+{
+	if (!canFetchMore(parent))
+		return;
+
+	const uint32_t item_index = parent.internalId();
+	const uint32_t first_child = repo_ctrl.ref_items.size();
+
+	/* the new children are not reachable from the model until they are linked to the parent below */
+	const name_tree_item item = repo_ctrl.ref_items[item_index];
+	const uint32_t num_children = repo_ctrl.add_ref_item_children(item_index, item.begin, item.end, item.name_end + 1);
+
+	beginInsertRows(parent, 0, num_children - 1);
+
+	name_tree_item &parent_item = repo_ctrl.ref_items[item_index];
+	parent_item.first_child = first_child;
+	parent_item.num_children = num_children;
+	parent_item.children_loaded = true;
+
+	endInsertRows();
 }
 
 commit_file_model::commit_file_model(repository_controller &repo_ctrl, QObject *parent) :
-	QAbstractListModel(parent),
+	QAbstractItemModel(parent),
 	repo_ctrl(repo_ctrl)
 {}
 
 int commit_file_model::rowCount(const QModelIndex &parent) const
 {
-	(void) parent;
+	if (!repo_ctrl.cfile_tree_built)
+		return parent.isValid() ? 0 : repo_ctrl.cfile_items.size();
 
-	return repo_ctrl.cfile_items.size();
+	if (parent.isValid())
+		return repo_ctrl.cfile_tree_items[parent.internalId()].num_children;
+	else
+		return repo_ctrl.num_top_level_cfile_tree_items;
+}
+
+int commit_file_model::columnCount(const QModelIndex &parent) const
+{
+	(void)parent;
+	return 1;
 }
 
 QVariant commit_file_model::data(const QModelIndex &index, int role) const
@@ -535,11 +783,66 @@ QVariant commit_file_model::data(const QModelIndex &index, int role) const
 	if (!index.isValid())
 		return QVariant();
 
-	if (role != Qt::DisplayRole)
+	if (role != Qt::DisplayRole && role != Qt::ToolTipRole)
 		return QVariant();
 
-	const git_diff_delta *delta = repo_ctrl.cfile_items[index.row()];
-	return QString(delta->new_file.path);
+	if (!repo_ctrl.cfile_tree_built) {
+		const std::string &path = repo_ctrl.cfile_items[index.internalId()].new_path;
+		return QString::fromUtf8(path.data(), path.size());
+	}
+
+	const name_tree_item &item = repo_ctrl.cfile_tree_items[index.internalId()];
+	const std::string &path = repo_ctrl.cfile_items[repo_ctrl.sorted_cfiles[item.begin]].new_path;
+
+	if (role == Qt::ToolTipRole) {
+		if (item.has_children())
+			return QVariant();
+
+		/* renamed and copied files show where they came from */
+		const diff_file &file = repo_ctrl.cfile_items[repo_ctrl.sorted_cfiles[item.begin]];
+		if (file.status == GIT_DELTA_RENAMED || file.status == GIT_DELTA_COPIED)
+			return tr("%1 -> %2").arg(QString::fromUtf8(file.old_path.data(), file.old_path.size()),
+					QString::fromUtf8(path.data(), path.size()));
+
+		return QString::fromUtf8(path.data(), path.size());
+	}
+
+	QString name = QString::fromUtf8(path.data() + item.name_begin, item.name_end - item.name_begin);
+	if (item.has_children())
+		/* directories show how many changed files are under them */
+		return tr("%1 (%2)").arg(name, QString::number(item.end - item.begin));
+
+	const size_t file_index = repo_ctrl.sorted_cfiles[item.begin];
+	if (file_index >= repo_ctrl.cfile_stats.size() || !repo_ctrl.cfile_stats[file_index].computed)
+		return name;
+
+	const diff_stats &stats = repo_ctrl.cfile_stats[file_index];
+	if (stats.binary)
+		return tr("%1  Bin %2 -> %3 bytes").arg(name, QString::number(stats.old_size), QString::number(stats.new_size));
+	else
+		return tr("%1  +%2 -%3").arg(name, QString::number(stats.additions), QString::number(stats.deletions));
+}
+
+void commit_file_model::emit_loaded_data_changed()
+{
+	const int num_rows = rowCount();
+	if (num_rows == 0)
+		return;
+
+	emit dataChanged(index(0, 0), index(num_rows - 1, 0), { Qt::DisplayRole });
+	if (!repo_ctrl.cfile_tree_built)
+		return;
+
+	/* only the nodes that have been loaded can be shown, so only they need updating */
+	for (const name_tree_item &item : repo_ctrl.cfile_tree_items) {
+		if (item.num_children == 0)
+			continue;
+
+		emit dataChanged(
+				createIndex(0, 0, (quintptr)item.first_child),
+				createIndex(item.num_children - 1, 0, (quintptr)(item.first_child + item.num_children - 1)),
+				{ Qt::DisplayRole });
+	}
 }
 
 QVariant commit_file_model::headerData(int section, Qt::Orientation orientation, int role) const
@@ -550,3 +853,68 @@ QVariant commit_file_model::headerData(int section, Qt::Orientation orientation,
 
 	return QVariant();
 }
+
+QModelIndex commit_file_model::index(int row, int column, const QModelIndex &parent) const
+{
+	if (!hasIndex(row, column, parent))
+		return QModelIndex();
+
+	if (!repo_ctrl.cfile_tree_built)
+		return createIndex(row, column, (quintptr)row);
+
+	const uint32_t first_child = parent.isValid() ? repo_ctrl.cfile_tree_items[parent.internalId()].first_child : 0;
+	return createIndex(row, column, (quintptr)(first_child + row));
+}
+
+QModelIndex commit_file_model::parent(const QModelIndex &index) const
+{
+	if (!index.isValid() || !repo_ctrl.cfile_tree_built)
+		return QModelIndex();
+
+	const name_tree_item &item = repo_ctrl.cfile_tree_items[index.internalId()];
+	if (item.parent == name_tree_no_parent)
+		return QModelIndex();
+	else
+		return createIndex(repo_ctrl.cfile_tree_items[item.parent].index_in_parent, 0, (quintptr)item.parent);
+}
+
+bool commit_file_model::hasChildren(const QModelIndex &parent) const
+{
+	if (!parent.isValid())
+		return rowCount(parent) > 0;
+	else if (!repo_ctrl.cfile_tree_built)
+		return false;
+	else
+		return repo_ctrl.cfile_tree_items[parent.internalId()].has_children();
+}
+
+bool commit_file_model::canFetchMore(const QModelIndex &parent) const
+{
+	if (!parent.isValid() || !repo_ctrl.cfile_tree_built)
+		return false;
+
+	const name_tree_item &item = repo_ctrl.cfile_tree_items[parent.internalId()];
+	return item.has_children() && !item.children_loaded;
+}
+
+void commit_file_model::fetchMore(const QModelIndex &parent)
+{
+	if (!canFetchMore(parent))
+		return;
+
+	const uint32_t item_index = parent.internalId();
+	const uint32_t first_child = repo_ctrl.cfile_tree_items.size();
+
+	/* the new children are not reachable from the model until they are linked to the parent below */
+	const name_tree_item item = repo_ctrl.cfile_tree_items[item_index];
+	const uint32_t num_children = repo_ctrl.add_cfile_tree_children(item_index, item.begin, item.end, item.name_end + 1);
+
+	beginInsertRows(parent, 0, num_children - 1);
+
+	name_tree_item &parent_item = repo_ctrl.cfile_tree_items[item_index];
+	parent_item.first_child = first_child;
+	parent_item.num_children = num_children;
+	parent_item.children_loaded = true;
+
+	endInsertRows();
+}
@@ -20,39 +20,31 @@
 #ifndef REPOSITORY_CONTROLLER_H
 #define REPOSITORY_CONTROLLER_H
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <functional>
+#include <list>
+#include <unordered_map>
+#include <vector>
 
-#include <QAbstractTableModel>
+#include <QAbstractItemModel>
 #include <QString>
+#include <QTimer>
 
 #include "compat/cpp_git.h"
 #include "core/commit_list.h"
+#include "core/diff_worker.h"
 #include "core/graph.h"
 #include "core/ref_map.h"
-#include "util/block_allocator.h"
+#include "util/arena.h"
+#include "util/memory_usage.h"
+#include "util/name_tree.h"
 #include "util/preferences.h"
+#include "util/span.h"
 
 class repository_controller;
 
-class commit_model : public QAbstractTableModel
-{
-	friend class repository_controller;
-
-	Q_OBJECT
-
-public:
-	commit_model(repository_controller &repo_ctrl, QObject *parent = nullptr);
-
-	int rowCount(const QModelIndex &parent = QModelIndex()) const override;
-	int columnCount(const QModelIndex &parent = QModelIndex()) const override;
-	QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
-	QVariant headerData(int section, Qt::Orientation orientation, int role) const override;
-
-private:
-	repository_controller &repo_ctrl;
-};
-
 class ref_model : public QAbstractItemModel
 {
 	friend class repository_controller;
@@ -70,12 +62,18 @@ public:
 	Qt::ItemFlags flags(const QModelIndex &index) const override;
 	QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
 	QModelIndex parent(const QModelIndex &index) const override;
+	bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+	bool canFetchMore(const QModelIndex &parent) const override;
+	void fetchMore(const QModelIndex &parent) override;
 
 private:
 	repository_controller &repo_ctrl;
+
+	void emit_check_state_changed(const QModelIndex &index);
+	void emit_all_check_states_changed();
 };
 
-class commit_file_model : public QAbstractListModel
+class commit_file_model : public QAbstractItemModel
 {
 	friend class repository_controller;
 
@@ -85,74 +83,94 @@ public:
 	commit_file_model(repository_controller &repo_ctrl, QObject *parent = nullptr);
 
 	int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+	int columnCount(const QModelIndex &parent = QModelIndex()) const override;
 	QVariant data(const QModelIndex &index, int role) const override;
 	QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
+	QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+	QModelIndex parent(const QModelIndex &index) const override;
+	bool hasChildren(const QModelIndex &parent = QModelIndex()) const override;
+	bool canFetchMore(const QModelIndex &parent) const override;
+	void fetchMore(const QModelIndex &parent) override;
 
 private:
 	repository_controller &repo_ctrl;
+
+	void emit_loaded_data_changed();
 };
 
 class repository_controller : public QObject
 {
-	friend class commit_model;
 	friend class ref_model;
 	friend class commit_file_model;
 
 	Q_OBJECT
 
 public:
+	/*!
+	 * \struct commit_row
+	 * \brief The contents of a row of the commit table, pointing into the storage of the controller
+	 *
+	 * Nothing is copied or reference counted to make a row. The text is
+	 * decoded into a small cache of recently shown rows, so the row is only
+	 * valid until the next row is asked for.
+	 */
+	struct commit_row
+	{
+		span<const graph_char> graph;
+		const QString *refs;
+		const QString *summary;
+	};
+
 	repository_controller(std::string &dir, std::function<void(const QString &)> update_status_func);
 
-	QAbstractItemModel *get_commit_model();
+	uint64_t num_commit_rows() const;
+	commit_row get_commit_row(uint64_t row) const;
+
+	/*!
+	 * \brief Estimate the memory held by each part of the repository and by libgit2
+	 * \return The usage of each part
+	 */
+	std::vector<memory_usage> get_memory_usage() const;
 	QAbstractItemModel *get_ref_model();
 	QAbstractItemModel *get_commit_file_model();
 
 	void display_refs();
 	void display_commits();
 	void reload_commits();
+	void request_reload();
+	size_t set_refs_active_matching(const std::string &pattern, ref_pattern_syntax syntax, bool is_active);
+	void set_graph_lane_policy(graph_lane_policy policy);
+	void set_find_similar(bool find_similar);
+	void set_combined_diff(bool combined_diff);
 
 public slots:
-	void handle_commit_table_row_changed(const QModelIndex &current, const QModelIndex &previous);
+	void handle_commit_row_changed(int64_t row);
 	void handle_file_list_row_changed(const QModelIndex &current, const QModelIndex &previous);
 
+private slots:
+	void handle_reload_timeout();
+
 signals:
 	void commit_info_text_changed(QString text);
-	void diff_view_text_changed(QString text);
+	void diff_view_patch_changed(std::shared_ptr<const diff_patch> patch);
 	void diff_view_visible(bool visible);
+	void graph_width_changed(int width);
+	void commit_rows_changed(uint64_t num_rows);
 
 private:
+	/* the graph characters and the UTF-8 text of each row are in row_arena */
 	struct commit_item
 	{
-		commit_item(const git_oid &commit_id, QByteArray &&graph, QString &&refs, QString &&summary);
-		commit_item(const commit_item &) = delete;
-		commit_item &operator=(const commit_item &) = delete;
-		commit_item(commit_item &&other) noexcept;
-		commit_item &operator=(commit_item &&) noexcept;
-
 		git_oid commit_id;
-		QByteArray graph;
-		QString refs;
-		QString summary;
+		span<const graph_char> graph;
+		span<const char> refs;
+		span<const char> summary;
 	};
 
-	struct ref_item
+	struct row_text
 	{
-		ref_item(QString &&name, ref_item *parent = nullptr);
-		ref_item(QString &&name, ref_map::refs_ordered_map::iterator ref_iter, ref_item *parent = nullptr);
-		ref_item(const commit_item &) = delete;
-		ref_item &operator=(const commit_item &) = delete;
-		ref_item(ref_item &&other) noexcept;
-		ref_item &operator=(ref_item &&) noexcept;
-
-		QString name;
-		int index_in_parent;
-		Qt::CheckState checked = Qt::Checked;
-		ref_map::refs_ordered_map::iterator ref_iter;
-		std::map<QString, ref_item> children_map;
-		std::vector<std::pair<QString, ref_item>> children_vec;
-		ref_item *parent = nullptr;
-
-		void convert_to_vector();
+		uint64_t key;
+		QString text;
 	};
 
 	git::repository repo;
@@ -163,23 +181,65 @@ private:
 	graph_list glist;
 
 	std::vector<commit_item> clist_items;
-	commit_model clist_model;
 
-	std::map<QString, ref_item> ref_items_map;
-	std::vector<std::pair<QString, ref_item>> ref_items_vec;
+	/* the text of the rows last shown, decoded from row_arena, the most recently used is at the front */
+	mutable std::list<row_text> row_texts;
+	mutable std::unordered_map<uint64_t, std::list<row_text>::iterator> row_text_index;
+	size_t graph_width = 0;
+
+	/* reloads are delayed so that changes made in quick succession only cause one */
+	QTimer reload_timer;
+	bool display_in_progress = false;
+	bool display_cancelled = false;
+
+	/* the label of each commit that active refs point to, updated as refs are toggled, the rows
+	 * copy their label into row_arena as it can change while the rows of the last walk are shown */
+	std::unordered_map<git_oid, std::string, git_oid_ref_hash, git_oid_ref_cmp> ref_labels;
+
+	/* the ref tree, the top level nodes come first */
+	std::vector<name_tree_item> ref_items;
+	uint32_t num_top_level_ref_items = 0;
 	ref_model r_model;
 
-	git::diff diff;
-	git::patch patch;
-	std::vector<const git_diff_delta *> cfile_items;
+	/* the diffs are computed in the background, results of superseded requests are dropped */
+	diff_worker dworker;
+	uint64_t diff_generation = 0;
+	uint64_t patch_generation = 0;
+	size_t diff_row = 0;
+	git_oid diff_commit_id;
+	std::vector<diff_file> cfile_items;
+	/* the stats of each file in cfile_items, filled in as the worker works them out */
+	std::vector<diff_stats> cfile_stats;
+
+	/* the files are listed flat while they stream in, once they are all known they are
+	 * sorted by path and shown as a tree that is built as its directories are expanded */
+	bool cfile_tree_built = false;
+	std::vector<uint32_t> sorted_cfiles;
+	std::vector<name_tree_item> cfile_tree_items;
+	uint32_t num_top_level_cfile_tree_items = 0;
 	commit_file_model cfile_model;
 
-	block_allocator block_alloc;
+	/* the graph and text of the commit rows, released all at once when the commits are reloaded */
+	arena row_arena;
 
 	std::function<void(const QString &)> update_status_func;
 
-	void insert_ref(const char *ref_name, ref_item *parent, std::map<QString, ref_item> &map, ref_map::refs_ordered_map::iterator ref_iter);
-	void convert_ref_items_to_vectors();
+	const QString &get_row_text(uint64_t key, span<const char> text) const;
+	span<const char> copy_row_text(const char *text, size_t length);
+	void clear_row_texts();
+	void build_ref_labels();
+	void update_ref_labels(uint32_t begin, uint32_t end);
+	void update_ref_label(const git_oid &target);
+	void clear_file_rows();
+	void add_file_rows(uint64_t generation, std::vector<diff_file> &&files, bool finished);
+	void add_file_stats(uint64_t generation, size_t first_index, std::vector<diff_stats> &&stats);
+	void add_commit_rows(const std::vector<git::commit> &commits, const graph_rows &rows);
+	uint32_t add_ref_item_children(uint32_t parent, uint32_t begin, uint32_t end, uint32_t name_begin);
+	QString ref_item_name(const name_tree_item &item) const;
+	Qt::CheckState ref_item_check_state(const name_tree_item &item) const;
+	uint32_t build_cfile_tree();
+	uint32_t add_cfile_tree_children(uint32_t parent, uint32_t begin, uint32_t end, uint32_t name_begin);
+	size_t cfile_index(const QModelIndex &index) const;
 };
 
 #endif /* REPOSITORY_CONTROLLER_H */
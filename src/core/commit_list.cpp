@@ -25,6 +25,7 @@
 #include "compat/cpp_git.h"
 #include "util/error.h"
 #include "util/preferences.h"
+#include "util/trace.h"
 
 #include "commit_list.h"
 #include "ref_map.h"
@@ -79,6 +80,7 @@ commit_list::graph_node::graph_node(graph_node &&other) noexcept :
 	commit(std::move(other.commit)),
 	time(other.time),
 	depth(other.depth),
+	parents_loaded(other.parents_loaded),
 	parents(std::move(other.parents)),
 	children(std::move(other.children))
 {}
@@ -88,6 +90,7 @@ commit_list::graph_node &commit_list::graph_node::operator=(graph_node &&other)
 	commit = std::move(other.commit);
 	time = other.time;
 	depth = other.depth;
+	parents_loaded = other.parents_loaded;
 	parents = std::move(other.parents);
 	children = std::move(other.children);
 	return *this;
@@ -95,60 +98,95 @@ commit_list::graph_node &commit_list::graph_node::operator=(graph_node &&other)
 
 commit_list::commit_list(const ref_map &refs, const git::repository &repo, const preferences &prefs) :
 	repo(repo),
-	prefs(prefs)
+	prefs(prefs),
+	node_arena(preferences::commit_arena_block_size),
+	commits_loaded(0, git_oid_ref_hash(), git_oid_ref_cmp(), arena_allocator<std::pair<const git_oid, graph_node>>(node_arena))
 {
-	initialize_bfs_queue(refs);
-	bfs(prefs.graph_approximation_factor);
 	initialize(refs);
 }
 
+/* orders the bfs queue heap so the shallowest node is on top */
+bool commit_list::bfs_queue_cmp(const graph_node *lhs, const graph_node *rhs)
+{
+	return lhs->depth > rhs->depth;
+}
+
+void commit_list::load_tip(const git_oid &target)
+{
+	if (commits_visited.count(target) > 0)
+		return;
+
+	git::commit commit = repo.commit_lookup(&target);
+	git_time_t time = commit.time();
+
+	commits_visited.insert(target);
+
+	graph_node new_graph_node(std::move(commit), time, 0);
+	auto ret = commits_loaded.emplace(target, std::move(new_graph_node));
+	bfs_queue.push_back(&ret.first->second);
+	std::push_heap(bfs_queue.begin(), bfs_queue.end(), bfs_queue_cmp);
+}
+
+void commit_list::load_parents(graph_node *node)
+{
+	git_time_t max_parent_time = 0;
+
+	for (unsigned int i = 0; i < node->commit.parentcount(); i++) {
+		const git_oid *parent_id = node->commit.parent_id(i);
+		git_time_t parent_time;
+		if (commits_visited.count(*parent_id) == 0) {
+			/* load parent */
+			git::commit parent = node->commit.parent(i);
+			parent_time = parent.time();
+
+			/* mark parent as visited */
+			commits_visited.insert(*parent_id);
+
+			/* add parent to the queue */
+			graph_node new_graph_node(std::move(parent), parent_time, node->depth + 1);
+			auto ret = commits_loaded.emplace(*parent_id, std::move(new_graph_node));
+			bfs_queue.push_back(&ret.first->second);
+			std::push_heap(bfs_queue.begin(), bfs_queue.end(), bfs_queue_cmp);
+
+			/* add pointer from child to parent */
+			node->parents.push_back(&ret.first->second);
+
+			/* add pointer from parent to child */
+			ret.first->second.children.push_back(node);
+		} else {
+			/* find parent */
+			graph_node *parent = &commits_loaded.find(*parent_id)->second;
+			parent_time = parent->time;
+
+			/* add pointer from child to parent */
+			node->parents.push_back(parent);
+
+			/* add pointer from parent to child */
+			parent->children.push_back(node);
+		}
+
+		if (parent_time > max_parent_time)
+			max_parent_time = parent_time;
+	}
+
+	node->parents_loaded = true;
+
+	if (max_parent_time >= node->time)
+		fix_commit_times(node, max_parent_time);
+}
+
 void commit_list::bfs(size_t requested_depth)
 {
+	TRACE_SCOPE("commit_list::bfs");
+
 	while (!bfs_queue.empty() && bfs_queue.front()->depth <= requested_depth) {
-		graph_node *node = bfs_queue.front();
-		bfs_queue.pop_front();
-
-		git_time_t max_parent_time = 0;
-
-		for (unsigned int i = 0; i < node->commit.parentcount(); i++) {
-			const git_oid *parent_id = node->commit.parent_id(i);
-			git_time_t parent_time;
-			if (commits_visited.count(*parent_id) == 0) {
-				/* load parent */
-				git::commit parent = node->commit.parent(i);
-				parent_time = parent.time();
-
-				/* mark parent as visited */
-				commits_visited.insert(*parent_id);
-
-				/* add parent to the queue */
-				graph_node new_graph_node(std::move(parent), parent_time, node->depth + 1);
-				auto ret = commits_loaded.emplace(*parent_id, std::move(new_graph_node));
-				bfs_queue.push_back(&ret.first->second);
-
-				/* add pointer from child to parent */
-				node->parents.push_back(&ret.first->second);
-
-				/* add pointer from parent to child */
-				ret.first->second.children.push_back(node);
-			} else {
-				/* find parent */
-				graph_node *parent = &commits_loaded.find(*parent_id)->second;
-				parent_time = parent->time;
-
-				/* add pointer from child to parent */
-				node->parents.push_back(parent);
-
-				/* add pointer from parent to child */
-				parent->children.push_back(node);
-			}
-
-			if (parent_time > max_parent_time)
-				max_parent_time = parent_time;
-		}
+		std::pop_heap(bfs_queue.begin(), bfs_queue.end(), bfs_queue_cmp);
+		graph_node *node = bfs_queue.back();
+		bfs_queue.pop_back();
 
-		if (max_parent_time >= node->time)
-			fix_commit_times(node, max_parent_time);
+		/* nodes which were needed early may have been loaded already */
+		if (!node->parents_loaded)
+			load_parents(node);
 	}
 }
 
@@ -160,28 +198,10 @@ void commit_list::fix_commit_times(graph_node *node, const git_time_t parent_tim
 			fix_commit_times(child, parent_time + 1);
 }
 
-void commit_list::initialize_bfs_queue(const ref_map &refs)
-{
-	/* copy all of the refs into a set */
-	std::unordered_set<git_oid, git_oid_ref_hash, git_oid_ref_cmp> refs_unique;
-	for (auto &it : refs.refs)
-		refs_unique.insert(it.first);
-
-	/* load all of the unique refs into bfs_queue */
-	for (auto &it : refs_unique) {
-		git::commit commit = repo.commit_lookup(&it);
-		git_time_t time = commit.time();
-
-		commits_visited.insert(*commit.id());
-
-		graph_node new_graph_node(std::move(commit), time, 0);
-		auto ret = commits_loaded.emplace(*&it, std::move(new_graph_node));
-		bfs_queue.push_back(&ret.first->second);
-	}
-}
-
 void commit_list::initialize(const ref_map &refs)
 {
+	TRACE_SCOPE("commit_list::initialize");
+
 	if (refs.refs.empty())
 		return;
 
@@ -189,18 +209,38 @@ void commit_list::initialize(const ref_map &refs)
 	next_id = 0;
 	clist.clear();
 	commits_returned.clear();
+	pending_branch_ids.clear();
+
+	/* load the commits of any refs which were activated since the last time */
+	const git_oid *prev_target = nullptr;
+	for (uint32_t index : refs.refs_by_target) {
+		const ref_map::ref &ref = refs.refs[index];
+		if (!refs.is_ref_active(index) || (prev_target != nullptr && git_oid_equal(prev_target, &ref.target)))
+			continue;
+
+		prev_target = &ref.target;
+		load_tip(ref.target);
+	}
 
-	/* copy all of the refs that are active into a set */
-	std::unordered_set<git_oid, git_oid_ref_hash, git_oid_ref_cmp> refs_active;
-	for (auto &it : refs.refs)
-		if (it.second.second)
-			refs_active.insert(it.first);
+	bfs(prefs.graph_approximation_factor);
+
+	/* load all of the unique active refs into clist */
+	prev_target = nullptr;
+	for (uint32_t index : refs.refs_by_target) {
+		const ref_map::ref &ref = refs.refs[index];
+		if (!refs.is_ref_active(index) || (prev_target != nullptr && git_oid_equal(prev_target, &ref.target)))
+			continue;
 
-	/* load all of the unique refs into clist */
-	for (auto &it : refs_active) {
-		auto loaded_commit = commits_loaded.find(*&it);
+		prev_target = &ref.target;
+
+		auto loaded_commit = commits_loaded.find(ref.target);
 		graph_node *node = &loaded_commit->second;
-		clist.emplace_back(node, next_id++);
+		clist.emplace_back(node, next_id);
+
+		if (prefs.lane_policy == graph_lane_policy::COMPACT)
+			pending_branch_ids.emplace(node, next_id);
+
+		next_id++;
 	}
 
 	std::make_heap(clist.begin(), clist.end());
@@ -229,25 +269,49 @@ void commit_list::remove_duplicates(const git_oid *latest_commit_oid, commit_gra
 	}
 }
 
+void commit_list::push_node(graph_node *node, unsigned int id)
+{
+	clist.emplace_back(node, id);
+	std::push_heap(clist.begin(), clist.end());
+
+	/* remember the first branch waiting on each commit so merges can be drawn into it */
+	if (prefs.lane_policy == graph_lane_policy::COMPACT)
+		pending_branch_ids.emplace(node, id);
+}
+
 void commit_list::insert_parents(const node &latest_node, commit_graph_info &graph)
 {
 	if (graph.num_parents > 0) {
 		/* load_parent */
 		graph_node *node = latest_node.graph_node_ptr->parents[0];
 
+		/* look ahead for a branch which is already waiting on the first parent */
+		if (prefs.lane_policy == graph_lane_policy::COMPACT) {
+			auto pending = pending_branch_ids.find(node);
+			if (pending != pending_branch_ids.end())
+				graph.first_parent_target_id = pending->second;
+		}
+
 		/* set the first parent to have the same id as the child */
-		clist.emplace_back(node, latest_node.id);
-		std::push_heap(clist.begin(), clist.end());
+		push_node(node, latest_node.id);
 	}
 
 	for (size_t i = 1; i < graph.num_parents; i++) {
 		/* load_parent */
 		graph_node *node = latest_node.graph_node_ptr->parents[i];
 
+		/* look ahead for a branch which is already waiting on this parent */
+		if (prefs.lane_policy == graph_lane_policy::COMPACT) {
+			auto pending = pending_branch_ids.find(node);
+			if (pending != pending_branch_ids.end())
+				graph.merge_target_ids.push_back(pending->second);
+			else
+				graph.merge_target_ids.push_back(NO_MERGE_TARGET);
+		}
+
 		/* give every additional parent a newly generated id */
 		unsigned int node_id = next_id++;
-		clist.emplace_back(node, node_id);
-		std::push_heap(clist.begin(), clist.end());
+		push_node(node, node_id);
 
 		/* add additional parents to the the new_parent_ids list */
 		graph.new_parent_ids.push_back(node_id);
@@ -256,6 +320,8 @@ void commit_list::insert_parents(const node &latest_node, commit_graph_info &gra
 
 git::commit commit_list::get_next_commit(commit_graph_info &graph)
 {
+	TRACE_SCOPE("commit_list::get_next_commit");
+
 	/* get the latest commit from the heap */
 	std::pop_heap(clist.begin(), clist.end());
 	node latest_node = std::move(clist.back());
@@ -269,6 +335,11 @@ git::commit commit_list::get_next_commit(commit_graph_info &graph)
 	graph.id_of_commit = latest_node.id;
 
 	remove_duplicates(latest_node.graph_node_ptr->commit.id(), graph);
+	pending_branch_ids.erase(latest_node.graph_node_ptr);
+
+	/* a tip loaded after the search went deeper can have parents that are deeper than it expects */
+	if (!latest_node.graph_node_ptr->parents_loaded)
+		load_parents(latest_node.graph_node_ptr);
 
 	graph.num_parents = latest_node.graph_node_ptr->commit.parentcount();
 	insert_parents(latest_node, graph);
@@ -290,3 +361,16 @@ bool commit_list::empty()
 {
 	return clist.empty();
 }
+
+memory_usage commit_list::get_memory_usage() const
+{
+	/* the nodes and buckets of commits_loaded are in node_arena, the edges of each node are not */
+	size_t bytes = node_arena.get_stats().reserved_bytes;
+	for (const auto &loaded : commits_loaded)
+		bytes += vector_memory(loaded.second.parents) + vector_memory(loaded.second.children);
+
+	bytes += vector_memory(clist) + vector_memory(bfs_queue);
+	bytes += hash_table_memory(commits_visited) + hash_table_memory(commits_returned) + hash_table_memory(pending_branch_ids);
+
+	return { "commit_list", bytes, commits_loaded.size() };
+}
@@ -22,15 +22,21 @@
 
 #include <git2.h>
 
-#include <list>
+#include <climits>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
 #include "compat/cpp_git.h"
+#include "util/arena.h"
+#include "util/memory_usage.h"
 #include "util/preferences.h"
 
 #include "ref_map.h"
 
+/*! \brief Marker for a merge parent that no other branch is waiting on */
+constexpr unsigned int NO_MERGE_TARGET = UINT_MAX;
+
 /*!
  * \struct commit_graph_info
  * \brief Structure for storing information needed to produce the commit graph
@@ -40,6 +46,18 @@ struct commit_graph_info {
 	std::unordered_set<unsigned int> duplicate_ids;
 	/*! \brief A list showing the ids of commit branches that were added from a merge */
 	std::vector<unsigned int> new_parent_ids;
+	/*!
+	 * \brief For each id in new_parent_ids, the id of a branch already waiting on the same parent
+	 *
+	 * This is only filled in when using graph_lane_policy::COMPACT, missing entries are NO_MERGE_TARGET.
+	 */
+	std::vector<unsigned int> merge_target_ids;
+	/*!
+	 * \brief The id of a branch already waiting on the first parent, NO_MERGE_TARGET if there is none
+	 *
+	 * This is only filled in when using graph_lane_policy::COMPACT.
+	 */
+	unsigned int first_parent_target_id = NO_MERGE_TARGET;
 
 	/*! \brief The id of the commit branch returned */
 	unsigned int id_of_commit;
@@ -65,6 +83,11 @@ public:
 
 	/*!
 	 * \brief Reload the list of references into the commit_list to begin the display process
+	 *
+	 * Only the commits of the active refs are loaded, the commits of the other
+	 * refs are loaded when those refs are activated or when they are reached
+	 * as the ancestors of other commits.
+	 *
 	 * \param refs The ref_map containing all of references in the repo
 	 */
 	void initialize(const ref_map &refs);
@@ -89,14 +112,21 @@ public:
 	 */
 	bool empty();
 
+	/*!
+	 * \brief Estimate the memory held by the list
+	 * \return The bytes held and the number of commits loaded
+	 */
+	memory_usage get_memory_usage() const;
+
 private:
 	/*!
 	 * \struct commit_list::graph_node
 	 * \brief Private structure for representing nodes in the repo graph
 	 *
 	 * This struct represents a node in the directed acyclic graph.
-	 * It is populated by loading the commits using a depth first search.
-	 * Each nodes has pointers to its parents and children.
+	 * It is populated by loading the commits using a breadth first search.
+	 * Each nodes has pointers to its parents and children, the parents are
+	 * only filled in once parents_loaded is set.
 	 * It also stores the time and depth. The time is the corrected time.
 	 * For any node, the corrected time is the minimum of the MAX of the
 	 * times of the parents plus one or the stored time of the commit.
@@ -105,6 +135,7 @@ private:
 		git::commit commit;
 		git_time_t time;
 		size_t depth;
+		bool parents_loaded = false;
 
 		std::vector<graph_node *> parents;
 		std::vector<graph_node *> children;
@@ -143,8 +174,12 @@ private:
 	std::vector<node> clist;
 	std::unordered_set<git_oid, git_oid_ref_hash, git_oid_ref_cmp> commits_visited;
 	std::unordered_set<git_oid, git_oid_ref_hash, git_oid_ref_cmp> commits_returned;
-	std::unordered_map<git_oid, graph_node, git_oid_ref_hash, git_oid_ref_cmp> commits_loaded;
-	std::list<graph_node *> bfs_queue;
+	/* the loaded nodes are kept across reloads and live in node_arena until the list is destroyed */
+	arena node_arena;
+	std::unordered_map<git_oid, graph_node, git_oid_ref_hash, git_oid_ref_cmp,
+			arena_allocator<std::pair<const git_oid, graph_node>>> commits_loaded;
+	std::vector<graph_node *> bfs_queue;
+	std::unordered_map<const graph_node *, unsigned int> pending_branch_ids;
 
 	/*!
 	 * \brief remove_duplicates
@@ -153,6 +188,13 @@ private:
 	 */
 	void remove_duplicates(const git_oid *latest_commit_oid, commit_graph_info &graph);
 
+	/*!
+	 * \brief Add a node to the commit list heap
+	 * \param node The graph node to add
+	 * \param id The id of the commit branch
+	 */
+	void push_node(graph_node *node, unsigned int id);
+
 	/*!
 	 * \brief Insert the latest nodes parents into the commit list
 	 * \param latest_node The latest node
@@ -160,14 +202,26 @@ private:
 	 */
 	void insert_parents(const node &latest_node, commit_graph_info &graph);
 
+	static bool bfs_queue_cmp(const graph_node *lhs, const graph_node *rhs);
+
 	/*!
-	 * \brief Prepare the bfs queue using the refs in refs
-	 * \param refs The ref_map containing all of the refs
+	 * \brief Load the commit a ref points to and add it to the bfs queue, unless it is already loaded
+	 * \param target The commit the ref points to
 	 */
-	void initialize_bfs_queue(const ref_map &refs);
+	void load_tip(const git_oid &target);
+
+	/*!
+	 * \brief Load the parents of a node and link them to the node
+	 * \param node The node to load the parents of
+	 */
+	void load_parents(graph_node *node);
 
 	/*!
 	 * \brief Execute the breadth first search up to the requested depth
+	 *
+	 * The bfs queue is a heap ordered by depth, so tips which are loaded after
+	 * the search has already gone deeper are still visited first.
+	 *
 	 * \param requested_depth The requested depth
 	 */
 	void bfs(size_t requested_depth);
@@ -0,0 +1,157 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "diff_cache.h"
+
+/* the bookkeeping of an entry and of each patch in it, on top of the memory they point to */
+constexpr size_t entry_overhead = sizeof(diff_key) * 2 + 128;
+constexpr size_t patch_overhead = 64;
+
+static size_t files_size(const std::vector<diff_file> &files)
+{
+	size_t size = files.capacity() * sizeof(diff_file);
+	for (const diff_file &file : files)
+		size += file.old_path.capacity() + file.new_path.capacity() + file.other_old_ids.capacity() * sizeof(git_oid);
+
+	return size;
+}
+
+void diff_patch::add_line(char origin, const char *content, size_t length)
+{
+	/* the end of file markers start with the newline that is missing from the file */
+	if ((origin == GIT_DIFF_LINE_CONTEXT_EOFNL || origin == GIT_DIFF_LINE_ADD_EOFNL || origin == GIT_DIFF_LINE_DEL_EOFNL)
+			&& length > 0 && content[0] == '\n') {
+		content++;
+		length--;
+	}
+
+	if (length > 0 && content[length - 1] == '\n')
+		length--;
+	if (length > 0 && content[length - 1] == '\r')
+		length--;
+
+	lines.push_back({ text.size(), static_cast<uint32_t>(length), origin });
+	text.append(content, length);
+
+	if (length > max_line_length)
+		max_line_length = length;
+}
+
+diff_cache::diff_cache(size_t max_size) :
+	max_size(max_size)
+{}
+
+std::list<diff_cache::entry>::iterator diff_cache::find_entry(const diff_key &key)
+{
+	auto it = entry_index.find(key);
+	if (it == entry_index.end())
+		return entries.end();
+
+	/* move the entry to the front */
+	entries.splice(entries.begin(), entries, it->second);
+	return it->second;
+}
+
+const std::vector<diff_file> *diff_cache::find_files(const diff_key &key)
+{
+	auto it = find_entry(key);
+	return it != entries.end() ? &it->files : nullptr;
+}
+
+std::shared_ptr<const diff_patch> diff_cache::find_patch(const diff_key &key, size_t file_index)
+{
+	auto it = find_entry(key);
+	if (it == entries.end())
+		return nullptr;
+
+	auto patch = it->patches.find(file_index);
+	return patch != it->patches.end() ? patch->second : nullptr;
+}
+
+const std::vector<diff_stats> *diff_cache::find_stats(const diff_key &key)
+{
+	auto it = find_entry(key);
+	return it != entries.end() && !it->stats.empty() ? &it->stats : nullptr;
+}
+
+void diff_cache::insert_files(const diff_key &key, std::vector<diff_file> files)
+{
+	/* the patches of the old files may not match the new ones, so the whole entry is replaced */
+	auto it = entry_index.find(key);
+	if (it != entry_index.end()) {
+		total_size -= it->second->size;
+		entries.erase(it->second);
+		entry_index.erase(it);
+	}
+
+	const size_t size = entry_overhead + files_size(files);
+	entries.push_front(entry{ key, std::move(files), {}, {}, size });
+	entry_index.emplace(key, entries.begin());
+	total_size += size;
+
+	trim();
+}
+
+void diff_cache::insert_patch(const diff_key &key, size_t file_index, std::shared_ptr<const diff_patch> patch)
+{
+	auto it = find_entry(key);
+	if (it == entries.end() || file_index >= it->files.size())
+		return;
+
+	const size_t patch_size = patch->memory_size() + patch_overhead;
+	auto ret = it->patches.emplace(file_index, std::move(patch));
+	if (!ret.second)
+		return;
+
+	it->size += patch_size;
+	total_size += patch_size;
+
+	trim();
+}
+
+void diff_cache::insert_stats(const diff_key &key, size_t first_index, const std::vector<diff_stats> &stats)
+{
+	auto it = find_entry(key);
+	if (it == entries.end() || first_index + stats.size() > it->files.size())
+		return;
+
+	if (it->stats.empty()) {
+		it->stats.resize(it->files.size());
+
+		const size_t stats_size = it->stats.capacity() * sizeof(diff_stats);
+		it->size += stats_size;
+		total_size += stats_size;
+	}
+
+	std::copy(stats.begin(), stats.end(), it->stats.begin() + first_index);
+
+	trim();
+}
+
+void diff_cache::trim()
+{
+	/* the entry at the front was just used, so it is kept even when it is bigger than the cache */
+	while (total_size > max_size && entries.size() > 1) {
+		const entry &last = entries.back();
+		total_size -= last.size;
+		entry_index.erase(last.key);
+		entries.pop_back();
+	}
+}
@@ -0,0 +1,263 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* diff_cache.h */
+#ifndef DIFF_CACHE_H
+#define DIFF_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <git2.h>
+
+/*!
+ * \struct diff_file
+ * \brief A file changed by a commit
+ */
+struct diff_file
+{
+	/*! \brief How the file was changed */
+	git_delta_t status;
+	/*! \brief The blob of the file before the change, zero if it was added */
+	git_oid old_id;
+	/*! \brief The blob of the file after the change, zero if it was deleted */
+	git_oid new_id;
+	/*! \brief The path of the file before the change */
+	std::string old_path;
+	/*! \brief The path of the file after the change */
+	std::string new_path;
+	/*! \brief The blobs of the file in the other parents of a merge, only set in combined diffs */
+	std::vector<git_oid> other_old_ids;
+};
+
+/*!
+ * \struct diff_stats
+ * \brief The size of the change to a file, like a line of git diff --stat
+ */
+struct diff_stats
+{
+	/*! \brief Whether or not the stats have been worked out yet */
+	bool computed = false;
+	/*! \brief Whether or not either side of the file is binary, the line counts are zero if so */
+	bool binary = false;
+	/*! \brief The number of lines added */
+	uint32_t additions = 0;
+	/*! \brief The number of lines removed */
+	uint32_t deletions = 0;
+	/*! \brief The size in bytes of the file before the change */
+	uint64_t old_size = 0;
+	/*! \brief The size in bytes of the file after the change */
+	uint64_t new_size = 0;
+};
+
+/*!
+ * \struct diff_patch
+ * \brief The lines of a patch, indexed so that each line can be read without decoding the others
+ */
+struct diff_patch
+{
+	/*!
+	 * \struct line
+	 * \brief A line of the patch
+	 */
+	struct line
+	{
+		/*! \brief The offset of the line in text */
+		size_t offset;
+		/*! \brief The length of the line in bytes */
+		uint32_t length;
+		/*! \brief The git_diff_line_t origin of the line */
+		char origin;
+	};
+
+	/*! \brief The UTF-8 content of every line, without line endings */
+	std::string text;
+	/*! \brief The lines, in order */
+	std::vector<line> lines;
+	/*! \brief The length in bytes of the longest line */
+	size_t max_line_length = 0;
+
+	/*!
+	 * \brief Append a line to the patch, removing its line ending
+	 * \param origin The git_diff_line_t origin of the line
+	 * \param content The content of the line
+	 * \param length The length of the content
+	 */
+	void add_line(char origin, const char *content, size_t length);
+
+	/*!
+	 * \brief Get the estimated memory used by the patch
+	 * \return The size in bytes
+	 */
+	size_t memory_size() const
+	{
+		return sizeof(diff_patch) + text.capacity() + lines.capacity() * sizeof(line);
+	}
+};
+
+/*!
+ * \struct diff_key
+ * \brief The commits a diff is computed between and how
+ */
+struct diff_key
+{
+	/*! \brief The commit that was diffed */
+	git_oid commit_id;
+	/*! \brief The parent it was diffed against, zero for a root commit */
+	git_oid parent_id;
+	/*! \brief Whether or not renamed and copied files were paired up */
+	bool find_similar;
+	/*! \brief Whether or not a merge was diffed against all of its parents */
+	bool combined;
+
+	bool operator==(const diff_key &other) const
+	{
+		return git_oid_equal(&commit_id, &other.commit_id) && git_oid_equal(&parent_id, &other.parent_id)
+				&& find_similar == other.find_similar && combined == other.combined;
+	}
+};
+
+/*!
+ * \struct diff_key_hash
+ * \brief Structure for computing hashes of diff_key
+ */
+struct diff_key_hash
+{
+	/*!
+	 * \brief Compute the hash of a diff_key
+	 * \param key The diff_key to hash
+	 * \return The hash of key
+	 */
+	size_t operator()(const diff_key &key) const
+	{
+		/* the ids are already uniformly distributed */
+		size_t hash = 0;
+		for (size_t i = 0; i < sizeof(size_t); i++)
+			hash = (hash << 8) | (key.commit_id.id[i] ^ key.parent_id.id[i]);
+		return hash;
+	}
+};
+
+/*!
+ * \class diff_cache
+ * \brief Least recently used cache of the changed files and patches of commits
+ *
+ * The patches and stats of a commit are stored with its changed files and are evicted
+ * along with them. The size of the cache is an estimate of the memory used
+ * by the strings and vectors it holds. The cache is not thread safe.
+ */
+class diff_cache
+{
+public:
+	/*!
+	 * \brief Create an empty cache
+	 * \param max_size The size in bytes the cache is trimmed to after each insertion
+	 */
+	diff_cache(size_t max_size);
+
+	/*!
+	 * \brief Find the changed files of a diff, marking it as recently used
+	 * \param key The diff to find
+	 * \return The changed files, or nullptr if the diff is not cached
+	 */
+	const std::vector<diff_file> *find_files(const diff_key &key);
+
+	/*!
+	 * \brief Find the patch of a changed file, marking its diff as recently used
+	 * \param key The diff the file is in
+	 * \param file_index The index of the file in the changed files
+	 * \return The patch, or nullptr if the patch is not cached
+	 */
+	std::shared_ptr<const diff_patch> find_patch(const diff_key &key, size_t file_index);
+
+	/*!
+	 * \brief Find the stats of the changed files of a diff, marking it as recently used
+	 * \param key The diff to find
+	 * \return The stats of each file in the order of the files, or nullptr if none are cached
+	 */
+	const std::vector<diff_stats> *find_stats(const diff_key &key);
+
+	/*!
+	 * \brief Add the changed files of a diff, replacing any cached ones
+	 * \param key The diff the files belong to
+	 * \param files The changed files
+	 */
+	void insert_files(const diff_key &key, std::vector<diff_file> files);
+
+	/*!
+	 * \brief Add the patch of a changed file, the files of the diff must be cached
+	 * \param key The diff the file is in
+	 * \param file_index The index of the file in the changed files
+	 * \param patch The patch, which is shared with whoever else holds it
+	 */
+	void insert_patch(const diff_key &key, size_t file_index, std::shared_ptr<const diff_patch> patch);
+
+	/*!
+	 * \brief Add the stats of a run of changed files, the files of the diff must be cached
+	 * \param key The diff the files are in
+	 * \param first_index The index of the first file in the changed files
+	 * \param stats The stats of the files from first_index onwards
+	 */
+	void insert_stats(const diff_key &key, size_t first_index, const std::vector<diff_stats> &stats);
+
+	/*!
+	 * \brief Get the estimated memory used by the cache
+	 * \return The size in bytes
+	 */
+	size_t size() const
+	{
+		return total_size;
+	}
+
+	/*!
+	 * \brief Get the number of diffs in the cache
+	 * \return The number of diffs, each with its files and any patches and stats
+	 */
+	size_t num_entries() const
+	{
+		return entries.size();
+	}
+
+private:
+	struct entry
+	{
+		diff_key key;
+		std::vector<diff_file> files;
+		std::unordered_map<size_t, std::shared_ptr<const diff_patch>> patches;
+		/* empty until the first stats are inserted, then one for each file */
+		std::vector<diff_stats> stats;
+		size_t size;
+	};
+
+	/* the most recently used entry is at the front */
+	std::list<entry> entries;
+	std::unordered_map<diff_key, std::list<entry>::iterator, diff_key_hash> entry_index;
+
+	size_t max_size;
+	size_t total_size = 0;
+
+	std::list<entry>::iterator find_entry(const diff_key &key);
+	void trim();
+};
+
+#endif /* DIFF_CACHE_H */
@@ -0,0 +1,303 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+
+#include "util/preferences.h"
+
+#include "diff_similarity.h"
+
+constexpr uint32_t no_source = UINT32_MAX;
+
+/* the bytes of a file's lines that hash to the same value */
+struct line_hash_bytes
+{
+	uint64_t hash;
+	uint64_t bytes;
+};
+
+/* a file taking part in the scoring, the blob is kept loaded so its content can be read from any thread */
+struct similarity_candidate
+{
+	uint32_t file_index;
+	uint64_t size;
+	git::blob blob;
+	std::vector<line_hash_bytes> lines;
+};
+
+struct similarity_match
+{
+	uint32_t score;
+	uint32_t dst;
+	uint32_t src;
+};
+
+/* runs func(begin, end) over [0, count) split into a range for each core */
+template<typename range_func>
+static void parallel_for(size_t count, const range_func &func)
+{
+	const size_t num_threads = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), count);
+	if (num_threads <= 1) {
+		func(0, count);
+		return;
+	}
+
+	const size_t range_size = (count + num_threads - 1) / num_threads;
+	std::vector<std::thread> threads;
+	for (size_t begin = range_size; begin < count; begin += range_size)
+		threads.emplace_back([&func, begin, range_size, count] () { func(begin, std::min(begin + range_size, count)); });
+
+	/* this thread takes the first range */
+	func(0, std::min(range_size, count));
+
+	for (std::thread &thread : threads)
+		thread.join();
+}
+
+/* splits content into lines and sums the bytes of the lines with the same hash, sorted by hash */
+static std::vector<line_hash_bytes> hash_lines(const char *content, size_t size)
+{
+	std::vector<line_hash_bytes> lines;
+
+	size_t line_begin = 0;
+	while (line_begin < size) {
+		const char *newline = static_cast<const char *>(memchr(content + line_begin, '\n', size - line_begin));
+		const size_t line_end = newline != nullptr ? newline - content + 1 : size;
+
+		/* FNV-1a */
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = line_begin; i < line_end; i++)
+			hash = (hash ^ static_cast<unsigned char>(content[i])) * 1099511628211ull;
+
+		lines.push_back({ hash, line_end - line_begin });
+		line_begin = line_end;
+	}
+
+	std::sort(lines.begin(), lines.end(), [] (const line_hash_bytes &lhs, const line_hash_bytes &rhs) {
+		return lhs.hash < rhs.hash;
+	});
+
+	/* merge the lines which appear more than once */
+	size_t num_unique = 0;
+	for (size_t i = 0; i < lines.size(); i++) {
+		if (num_unique > 0 && lines[num_unique - 1].hash == lines[i].hash)
+			lines[num_unique - 1].bytes += lines[i].bytes;
+		else
+			lines[num_unique++] = lines[i];
+	}
+
+	lines.resize(num_unique);
+	return lines;
+}
+
+/* the percentage of the bigger file made up of lines the two files share */
+static uint32_t similarity_score(const similarity_candidate &a, const similarity_candidate &b)
+{
+	uint64_t shared_bytes = 0;
+
+	auto it_a = a.lines.begin();
+	auto it_b = b.lines.begin();
+	while (it_a != a.lines.end() && it_b != b.lines.end()) {
+		if (it_a->hash < it_b->hash) {
+			it_a++;
+		} else if (it_b->hash < it_a->hash) {
+			it_b++;
+		} else {
+			shared_bytes += std::min(it_a->bytes, it_b->bytes);
+			it_a++;
+			it_b++;
+		}
+	}
+
+	return shared_bytes * 100 / std::max(a.size, b.size);
+}
+
+/* loads the side of a file that takes part in the scoring, returns false if it can only be matched exactly */
+static bool load_candidate(const git::repository &repo, const git_oid &id, uint32_t file_index,
+		std::vector<similarity_candidate> &candidates)
+{
+	try {
+		git::blob blob = repo.blob_lookup(&id);
+		const uint64_t size = blob.rawsize();
+		if (size == 0 || size > preferences::similarity_max_file_size || blob.is_binary())
+			return false;
+
+		candidates.push_back({ file_index, size, std::move(blob), {} });
+		return true;
+	} catch (const git::libgit_error &) {
+		return false;
+	}
+}
+
+bool find_similar_files(const git::repository &repo, std::vector<diff_file> &files,
+		const std::atomic<uint64_t> &current_generation, uint64_t generation)
+{
+	/* the added files are the destinations, the deleted and modified ones the sources */
+	std::vector<uint32_t> dsts;
+	std::vector<uint32_t> srcs;
+	for (uint32_t i = 0; i < files.size(); i++) {
+		if (files[i].status == GIT_DELTA_ADDED)
+			dsts.push_back(i);
+		else if (files[i].status == GIT_DELTA_DELETED || files[i].status == GIT_DELTA_MODIFIED)
+			srcs.push_back(i);
+	}
+
+	if (dsts.empty() || srcs.empty())
+		return true;
+
+	/* the source of each destination, and the destination each deleted file was renamed to */
+	std::vector<uint32_t> source_of(files.size(), no_source);
+	std::vector<uint32_t> renamed_to(files.size(), no_source);
+
+	/* identical content is found by the blob ids, the deleted files are preferred so that they become renames */
+	std::unordered_map<git_oid, uint32_t, git_oid_ref_hash, git_oid_ref_cmp> srcs_by_id;
+	for (uint32_t src : srcs) {
+		auto ret = srcs_by_id.emplace(files[src].old_id, src);
+		if (!ret.second && files[src].status == GIT_DELTA_DELETED && files[ret.first->second].status != GIT_DELTA_DELETED)
+			ret.first->second = src;
+	}
+
+	std::vector<uint32_t> unmatched_dsts;
+	for (uint32_t dst : dsts) {
+		auto it = srcs_by_id.find(files[dst].new_id);
+		if (it == srcs_by_id.end()) {
+			unmatched_dsts.push_back(dst);
+			continue;
+		}
+
+		source_of[dst] = it->second;
+		if (files[it->second].status == GIT_DELTA_DELETED && renamed_to[it->second] == no_source)
+			renamed_to[it->second] = dst;
+	}
+
+	std::vector<uint32_t> unmatched_srcs;
+	for (uint32_t src : srcs)
+		if (renamed_to[src] == no_source)
+			unmatched_srcs.push_back(src);
+
+	/* comparing every pair is quadratic, so huge diffs only get the exact matches */
+	if (!unmatched_dsts.empty() && !unmatched_srcs.empty()
+			&& unmatched_dsts.size() <= preferences::similarity_file_limit
+			&& unmatched_srcs.size() <= preferences::similarity_file_limit) {
+		std::vector<similarity_candidate> dst_candidates;
+		for (uint32_t dst : unmatched_dsts)
+			load_candidate(repo, files[dst].new_id, dst, dst_candidates);
+
+		std::vector<similarity_candidate> src_candidates;
+		for (uint32_t src : unmatched_srcs)
+			load_candidate(repo, files[src].old_id, src, src_candidates);
+
+		if (current_generation.load() != generation)
+			return false;
+
+		/* the blobs are only read from here on, so their content can be hashed on every core */
+		parallel_for(dst_candidates.size() + src_candidates.size(), [&] (size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				similarity_candidate &candidate = i < dst_candidates.size() ?
+						dst_candidates[i] : src_candidates[i - dst_candidates.size()];
+				candidate.lines = hash_lines(static_cast<const char *>(candidate.blob.rawcontent()), candidate.size);
+			}
+		});
+
+		/* the score can be no more than the smaller size over the bigger one, so each destination is only
+		 * compared with the sources whose sizes are within the threshold of its own */
+		std::sort(src_candidates.begin(), src_candidates.end(), [] (const similarity_candidate &lhs, const similarity_candidate &rhs) {
+			return lhs.size < rhs.size;
+		});
+
+		/* each destination has its own list of matches so that the threads never share one */
+		std::vector<std::vector<similarity_match>> dst_matches_list(dst_candidates.size());
+		std::atomic<bool> cancelled(false);
+		parallel_for(dst_candidates.size(), [&] (size_t begin, size_t end) {
+			for (size_t i = begin; i < end && !cancelled.load(); i++) {
+				if (current_generation.load() != generation) {
+					cancelled = true;
+					return;
+				}
+
+				const similarity_candidate &dst = dst_candidates[i];
+				const uint64_t min_size = dst.size * preferences::similarity_threshold / 100;
+				const uint64_t max_size = dst.size * 100 / preferences::similarity_threshold;
+
+				auto src_it = std::lower_bound(src_candidates.begin(), src_candidates.end(), min_size,
+						[] (const similarity_candidate &candidate, uint64_t size) {
+					return candidate.size < size;
+				});
+
+				for (; src_it != src_candidates.end() && src_it->size <= max_size; src_it++) {
+					const uint32_t score = similarity_score(dst, *src_it);
+					if (score >= preferences::similarity_threshold)
+						dst_matches_list[i].push_back({ score, dst.file_index, src_it->file_index });
+				}
+			}
+		});
+
+		if (cancelled.load())
+			return false;
+
+		std::vector<similarity_match> matches;
+		for (const std::vector<similarity_match> &dst_matches : dst_matches_list)
+			matches.insert(matches.end(), dst_matches.begin(), dst_matches.end());
+
+		/* the best matches are taken first, the file indices break ties so the result does not depend on the threads */
+		std::sort(matches.begin(), matches.end(), [] (const similarity_match &lhs, const similarity_match &rhs) {
+			if (lhs.score != rhs.score)
+				return lhs.score > rhs.score;
+			if (lhs.dst != rhs.dst)
+				return lhs.dst < rhs.dst;
+			return lhs.src < rhs.src;
+		});
+
+		for (const similarity_match &match : matches) {
+			if (source_of[match.dst] != no_source)
+				continue;
+
+			source_of[match.dst] = match.src;
+			if (files[match.src].status == GIT_DELTA_DELETED && renamed_to[match.src] == no_source)
+				renamed_to[match.src] = match.dst;
+		}
+	}
+
+	/* a destination is a rename of the best match of a deleted file, and a copy of anything else */
+	for (uint32_t dst : dsts) {
+		const uint32_t src = source_of[dst];
+		if (src == no_source)
+			continue;
+
+		diff_file &file = files[dst];
+		file.status = renamed_to[src] == dst ? GIT_DELTA_RENAMED : GIT_DELTA_COPIED;
+
+		file.old_id = files[src].old_id;
+		file.old_path = files[src].old_path;
+	}
+
+	/* the renamed files are now covered by their destinations */
+	size_t num_kept = 0;
+	for (size_t i = 0; i < files.size(); i++) {
+		if (renamed_to[i] == no_source) {
+			if (num_kept != i)
+				files[num_kept] = std::move(files[i]);
+			num_kept++;
+		}
+	}
+
+	files.resize(num_kept);
+	return true;
+}
@@ -0,0 +1,58 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* diff_similarity.h */
+#ifndef DIFF_SIMILARITY_H
+#define DIFF_SIMILARITY_H
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "compat/cpp_git.h"
+
+#include "diff_cache.h"
+
+/*!
+ * \brief Pair up the added files of a diff with the files they were renamed or copied from
+ *
+ * An added file with the same content as a deleted file is a rename of
+ * it, and one with the same content as the old side of a modified file is
+ * a copy of it. The remaining added files are scored against the
+ * remaining deleted and modified files by the bytes of the lines they
+ * share. Only files whose sizes are close enough for the score to reach
+ * preferences::similarity_threshold are compared, and the scoring is
+ * spread across every core. A deleted file is renamed at most once, any
+ * other files matching it are copies.
+ *
+ * A renamed file takes the place of the added file and the deleted file
+ * is removed. The scoring is skipped when either side has more than
+ * preferences::similarity_file_limit files, and binary files or files
+ * bigger than preferences::similarity_max_file_size are only paired up
+ * when their content is identical.
+ *
+ * \param repo The repository the blobs of the files are in
+ * \param files The changed files, which are updated in place
+ * \param current_generation The generation of the latest request
+ * \param generation The generation of this request, the search stops once it is out of date
+ * \return False if the search was cancelled, in which case files is unchanged
+ */
+bool find_similar_files(const git::repository &repo, std::vector<diff_file> &files,
+		const std::atomic<uint64_t> &current_generation, uint64_t generation);
+
+#endif /* DIFF_SIMILARITY_H */
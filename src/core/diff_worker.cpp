@@ -0,0 +1,597 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <exception>
+
+#include <git2.h>
+
+#include "compat/cpp_git.h"
+#include "util/preferences.h"
+#include "util/trace.h"
+
+#include "diff_similarity.h"
+#include "diff_worker.h"
+
+diff_worker::diff_worker(const std::string &repo_path) :
+	repo_path(repo_path),
+	repo(repo_path.c_str()),
+	diff_generation(0),
+	patch_generation(0),
+	prefetch_generation(0),
+	find_similar(false),
+	combined(false),
+	cache(preferences::diff_cache_size),
+	cache_bytes(0),
+	cache_entries(0),
+	thread(&diff_worker::run, this)
+{}
+
+diff_worker::~diff_worker()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		diff_generation++;
+		patch_generation++;
+		prefetch_generation++;
+	}
+
+	requests_changed.notify_one();
+	thread.join();
+}
+
+uint64_t diff_worker::request_diff(const git_oid &commit_id, files_callback callback, stats_callback stats_cb)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	/* the new generation also stops a diff or stats that are already running */
+	const uint64_t generation = ++diff_generation;
+	next_diff.reset(new diff_request{ generation, commit_id, std::move(callback), std::move(stats_cb) });
+	next_stats.reset();
+
+	/* a patch of the previous commit is no longer wanted, and neither are its neighbours */
+	patch_generation++;
+	next_patch.reset();
+	prefetch_generation++;
+	prefetch_queue.clear();
+	prefetch_queue_generation++;
+
+	lock.unlock();
+	requests_changed.notify_one();
+
+	return generation;
+}
+
+uint64_t diff_worker::request_patch(const git_oid &commit_id, size_t file_index, const diff_file &file, patch_callback callback)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	const uint64_t generation = ++patch_generation;
+	next_patch.reset(new patch_request{ generation, commit_id, file_index, file, std::move(callback) });
+
+	/* interrupt the stats and the prefetch, they carry on once the patch is done */
+	prefetch_generation++;
+
+	lock.unlock();
+	requests_changed.notify_one();
+
+	return generation;
+}
+
+void diff_worker::prefetch_diffs(std::vector<git_oid> commit_ids)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	prefetch_generation++;
+	prefetch_queue = std::move(commit_ids);
+	prefetch_queue_generation++;
+
+	/* the queue is popped from the back */
+	std::reverse(prefetch_queue.begin(), prefetch_queue.end());
+
+	lock.unlock();
+	requests_changed.notify_one();
+}
+
+void diff_worker::cancel()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	diff_generation++;
+	patch_generation++;
+	prefetch_generation++;
+	next_diff.reset();
+	next_patch.reset();
+	next_stats.reset();
+	prefetch_queue.clear();
+	prefetch_queue_generation++;
+}
+
+void diff_worker::set_find_similar(bool new_find_similar)
+{
+	cancel();
+	find_similar = new_find_similar;
+}
+
+void diff_worker::set_combined(bool new_combined)
+{
+	cancel();
+	combined = new_combined;
+}
+
+memory_usage diff_worker::get_cache_memory_usage() const
+{
+	return { "diff_cache", cache_bytes.load(), cache_entries.load() };
+}
+
+void diff_worker::publish_cache_usage()
+{
+	cache_bytes = cache.size();
+	cache_entries = cache.num_entries();
+}
+
+void diff_worker::run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	for (;;) {
+		requests_changed.wait(lock, [this] () { return stopping || next_diff || next_patch || next_stats || !prefetch_queue.empty(); });
+		if (stopping)
+			return;
+
+		/* the patches are quick and are what the user is waiting on, so they go first */
+		if (next_patch) {
+			std::unique_ptr<patch_request> request = std::move(next_patch);
+			lock.unlock();
+			compute_patch(*request);
+			lock.lock();
+		} else if (next_diff) {
+			std::unique_ptr<diff_request> request = std::move(next_diff);
+			lock.unlock();
+			const bool finished = compute_diff(request->commit_id, diff_generation, request->generation, request->callback);
+			lock.lock();
+
+			/* the stats are worked out once the files are all shown, unless another diff was requested meanwhile */
+			if (finished && request->stats_cb && diff_generation.load() == request->generation)
+				next_stats.reset(new stats_request{ request->generation, request->commit_id, 0, std::move(request->stats_cb) });
+		} else if (next_stats) {
+			std::unique_ptr<stats_request> request = std::move(next_stats);
+			const uint64_t interrupt_generation = prefetch_generation.load();
+			lock.unlock();
+
+			const bool finished = compute_stats(*request, interrupt_generation);
+			lock.lock();
+
+			/* stats interrupted by another request carry on from where they stopped, unless the diff changed */
+			if (!finished && !next_stats && diff_generation.load() == request->generation)
+				next_stats = std::move(request);
+		} else {
+			const git_oid commit_id = prefetch_queue.back();
+			prefetch_queue.pop_back();
+			const uint64_t generation = prefetch_generation.load();
+			const uint64_t queue_generation = prefetch_queue_generation;
+			lock.unlock();
+
+			const bool finished = compute_diff(commit_id, prefetch_generation, generation, nullptr);
+			lock.lock();
+
+			/* a prefetch interrupted by another request is tried again, unless the queue was replaced */
+			if (!finished && prefetch_queue_generation == queue_generation)
+				prefetch_queue.push_back(commit_id);
+		}
+	}
+}
+
+diff_key diff_worker::get_diff_key(const git::commit &commit) const
+{
+	diff_key key;
+	key.commit_id = *commit.id();
+	if (commit.parentcount() != 0)
+		key.parent_id = *commit.parent_id(0);
+	else
+		memset(&key.parent_id, 0, sizeof(key.parent_id));
+	key.find_similar = find_similar.load();
+	key.combined = combined.load() && commit.parentcount() > 1;
+
+	return key;
+}
+
+static diff_file make_diff_file(const git_diff_delta *delta)
+{
+	diff_file file;
+	file.status = delta->status;
+	file.old_id = delta->old_file.id;
+	file.new_id = delta->new_file.id;
+	file.old_path = delta->old_file.path;
+	file.new_path = delta->new_file.path;
+
+	return file;
+}
+
+/* returns false if the diff was cancelled before it finished */
+bool diff_worker::compute_diff(const git_oid &commit_id, const std::atomic<uint64_t> &current_generation, uint64_t generation,
+		const files_callback &callback)
+{
+	TRACE_SCOPE("diff_worker::compute_diff");
+
+	struct payload {
+		const std::atomic<uint64_t> &current_generation;
+		uint64_t generation;
+		const files_callback &callback;
+		bool stream;
+		std::vector<diff_file> files;
+		size_t num_files_sent;
+		std::chrono::steady_clock::time_point last_batch_time;
+
+		/* send the files that have not been sent yet, all of the files are kept for the cache */
+		void send_files(bool finished)
+		{
+			std::vector<diff_file> batch(files.begin() + num_files_sent, files.end());
+			num_files_sent = files.size();
+			callback(generation, std::move(batch), finished);
+		}
+	};
+
+	payload _payload = { current_generation, generation, callback, true, {}, 0, std::chrono::steady_clock::now() };
+
+	/* the files are collected as libgit2 finds them, rather than after the whole diff is done */
+	git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
+	opts.payload = &_payload;
+	opts.notify_cb = [] (const git_diff *diff_so_far, const git_diff_delta *delta, const char *matched_pathspec, void *payload) {
+		(void) diff_so_far;
+		(void) matched_pathspec;
+
+		struct payload *_payload = static_cast<struct payload *>(payload);
+		if (_payload->current_generation.load() != _payload->generation)
+			/* a newer request came in, abort the diff */
+			return -1;
+
+		_payload->files.push_back(make_diff_file(delta));
+
+		if (!_payload->callback || !_payload->stream)
+			return 0;
+
+		const auto now = std::chrono::steady_clock::now();
+		const long duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - _payload->last_batch_time).count();
+		if (duration > preferences::window_update_interval) {
+			_payload->send_files(false);
+			_payload->last_batch_time = now;
+		}
+
+		return 0;
+	};
+
+	try {
+		git::commit commit = repo.commit_lookup(&commit_id);
+		const diff_key key = get_diff_key(commit);
+
+		/* renames, copies and the files of combined diffs are only found once all of the files are known,
+		 * so no partial batches are sent */
+		_payload.stream = !key.find_similar && !key.combined;
+
+		const std::vector<diff_file> *cached_files = cache.find_files(key);
+		if (cached_files != nullptr) {
+			if (callback && current_generation.load() == generation)
+				callback(generation, std::vector<diff_file>(*cached_files), true);
+			return true;
+		}
+
+		if (key.combined) {
+			if (!compute_combined_diff(commit, current_generation, generation, _payload.files))
+				return false;
+		} else {
+			git::tree tree_a = commit.tree();
+			git::tree tree_b(nullptr);
+			if (commit.parentcount() != 0)
+				tree_b = commit.parent(0).tree();
+
+			repo.diff_tree_to_tree(tree_b, tree_a, &opts);
+		}
+
+		if (key.find_similar && !find_similar_files(repo, _payload.files, current_generation, generation))
+			return false;
+
+		/* only complete diffs are cached */
+		if (current_generation.load() == generation) {
+			if (callback)
+				_payload.send_files(true);
+			cache.insert_files(key, std::move(_payload.files));
+			publish_cache_usage();
+			return true;
+		}
+	} catch (const git::libgit_error &) {
+		/* cancelled, or the files found before the error are all that can be shown */
+		if (callback && current_generation.load() == generation) {
+			_payload.send_files(true);
+			return true;
+		}
+	}
+
+	return current_generation.load() == generation;
+}
+
+/* returns false if the diff was cancelled, throws if a parent could not be diffed */
+bool diff_worker::compute_combined_diff(const git::commit &commit, const std::atomic<uint64_t> &current_generation, uint64_t generation,
+		std::vector<diff_file> &files)
+{
+	TRACE_SCOPE("diff_worker::compute_combined_diff");
+
+	struct payload {
+		const std::atomic<uint64_t> &current_generation;
+		uint64_t generation;
+		std::vector<diff_file> files;
+	};
+
+	const unsigned int num_parents = commit.parentcount();
+	const size_t num_threads = std::min<size_t>(num_parents, std::max(std::thread::hardware_concurrency(), 1u));
+
+	/* libgit2 objects cannot be shared between threads, so each thread diffs its parents in its own repository */
+	while (parent_repos.size() + 1 < num_threads)
+		parent_repos.emplace_back(new git::repository(repo_path.c_str()));
+
+	std::vector<payload> parent_payloads;
+	parent_payloads.reserve(num_parents);
+	for (unsigned int i = 0; i < num_parents; i++)
+		parent_payloads.push_back({ current_generation, generation, {} });
+
+	std::vector<std::exception_ptr> errors(num_threads);
+
+	/* thread n diffs parents n, n + num_threads, ... */
+	auto diff_parents = [&] (size_t thread_index) {
+		const git::repository &thread_repo = thread_index == 0 ? repo : *parent_repos[thread_index - 1];
+
+		git_diff_options opts = GIT_DIFF_OPTIONS_INIT;
+		opts.notify_cb = [] (const git_diff *diff_so_far, const git_diff_delta *delta, const char *matched_pathspec, void *payload) {
+			(void) diff_so_far;
+			(void) matched_pathspec;
+
+			struct payload *_payload = static_cast<struct payload *>(payload);
+			if (_payload->current_generation.load() != _payload->generation)
+				return -1;
+
+			_payload->files.push_back(make_diff_file(delta));
+			return 0;
+		};
+
+		try {
+			git::commit thread_commit = thread_repo.commit_lookup(commit.id());
+			git::tree tree = thread_commit.tree();
+			for (unsigned int i = thread_index; i < num_parents; i += num_threads) {
+				opts.payload = &parent_payloads[i];
+				thread_repo.diff_tree_to_tree(thread_commit.parent(i).tree(), tree, &opts);
+			}
+		} catch (...) {
+			errors[thread_index] = std::current_exception();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < num_threads; i++)
+		threads.emplace_back(diff_parents, i);
+
+	diff_parents(0);
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	if (current_generation.load() != generation)
+		return false;
+
+	for (const std::exception_ptr &error : errors)
+		if (error)
+			std::rethrow_exception(error);
+
+	/* the files of the other parents sorted by path, to look up the files of the first parent in */
+	std::vector<std::vector<const diff_file *>> sorted_parent_files(num_parents);
+	for (unsigned int i = 1; i < num_parents; i++) {
+		std::vector<const diff_file *> &sorted_files = sorted_parent_files[i];
+		sorted_files.reserve(parent_payloads[i].files.size());
+		for (const diff_file &file : parent_payloads[i].files)
+			sorted_files.push_back(&file);
+
+		std::sort(sorted_files.begin(), sorted_files.end(), [] (const diff_file *lhs, const diff_file *rhs) {
+			return lhs->new_path < rhs->new_path;
+		});
+	}
+
+	/* a file is only part of a combined diff if it differs from every parent, a file
+	 * matching one of the parents was taken from it rather than resolved by the merge */
+	for (diff_file &file : parent_payloads[0].files) {
+		bool in_every_parent = true;
+		for (unsigned int i = 1; i < num_parents && in_every_parent; i++) {
+			const std::vector<const diff_file *> &sorted_files = sorted_parent_files[i];
+			auto it = std::lower_bound(sorted_files.begin(), sorted_files.end(), file.new_path,
+					[] (const diff_file *parent_file, const std::string &path) {
+				return parent_file->new_path < path;
+			});
+
+			if (it == sorted_files.end() || (*it)->new_path != file.new_path)
+				in_every_parent = false;
+			else
+				file.other_old_ids.push_back((*it)->old_id);
+		}
+
+		if (in_every_parent)
+			files.push_back(std::move(file));
+	}
+
+	return true;
+}
+
+void diff_worker::compute_patch(const patch_request &request)
+{
+	TRACE_SCOPE("diff_worker::compute_patch");
+
+	const diff_file &file = request.file;
+
+	std::shared_ptr<diff_patch> new_patch = std::make_shared<diff_patch>();
+	try {
+		const diff_key key = get_diff_key(repo.commit_lookup(&request.commit_id));
+
+		std::shared_ptr<const diff_patch> cached_patch = cache.find_patch(key, request.file_index);
+		if (cached_patch) {
+			if (patch_generation.load() == request.generation)
+				request.callback(request.generation, std::move(cached_patch));
+			return;
+		}
+
+		git::blob new_blob(nullptr);
+		if (!git_oid_iszero(&file.new_id))
+			new_blob = repo.blob_lookup(&file.new_id);
+
+		/* a file in a combined diff has the hunks against each parent in turn, under a line naming the parent */
+		const size_t num_parents = file.other_old_ids.size() + 1;
+		for (size_t parent = 0; parent < num_parents; parent++) {
+			const git_oid &old_id = parent == 0 ? file.old_id : file.other_old_ids[parent - 1];
+			const std::string &old_path = parent == 0 ? file.old_path : file.new_path;
+
+			git::blob old_blob(nullptr);
+			if (!git_oid_iszero(&old_id))
+				old_blob = repo.blob_lookup(&old_id);
+
+			if (num_parents > 1) {
+				const std::string header = "Parent " + std::to_string(parent + 1);
+				new_patch->add_line(GIT_DIFF_LINE_HUNK_HDR, header.c_str(), header.size());
+			}
+
+			git::patch patch = git::patch::from_blobs(old_blob, old_path.c_str(), new_blob, file.new_path.c_str(), nullptr);
+
+			for (size_t i = 0; i < patch.num_hunks(); i++) {
+				if (patch_generation.load() != request.generation)
+					return;
+
+				const git_diff_hunk *hunk = patch.get_hunk(i);
+				new_patch->add_line(GIT_DIFF_LINE_HUNK_HDR, hunk->header, hunk->header_len);
+				for (int j = 0; j < patch.num_lines_in_hunk(i); j++) {
+					const git_diff_line *line = patch.get_line_in_hunk(i, j);
+					new_patch->add_line(line->origin, line->content, line->content_len);
+				}
+			}
+		}
+
+		cache.insert_patch(key, request.file_index, new_patch);
+		publish_cache_usage();
+	} catch (const git::libgit_error &) {
+		/* show whatever was read before the error */
+	}
+
+	if (patch_generation.load() == request.generation)
+		request.callback(request.generation, std::move(new_patch));
+}
+
+/* returns false if the stats were interrupted before they were all worked out, request is updated to resume from there */
+bool diff_worker::compute_stats(stats_request &request, uint64_t interrupt_generation)
+{
+	TRACE_SCOPE("diff_worker::compute_stats");
+
+	try {
+		const diff_key key = get_diff_key(repo.commit_lookup(&request.commit_id));
+
+		/* the diff failed part way through or was evicted, so the files to work out the stats of are unknown */
+		const std::vector<diff_file> *files = cache.find_files(key);
+		if (files == nullptr)
+			return true;
+
+		/* stats computed for an earlier request of the same diff are reused */
+		const std::vector<diff_stats> *cached_stats = cache.find_stats(key);
+
+		std::vector<diff_stats> batch;
+		size_t batch_begin = request.next_index;
+		auto last_batch_time = std::chrono::steady_clock::now();
+
+		/* the cache keeps every batch, so an interrupted request does not lose its progress */
+		auto send_batch = [&] () {
+			if (batch.empty())
+				return;
+
+			cache.insert_stats(key, batch_begin, batch);
+			publish_cache_usage();
+
+			const size_t first_index = batch_begin;
+			batch_begin += batch.size();
+			if (diff_generation.load() == request.generation)
+				request.callback(request.generation, first_index, std::move(batch));
+
+			batch.clear();
+		};
+
+		for (size_t i = request.next_index; i < files->size(); i++) {
+			if (diff_generation.load() != request.generation || prefetch_generation.load() != interrupt_generation) {
+				send_batch();
+				request.next_index = i;
+				return false;
+			}
+
+			if (cached_stats != nullptr && (*cached_stats)[i].computed)
+				batch.push_back((*cached_stats)[i]);
+			else
+				batch.push_back(compute_file_stats((*files)[i]));
+
+			const auto now = std::chrono::steady_clock::now();
+			const long duration = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_batch_time).count();
+			if (duration > preferences::window_update_interval) {
+				send_batch();
+				last_batch_time = now;
+			}
+		}
+
+		send_batch();
+	} catch (const git::libgit_error &) {
+		/* the commit could not be read, there is nothing to work out */
+	}
+
+	return true;
+}
+
+diff_stats diff_worker::compute_file_stats(const diff_file &file)
+{
+	diff_stats stats;
+	stats.computed = true;
+
+	try {
+		git::blob old_blob(nullptr);
+		if (!git_oid_iszero(&file.old_id)) {
+			old_blob = repo.blob_lookup(&file.old_id);
+			stats.old_size = old_blob.rawsize();
+		}
+
+		git::blob new_blob(nullptr);
+		if (!git_oid_iszero(&file.new_id)) {
+			new_blob = repo.blob_lookup(&file.new_id);
+			stats.new_size = new_blob.rawsize();
+		}
+
+		git::patch patch = git::patch::from_blobs(old_blob, file.old_path.c_str(), new_blob, file.new_path.c_str(), nullptr);
+		if (patch.get_delta()->flags & GIT_DIFF_FLAG_BINARY) {
+			stats.binary = true;
+			return stats;
+		}
+
+		size_t context, additions, deletions;
+		patch.line_stats(&context, &additions, &deletions);
+		stats.additions = additions;
+		stats.deletions = deletions;
+	} catch (const git::libgit_error &) {
+		/* the stats are left at what was read before the error, rather than being retried */
+	}
+
+	return stats;
+}
@@ -0,0 +1,237 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* diff_worker.h */
+#ifndef DIFF_WORKER_H
+#define DIFF_WORKER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <git2.h>
+
+#include "compat/cpp_git.h"
+#include "util/memory_usage.h"
+
+#include "diff_cache.h"
+
+/*!
+ * \class diff_worker
+ * \brief Class computing the diffs of commits on a background thread
+ *
+ * The worker has its own repository so that libgit2 is never used from two
+ * threads at once. Each request is given a generation number and a new
+ * request supersedes the ones before it, which are cancelled as soon as
+ * possible. The callbacks are called on the worker thread along with the
+ * generation of the request they belong to, so the caller can drop the
+ * results of requests that are no longer current.
+ *
+ * Computed diffs, patches and stats are kept in a diff_cache. When there are no
+ * requests left the worker diffs the commits it was asked to prefetch, so
+ * that they are already cached when they are requested.
+ */
+class diff_worker
+{
+public:
+	/*!
+	 * \brief Callback receiving the changed files as they are found
+	 * \param generation The generation of the request
+	 * \param files The next batch of files
+	 * \param finished Whether or not this is the last batch
+	 */
+	using files_callback = std::function<void(uint64_t generation, std::vector<diff_file> &&files, bool finished)>;
+
+	/*!
+	 * \brief Callback receiving a patch
+	 * \param generation The generation of the request
+	 * \param patch The hunk headers and lines of the patch, shared with the cache
+	 */
+	using patch_callback = std::function<void(uint64_t generation, std::shared_ptr<const diff_patch> patch)>;
+
+	/*!
+	 * \brief Callback receiving the stats of the changed files as they are worked out
+	 * \param generation The generation of the diff request
+	 * \param first_index The index of the first file the stats are for
+	 * \param stats The stats of the files from first_index onwards
+	 */
+	using stats_callback = std::function<void(uint64_t generation, size_t first_index, std::vector<diff_stats> &&stats)>;
+
+	/*!
+	 * \brief Start the worker thread
+	 * \param repo_path The path of the repository to open on the worker
+	 */
+	diff_worker(const std::string &repo_path);
+
+	diff_worker(const diff_worker &) = delete;
+	diff_worker &operator=(const diff_worker &) = delete;
+	diff_worker(diff_worker &&) = delete;
+	diff_worker &operator=(diff_worker &&) = delete;
+
+	/*!
+	 * \brief Cancel any running request and stop the worker thread
+	 */
+	~diff_worker();
+
+	/*!
+	 * \brief Request the files changed by a commit against its first parent
+	 *
+	 * Once all of the files have been given to callback, the stats of each
+	 * file are worked out in the background and given to stats_cb. Patch
+	 * requests go first and the stats carry on after them.
+	 *
+	 * \param commit_id The commit to diff
+	 * \param callback The function to give the files to, in batches
+	 * \param stats_cb The function to give the stats of the files to, in batches, or nullptr
+	 * \return The generation of the request
+	 */
+	uint64_t request_diff(const git_oid &commit_id, files_callback callback, stats_callback stats_cb = nullptr);
+
+	/*!
+	 * \brief Request the patch of a changed file
+	 * \param commit_id The commit the file was changed in
+	 * \param file_index The index of the file in the files of the commit's diff
+	 * \param file The file to create the patch for
+	 * \param callback The function to give the patch to
+	 * \return The generation of the request
+	 */
+	uint64_t request_patch(const git_oid &commit_id, size_t file_index, const diff_file &file, patch_callback callback);
+
+	/*!
+	 * \brief Diff commits in the background while there are no other requests
+	 *
+	 * The commits replace the ones from any previous call and are diffed in
+	 * order. A prefetch is abandoned as soon as another request comes in.
+	 *
+	 * \param commit_ids The commits to diff
+	 */
+	void prefetch_diffs(std::vector<git_oid> commit_ids);
+
+	/*!
+	 * \brief Cancel all of the requests
+	 */
+	void cancel();
+
+	/*!
+	 * \brief Set whether or not diffs pair up renamed and copied files
+	 *
+	 * Diffs computed either way are cached separately. Every request is
+	 * cancelled, since the files of a diff change with the setting.
+	 *
+	 * \param find_similar Whether or not to look for renames and copies
+	 */
+	void set_find_similar(bool find_similar);
+
+	/*!
+	 * \brief Set whether or not merges are diffed against all of their parents
+	 *
+	 * A combined diff only lists the files that differ from every parent,
+	 * which are the files the merge had to resolve. The parents are diffed
+	 * at the same time on separate threads. Every request is cancelled.
+	 *
+	 * \param combined Whether or not to compute combined diffs of merges
+	 */
+	void set_combined(bool combined);
+
+	/*!
+	 * \brief Get the memory held by the cache of computed diffs
+	 *
+	 * The figures are updated by the worker whenever it adds to the cache and
+	 * can be read from any thread.
+	 *
+	 * \return The estimated bytes held and the number of diffs cached
+	 */
+	memory_usage get_cache_memory_usage() const;
+
+private:
+	struct diff_request
+	{
+		uint64_t generation;
+		git_oid commit_id;
+		files_callback callback;
+		stats_callback stats_cb;
+	};
+
+	struct stats_request
+	{
+		uint64_t generation;
+		git_oid commit_id;
+		size_t next_index;
+		stats_callback callback;
+	};
+
+	struct patch_request
+	{
+		uint64_t generation;
+		git_oid commit_id;
+		size_t file_index;
+		diff_file file;
+		patch_callback callback;
+	};
+
+	/* only used from the worker thread, along with the repositories the other parents of merges are diffed in */
+	std::string repo_path;
+	git::repository repo;
+	std::vector<std::unique_ptr<git::repository>> parent_repos;
+
+	std::mutex mutex;
+	std::condition_variable requests_changed;
+	bool stopping = false;
+	std::unique_ptr<diff_request> next_diff;
+	std::unique_ptr<patch_request> next_patch;
+	std::unique_ptr<stats_request> next_stats;
+	std::vector<git_oid> prefetch_queue;
+	uint64_t prefetch_queue_generation = 0;
+
+	/* the generations of the latest requests, a running request stops once its generation is out of date,
+	 * the prefetch generation changes whenever any request comes in */
+	std::atomic<uint64_t> diff_generation;
+	std::atomic<uint64_t> patch_generation;
+	std::atomic<uint64_t> prefetch_generation;
+
+	/* read whenever the worker makes a diff_key, changing them cancels the requests made before */
+	std::atomic<bool> find_similar;
+	std::atomic<bool> combined;
+
+	/* only used from the worker thread, its size is copied out after every change */
+	diff_cache cache;
+	std::atomic<size_t> cache_bytes;
+	std::atomic<size_t> cache_entries;
+
+	/* started last, once everything it uses is constructed */
+	std::thread thread;
+
+	void run();
+	diff_key get_diff_key(const git::commit &commit) const;
+	bool compute_diff(const git_oid &commit_id, const std::atomic<uint64_t> &current_generation, uint64_t generation,
+			const files_callback &callback);
+	bool compute_combined_diff(const git::commit &commit, const std::atomic<uint64_t> &current_generation, uint64_t generation,
+			std::vector<diff_file> &files);
+	void compute_patch(const patch_request &request);
+	bool compute_stats(stats_request &request, uint64_t interrupt_generation);
+	diff_stats compute_file_stats(const diff_file &file);
+	void publish_cache_usage();
+};
+
+#endif /* DIFF_WORKER_H */
@@ -16,10 +16,13 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <cassert>
 #include <climits>
-#include <vector>
 #include <stdexcept>
+#include <vector>
+
+#include "util/trace.h"
 
 #include "commit_list.h"
 #include "graph.h"
@@ -107,6 +110,11 @@ size_t graph_list::mark_graph_duplicates(commit_graph_info &graph)
 
 void graph_list::add_parents(size_t list_head_commit, const commit_graph_info &graph)
 {
+	if (lane_policy == graph_lane_policy::COMPACT) {
+		add_parents_compact(list_head_commit, graph);
+		return;
+	}
+
 	size_t pos = list_head_commit;
 
 	for (unsigned int i = 1; i < graph.num_parents; i++) {
@@ -140,6 +148,70 @@ void graph_list::add_parents(size_t list_head_commit, const commit_graph_info &g
 	}
 }
 
+void graph_list::add_parents_compact(size_t list_head_commit, const commit_graph_info &graph)
+{
+	/* the commit's branch would only run alongside the branch waiting on its first parent
+	 * until that parent is reached, so it ends here and the lane is free from the next row */
+	if (graph.first_parent_target_id != NO_MERGE_TARGET) {
+		const unsigned int target_id = graph.first_parent_target_id;
+		auto target = std::find_if(glist.begin() + list_head_commit + 1, glist.end(), [target_id](const node &node) {
+			return node.status == GRAPH_STATUS::OLD && node.commit_list_branch_id == target_id;
+		});
+
+		if (target != glist.end()) {
+			target->status = GRAPH_STATUS::REM_MERGE;
+			glist[list_head_commit].status = GRAPH_STATUS::COMMIT_MERGED;
+		}
+	}
+
+	for (unsigned int i = 1; i < graph.num_parents; i++) {
+		const unsigned int parent_id = graph.new_parent_ids[i - 1];
+		const unsigned int target_id = i - 1 < graph.merge_target_ids.size() ?
+				graph.merge_target_ids[i - 1] : NO_MERGE_TARGET;
+
+		/* draw the merge into a branch which is already waiting on the parent, the new
+		 * branch for the parent will be found as a duplicate of it later on */
+		if (target_id != NO_MERGE_TARGET) {
+			auto target = std::find_if(glist.begin() + list_head_commit + 1, glist.end(), [target_id](const node &node) {
+				return node.status == GRAPH_STATUS::OLD && node.commit_list_branch_id == target_id;
+			});
+
+			if (target != glist.end()) {
+				target->status = GRAPH_STATUS::REM_MERGE;
+				continue;
+			}
+		}
+
+		/* otherwise prefer a lane which is ending on this row, then an empty lane */
+		auto free_lane = std::find_if(glist.begin() + list_head_commit + 1, glist.end(), [](const node &node) {
+			return node.status == GRAPH_STATUS::REMOVED;
+		});
+
+		if (free_lane != glist.end()) {
+			free_lane->commit_list_branch_id = parent_id;
+			free_lane->status = GRAPH_STATUS::REM_MERGE;
+			continue;
+		}
+
+		free_lane = std::find_if(glist.begin() + list_head_commit + 1, glist.end(), [](const node &node) {
+			return node.status == GRAPH_STATUS::EMPTY;
+		});
+
+		if (free_lane != glist.end()) {
+			free_lane->commit_list_branch_id = parent_id;
+			free_lane->status = GRAPH_STATUS::MERGE_HEAD;
+			free_lane->color = get_next_color();
+			continue;
+		}
+
+		node node;
+		node.commit_list_branch_id = parent_id;
+		node.status = GRAPH_STATUS::MERGE_HEAD;
+		node.color = get_next_color();
+		glist.push_back(node);
+	}
+}
+
 void graph_list::cleanup_empty_graph_right()
 {
 	auto it = glist.end();
@@ -155,9 +227,7 @@ void graph_list::cleanup_empty_graph_right()
 	}
 }
 
-static void draw_merge_connection(
-		graph_char (&buf)[preferences::max_line_length],
-		int index, unsigned char color)
+static void draw_merge_connection(graph_char *buf, int index, unsigned char color)
 {
 	for (; (buf[index].flags & G_MARK) == 0; index--) {
 		assert(index > 0);
@@ -232,8 +302,20 @@ void graph_list::initialize()
 	glist.clear();
 }
 
-size_t graph_list::compute_graph(commit_graph_info &graph, graph_char (&buf)[preferences::max_line_length])
+void graph_list::set_lane_policy(graph_lane_policy policy)
 {
+	lane_policy = policy;
+}
+
+memory_usage graph_list::get_memory_usage() const
+{
+	return { "graph_list", vector_memory(glist), glist.size() };
+}
+
+size_t graph_list::compute_graph(commit_graph_info &graph, std::vector<graph_char> &buf)
+{
+	TRACE_SCOPE("graph_list::compute_graph");
+
 	int graph_index = search_for_commit_index(graph);
 
 	if (graph_index == -1) {
@@ -251,92 +333,121 @@ size_t graph_list::compute_graph(commit_graph_info &graph, graph_char (&buf)[pre
 
 	search_for_collapses(graph_index);
 
+	/* every node takes up at most two characters, the unused space is trimmed at the end */
+	const size_t row_begin = buf.size();
+	buf.resize(row_begin + glist.size() * 2);
+	graph_char *row = buf.data() + row_begin;
+
 	size_t i = 0;
 	for (auto it = glist.begin(); it != glist.end(); it++) {
-		if (i < preferences::max_line_length) {
-			switch (it->status) {
-			case GRAPH_STATUS::OLD:
-				buf[i].color = it->color;
-				buf[i++].flags = G_UPPER | G_LOWER;
-				break;
-			case GRAPH_STATUS::COMMIT:
-				buf[i].color = 0;
-				buf[i++].flags = G_MARK;
-				break;
-			case GRAPH_STATUS::COMMIT_INITIAL:
-				buf[i].color = 0;
-				buf[i++].flags = G_MARK | G_INITIAL;
-				it->status = GRAPH_STATUS::EMPTY;
-				break;
-			case GRAPH_STATUS::MERGE_HEAD:
-				buf[i].color = it->color;
-				buf[i++].flags = G_LOWER | G_LEFT;
-				it->status = GRAPH_STATUS::OLD;
-				draw_merge_connection(buf, i - 2, it->color);
-				break;
-			case GRAPH_STATUS::REM_MERGE:
-				buf[i].color = it->color;
-				buf[i++].flags = G_LOWER | G_LEFT | G_UPPER;
-				it->status = GRAPH_STATUS::OLD;
-				draw_merge_connection(buf, i - 2, it->color);
-				break;
-			case GRAPH_STATUS::REMOVED:
-				buf[i].color = it->color;
-				buf[i++].flags = G_UPPER | G_LEFT;
-				it->status = GRAPH_STATUS::EMPTY;
-				draw_merge_connection(buf, i - 2, it->color);
-				remove_color(it->color);
-				break;
-			case GRAPH_STATUS::CLPSE_BEG:
-				buf[i-1].color = it->color;
-				buf[i-1].flags = G_LEFT | G_RIGHT;
-				buf[i].color = it->color;
-				buf[i++].flags = G_UPPER | G_LEFT;
-				it->status = GRAPH_STATUS::EMPTY;
-				break;
-			case GRAPH_STATUS::CLPSE_MID:
-				buf[i-1].color = it->color;
-				buf[i-1].flags = G_LEFT | G_RIGHT;
-				buf[i].color = it->color;
-				buf[i++].flags = G_LEFT | G_RIGHT;
-				it->status = GRAPH_STATUS::EMPTY;
-				break;
-			case GRAPH_STATUS::CLPSE_END:
-				buf[i].color = it->color;
-				buf[i++].flags = G_LOWER | G_RIGHT;
-				it->status = GRAPH_STATUS::OLD;
-				break;
-			case GRAPH_STATUS::EMPTY:
-				buf[i].color = 0;
-				buf[i++].flags = G_EMPTY;
-				break;
-			}
-
-			buf[i].color = 0;
-			buf[i++].flags = G_EMPTY;
-		} else {
-			switch (it->status) {
-			case GRAPH_STATUS::MERGE_HEAD:
-			case GRAPH_STATUS::REM_MERGE:
-			case GRAPH_STATUS::CLPSE_END:
-				it->status = GRAPH_STATUS::OLD;
-				break;
-			case GRAPH_STATUS::REMOVED:
-				remove_color(it->color);
-			case GRAPH_STATUS::COMMIT_INITIAL:
-			case GRAPH_STATUS::CLPSE_BEG:
-			case GRAPH_STATUS::CLPSE_MID:
-				it->status = GRAPH_STATUS::EMPTY;
-				break;
-			case GRAPH_STATUS::OLD:
-			case GRAPH_STATUS::COMMIT:
-			case GRAPH_STATUS::EMPTY:
-				break;
-			}
+		switch (it->status) {
+		case GRAPH_STATUS::OLD:
+			row[i].color = it->color;
+			row[i++].flags = G_UPPER | G_LOWER;
+			break;
+		case GRAPH_STATUS::COMMIT:
+			row[i].color = 0;
+			row[i++].flags = G_MARK;
+			break;
+		case GRAPH_STATUS::COMMIT_INITIAL:
+			row[i].color = 0;
+			row[i++].flags = G_MARK | G_INITIAL;
+			it->status = GRAPH_STATUS::EMPTY;
+			break;
+		case GRAPH_STATUS::COMMIT_MERGED:
+			row[i].color = 0;
+			row[i++].flags = G_MARK;
+			it->status = GRAPH_STATUS::EMPTY;
+			remove_color(it->color);
+			break;
+		case GRAPH_STATUS::MERGE_HEAD:
+			row[i].color = it->color;
+			row[i++].flags = G_LOWER | G_LEFT;
+			it->status = GRAPH_STATUS::OLD;
+			draw_merge_connection(row, i - 2, it->color);
+			break;
+		case GRAPH_STATUS::REM_MERGE:
+			row[i].color = it->color;
+			row[i++].flags = G_LOWER | G_LEFT | G_UPPER;
+			it->status = GRAPH_STATUS::OLD;
+			draw_merge_connection(row, i - 2, it->color);
+			break;
+		case GRAPH_STATUS::REMOVED:
+			row[i].color = it->color;
+			row[i++].flags = G_UPPER | G_LEFT;
+			it->status = GRAPH_STATUS::EMPTY;
+			draw_merge_connection(row, i - 2, it->color);
+			remove_color(it->color);
+			break;
+		case GRAPH_STATUS::CLPSE_BEG:
+			row[i-1].color = it->color;
+			row[i-1].flags = G_LEFT | G_RIGHT;
+			row[i].color = it->color;
+			row[i++].flags = G_UPPER | G_LEFT;
+			it->status = GRAPH_STATUS::EMPTY;
+			break;
+		case GRAPH_STATUS::CLPSE_MID:
+			row[i-1].color = it->color;
+			row[i-1].flags = G_LEFT | G_RIGHT;
+			row[i].color = it->color;
+			row[i++].flags = G_LEFT | G_RIGHT;
+			it->status = GRAPH_STATUS::EMPTY;
+			break;
+		case GRAPH_STATUS::CLPSE_END:
+			row[i].color = it->color;
+			row[i++].flags = G_LOWER | G_RIGHT;
+			it->status = GRAPH_STATUS::OLD;
+			break;
+		case GRAPH_STATUS::EMPTY:
+			row[i].color = 0;
+			row[i++].flags = G_EMPTY;
+			break;
 		}
+
+		row[i].color = 0;
+		row[i++].flags = G_EMPTY;
 	}
 
 	cleanup_empty_graph_right();
 
+	buf.resize(row_begin + i);
+
 	return i;
 }
+
+graph_layout::graph_layout(graph_list &glist) :
+	glist(glist)
+{
+}
+
+graph_layout::~graph_layout()
+{
+	wait();
+}
+
+void graph_layout::start(std::vector<commit_graph_info> &&batch)
+{
+	wait();
+
+	graphs = std::move(batch);
+	rows.chars.clear();
+	rows.row_ends.clear();
+	rows.row_ends.reserve(graphs.size());
+
+	thread = std::thread([this] () {
+		TRACE_SCOPE("graph_layout::start");
+
+		for (commit_graph_info &graph : graphs) {
+			glist.compute_graph(graph, rows.chars);
+			rows.row_ends.push_back(rows.chars.size());
+		}
+	});
+}
+
+const graph_rows &graph_layout::wait()
+{
+	if (thread.joinable())
+		thread.join();
+
+	return rows;
+}
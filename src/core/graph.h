@@ -20,8 +20,11 @@
 #ifndef GRAPH_H
 #define GRAPH_H
 
+#include <thread>
 #include <vector>
 
+#include "util/memory_usage.h"
+
 #include "commit_list.h"
 
 constexpr unsigned char GRAPH_MAX_COLORS = 6;
@@ -57,13 +60,25 @@ public:
 	 */
 	void initialize();
 
+	/*!
+	 * \brief Set the policy for placing new branches in the graph, takes effect from the next row
+	 * \param policy The graph_lane_policy to use
+	 */
+	void set_lane_policy(graph_lane_policy policy);
+
 	/*!
 	 * \brief Compute the next step in the graph
 	 * \param graph The commit_graph_info structure describing the changes to the graph
-	 * \param buf The buffer to write the graph_chars to
-	 * \return The number of characters writtn to the buffer
+	 * \param buf The buffer to append the graph_chars to, it grows to fit the whole row
+	 * \return The number of characters appended to the buffer
 	 */
-	size_t compute_graph(commit_graph_info &graph, graph_char (&buf)[preferences::max_line_length]);
+	size_t compute_graph(commit_graph_info &graph, std::vector<graph_char> &buf);
+
+	/*!
+	 * \brief Estimate the memory held by the graph
+	 * \return The bytes held and the number of lanes
+	 */
+	memory_usage get_memory_usage() const;
 
 private:
 	enum class GRAPH_STATUS : char {
@@ -72,6 +87,7 @@ private:
 		REMOVED,
 		COMMIT,
 		COMMIT_INITIAL,
+		COMMIT_MERGED,
 		EMPTY,
 		MERGE_HEAD,
 		REM_MERGE,
@@ -95,6 +111,7 @@ private:
 
 	unsigned int color_branches[GRAPH_MAX_COLORS] = { 0 };
 	std::vector<node> glist;
+	graph_lane_policy lane_policy = graph_lane_policy::FIRST_FIT;
 
 	/*!
 	 * \brief Gets the next color to use for a new branch
@@ -129,6 +146,21 @@ private:
 	 */
 	void add_parents(size_t list_head_commit, const commit_graph_info &graph);
 
+	/*!
+	 * \brief Add the parents for the current node, merging into waiting branches where possible
+	 *
+	 * Parents which another branch is already waiting on are drawn into that
+	 * branch's lane when it is to the right of the commit. For the first parent
+	 * this ends the commit's own lane on this row, rather than on the row of the
+	 * parent, so the lane is free for the rows in between. Otherwise a new lane
+	 * is placed the same way as add_parents, except that lanes ending on this
+	 * row are preferred over empty lanes.
+	 *
+	 * \param list_head_commit The index of the node to add the parents
+	 * \param graph The commit_graph_info structure
+	 */
+	void add_parents_compact(size_t list_head_commit, const commit_graph_info &graph);
+
 	/*!
 	 * \brief Erase any empty graph nodes on the right
 	 */
@@ -149,4 +181,51 @@ private:
 	void search_for_collapses(int index_of_commit);
 };
 
+/*!
+ * \struct graph_rows
+ * \brief The graph rows of a batch of commits, stored one after another
+ */
+struct graph_rows {
+	/*! \brief The characters of all of the rows */
+	std::vector<graph_char> chars;
+	/*! \brief The offset in chars where each row ends */
+	std::vector<size_t> row_ends;
+};
+
+/*!
+ * \class graph_layout
+ * \brief Class to compute the graph rows of a batch of commits on another thread
+ *
+ * Each row depends on the rows before it, so the batches are laid out one at
+ * a time and in order. The thread which walks the commits can carry on with
+ * the next batch in the meantime.
+ */
+class graph_layout {
+public:
+	/*!
+	 * \brief Create a new instance of graph_layout
+	 * \param glist The graph_list to compute the rows with, it must not be used elsewhere while a batch is laid out
+	 */
+	graph_layout(graph_list &glist);
+	~graph_layout();
+
+	/*!
+	 * \brief Start laying out a batch, after waiting for the previous one
+	 * \param graphs The commit_graph_info structures of the batch, in the order of the commits
+	 */
+	void start(std::vector<commit_graph_info> &&graphs);
+
+	/*!
+	 * \brief Wait for the batch to be laid out
+	 * \return The rows of the batch, valid until the next batch is started
+	 */
+	const graph_rows &wait();
+
+private:
+	graph_list &glist;
+	std::vector<commit_graph_info> graphs;
+	graph_rows rows;
+	std::thread thread;
+};
+
 #endif /* GRAPH_H */
@@ -0,0 +1,357 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include "util/preferences.h"
+
+#include "patch_highlighter.h"
+
+/* the keywords of the common C like languages and scripting languages, sorted */
+static const char *const keywords[] = {
+	"and", "as", "async", "auto", "await", "bool", "break", "case", "catch", "char", "class", "const",
+	"constexpr", "continue", "def", "default", "delete", "do", "double", "elif", "else", "enum", "except",
+	"explicit", "export", "extern", "false", "final", "finally", "float", "fn", "for", "from", "func",
+	"function", "goto", "if", "impl", "import", "in", "inline", "int", "interface", "is", "let", "long",
+	"match", "mut", "namespace", "new", "noexcept", "not", "null", "nullptr", "operator", "or", "override",
+	"package", "pass", "private", "protected", "pub", "public", "raise", "return", "self", "short",
+	"signed", "sizeof", "static", "struct", "super", "switch", "template", "this", "throw", "true", "try",
+	"typedef", "typename", "union", "unsigned", "use", "using", "var", "virtual", "void", "volatile",
+	"while", "with", "yield",
+};
+
+/* bytes of multibyte UTF-8 characters count as identifier characters, so tokens never split a character */
+static bool is_identifier_char(unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || c >= 0x80;
+}
+
+/* compares a keyword with a token that is not null terminated */
+static int compare_keyword(const char *keyword, const char *token, size_t length)
+{
+	const int cmp = strncmp(keyword, token, length);
+	if (cmp != 0)
+		return cmp;
+
+	return keyword[length] == '\0' ? 0 : 1;
+}
+
+static bool is_keyword(const char *token, size_t length)
+{
+	auto it = std::lower_bound(std::begin(keywords), std::end(keywords), token, [length] (const char *keyword, const char *token) {
+		return compare_keyword(keyword, token, length) < 0;
+	});
+
+	return it != std::end(keywords) && compare_keyword(*it, token, length) == 0;
+}
+
+static void tokenize_line(const char *text, uint32_t length, std::vector<highlight_span> &spans)
+{
+	uint32_t i = 0;
+
+	/* a # at the start of a line is a comment in the scripting languages and a directive in C */
+	while (i < length && (text[i] == ' ' || text[i] == '\t'))
+		i++;
+	if (i < length && text[i] == '#') {
+		spans.push_back({ i, length, highlight_kind::COMMENT });
+		return;
+	}
+
+	while (i < length) {
+		const unsigned char c = text[i];
+
+		if (c == '/' && i + 1 < length && text[i + 1] == '/') {
+			spans.push_back({ i, length, highlight_kind::COMMENT });
+			return;
+		} else if (c == '/' && i + 1 < length && text[i + 1] == '*') {
+			const char *end = nullptr;
+			for (uint32_t j = i + 2; j + 1 < length; j++) {
+				if (text[j] == '*' && text[j + 1] == '/') {
+					end = text + j + 2;
+					break;
+				}
+			}
+
+			const uint32_t comment_end = end != nullptr ? end - text : length;
+			spans.push_back({ i, comment_end, highlight_kind::COMMENT });
+			i = comment_end;
+		} else if (c == '"' || c == '\'' || c == '`') {
+			uint32_t j = i + 1;
+			while (j < length && text[j] != c) {
+				if (text[j] == '\\')
+					j++;
+				j++;
+			}
+
+			const uint32_t string_end = std::min(j + 1, length);
+			spans.push_back({ i, string_end, highlight_kind::STRING });
+			i = string_end;
+		} else if (c >= '0' && c <= '9') {
+			uint32_t j = i + 1;
+			while (j < length && (is_identifier_char(text[j]) || text[j] == '.'))
+				j++;
+
+			spans.push_back({ i, j, highlight_kind::NUMBER });
+			i = j;
+		} else if (is_identifier_char(c)) {
+			uint32_t j = i + 1;
+			while (j < length && is_identifier_char(text[j]))
+				j++;
+
+			if (is_keyword(text + i, j - i))
+				spans.push_back({ i, j, highlight_kind::KEYWORD });
+			i = j;
+		} else {
+			i++;
+		}
+	}
+}
+
+/* the end of the word starting at i, words are runs of identifier characters or of spaces, or single punctuation */
+static uint32_t next_word_end(const char *text, uint32_t length, uint32_t i)
+{
+	const unsigned char c = text[i];
+	uint32_t j = i + 1;
+	if (is_identifier_char(c)) {
+		while (j < length && is_identifier_char(text[j]))
+			j++;
+	} else if (c == ' ' || c == '\t') {
+		while (j < length && (text[j] == ' ' || text[j] == '\t'))
+			j++;
+	}
+
+	return j;
+}
+
+static std::vector<uint32_t> split_words(const char *text, uint32_t length)
+{
+	std::vector<uint32_t> word_ends;
+	for (uint32_t i = 0; i < length; i = word_ends.back())
+		word_ends.push_back(next_word_end(text, length, i));
+
+	return word_ends;
+}
+
+/* finds the words of a line between the words it shares with the start and the end of the other line */
+static void find_changed_words(const char *text, uint32_t length, const char *other_text, uint32_t other_length,
+		uint32_t &changed_begin, uint32_t &changed_end)
+{
+	const std::vector<uint32_t> words = split_words(text, length);
+	const std::vector<uint32_t> other_words = split_words(other_text, other_length);
+
+	size_t num_prefix = 0;
+	uint32_t prefix_length = 0;
+	while (num_prefix < words.size() && num_prefix < other_words.size() && words[num_prefix] == other_words[num_prefix]
+			&& memcmp(text + prefix_length, other_text + prefix_length, words[num_prefix] - prefix_length) == 0) {
+		prefix_length = words[num_prefix];
+		num_prefix++;
+	}
+
+	size_t num_suffix = 0;
+	uint32_t suffix_length = 0;
+	while (num_suffix + num_prefix < words.size() && num_suffix + num_prefix < other_words.size()) {
+		const size_t word = words.size() - num_suffix - 1;
+		const size_t other_word = other_words.size() - num_suffix - 1;
+		const uint32_t begin = word > 0 ? words[word - 1] : 0;
+		const uint32_t other_begin = other_word > 0 ? other_words[other_word - 1] : 0;
+		const uint32_t word_length = words[word] - begin;
+		if (word_length != other_words[other_word] - other_begin || memcmp(text + begin, other_text + other_begin, word_length) != 0)
+			break;
+
+		suffix_length += word_length;
+		num_suffix++;
+	}
+
+	/* a line with nothing in common with its partner is left plain, since every word of it changed */
+	if (prefix_length == 0 && suffix_length == 0) {
+		changed_begin = changed_end = 0;
+		return;
+	}
+
+	changed_begin = prefix_length;
+	changed_end = length - suffix_length;
+}
+
+static bool is_deletion(char origin)
+{
+	return origin == GIT_DIFF_LINE_DELETION;
+}
+
+static bool is_addition(char origin)
+{
+	return origin == GIT_DIFF_LINE_ADDITION;
+}
+
+/* finds the run of deleted lines followed by added lines around line i, false if it is too long or not in that order */
+static bool find_change_run(const diff_patch &patch, size_t i, size_t &run_begin, size_t &num_deletions, size_t &run_end)
+{
+	const auto is_change = [&patch] (size_t line) {
+		return is_deletion(patch.lines[line].origin) || is_addition(patch.lines[line].origin);
+	};
+
+	run_begin = i;
+	while (run_begin > 0 && is_change(run_begin - 1)) {
+		if (i - run_begin >= preferences::intra_line_max_run)
+			return false;
+		run_begin--;
+	}
+
+	run_end = i + 1;
+	while (run_end < patch.lines.size() && is_change(run_end)) {
+		if (run_end - run_begin >= preferences::intra_line_max_run)
+			return false;
+		run_end++;
+	}
+
+	num_deletions = 0;
+	while (run_begin + num_deletions < run_end && is_deletion(patch.lines[run_begin + num_deletions].origin))
+		num_deletions++;
+
+	for (size_t line = run_begin + num_deletions; line < run_end; line++)
+		if (!is_addition(patch.lines[line].origin))
+			return false;
+
+	return true;
+}
+
+std::shared_ptr<patch_highlight_block> patch_highlighter::highlight_block(const diff_patch &patch, size_t block_index)
+{
+	std::shared_ptr<patch_highlight_block> block = std::make_shared<patch_highlight_block>();
+
+	const size_t first_line = block_index * preferences::highlight_block_size;
+	const size_t end_line = std::min(first_line + preferences::highlight_block_size, patch.lines.size());
+	if (first_line >= end_line)
+		return block;
+
+	block->lines.reserve(end_line - first_line);
+
+	/* the run the previous line was in, so that each run is only looked for once */
+	bool run_valid = false;
+	size_t run_begin = 0, num_deletions = 0, run_end = 0;
+
+	for (size_t i = first_line; i < end_line; i++) {
+		const diff_patch::line &line = patch.lines[i];
+		const char *text = patch.text.data() + line.offset;
+		const uint32_t length = std::min(size_t(line.length), size_t(preferences::max_line_length));
+
+		line_highlight highlight = { static_cast<uint32_t>(block->spans.size()), 0, 0, 0 };
+
+		if (line.origin != GIT_DIFF_LINE_HUNK_HDR) {
+			tokenize_line(text, length, block->spans);
+			highlight.num_spans = block->spans.size() - highlight.first_span;
+		}
+
+		if (is_deletion(line.origin) || is_addition(line.origin)) {
+			if (i >= run_end || i < run_begin) {
+				run_valid = find_change_run(patch, i, run_begin, num_deletions, run_end);
+				if (!run_valid) {
+					run_begin = i;
+					run_end = i + 1;
+				}
+			}
+
+			/* the nth deleted line of a run is replaced by its nth added line */
+			const size_t index_in_run = i - run_begin;
+			size_t partner = SIZE_MAX;
+			if (run_valid && index_in_run < num_deletions && run_begin + num_deletions + index_in_run < run_end)
+				partner = run_begin + num_deletions + index_in_run;
+			else if (run_valid && index_in_run >= num_deletions && index_in_run - num_deletions < num_deletions)
+				partner = run_begin + index_in_run - num_deletions;
+
+			if (partner != SIZE_MAX) {
+				const diff_patch::line &other = patch.lines[partner];
+				find_changed_words(text, length, patch.text.data() + other.offset,
+						std::min(size_t(other.length), size_t(preferences::max_line_length)),
+						highlight.changed_begin, highlight.changed_end);
+			}
+		}
+
+		block->lines.push_back(highlight);
+	}
+
+	return block;
+}
+
+patch_highlighter::patch_highlighter() :
+	generation(0),
+	thread(&patch_highlighter::run, this)
+{}
+
+patch_highlighter::~patch_highlighter()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		generation++;
+	}
+
+	requests_changed.notify_one();
+	thread.join();
+}
+
+uint64_t patch_highlighter::set_patch(std::shared_ptr<const diff_patch> new_patch, block_callback new_callback)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	patch = std::move(new_patch);
+	callback = std::move(new_callback);
+	pending_blocks.clear();
+
+	return ++generation;
+}
+
+void patch_highlighter::request_blocks(std::vector<size_t> block_indices)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	pending_blocks = std::move(block_indices);
+	std::reverse(pending_blocks.begin(), pending_blocks.end());
+
+	lock.unlock();
+	requests_changed.notify_one();
+}
+
+void patch_highlighter::run()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	for (;;) {
+		requests_changed.wait(lock, [this] () { return stopping || !pending_blocks.empty(); });
+		if (stopping)
+			return;
+
+		const size_t block_index = pending_blocks.back();
+		pending_blocks.pop_back();
+
+		/* the patch and callback are kept alive by the copies even if the patch is changed meanwhile */
+		std::shared_ptr<const diff_patch> current_patch = patch;
+		block_callback current_callback = callback;
+		const uint64_t current_generation = generation.load();
+		lock.unlock();
+
+		if (current_patch) {
+			std::shared_ptr<const patch_highlight_block> block = highlight_block(*current_patch, block_index);
+			if (generation.load() == current_generation)
+				current_callback(current_generation, block_index, std::move(block));
+		}
+
+		lock.lock();
+	}
+}
@@ -0,0 +1,160 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* patch_highlighter.h */
+#ifndef PATCH_HIGHLIGHTER_H
+#define PATCH_HIGHLIGHTER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "diff_cache.h"
+
+/*! \brief The kinds of token that are coloured */
+enum class highlight_kind : char {
+	KEYWORD,
+	STRING,
+	COMMENT,
+	NUMBER,
+};
+
+/*!
+ * \struct highlight_span
+ * \brief A coloured token of a line
+ */
+struct highlight_span
+{
+	/*! \brief The byte offsets of the start and end of the token in the line */
+	uint32_t begin, end;
+	/*! \brief The kind of token */
+	highlight_kind kind;
+};
+
+/*!
+ * \struct line_highlight
+ * \brief The highlighting of a line
+ */
+struct line_highlight
+{
+	/*! \brief The first of the line's spans in patch_highlight_block::spans */
+	uint32_t first_span;
+	/*! \brief The number of spans, which are in order and do not overlap */
+	uint32_t num_spans;
+	/*! \brief The byte offsets of the part of the line that differs from the line it replaced or was replaced by,
+	 * equal if there is no such part */
+	uint32_t changed_begin, changed_end;
+};
+
+/*!
+ * \struct patch_highlight_block
+ * \brief The highlighting of a block of preferences::highlight_block_size lines of a patch
+ */
+struct patch_highlight_block
+{
+	/*! \brief The highlighting of each line in the block */
+	std::vector<line_highlight> lines;
+	/*! \brief The spans of every line in the block */
+	std::vector<highlight_span> spans;
+};
+
+/*!
+ * \class patch_highlighter
+ * \brief Class highlighting blocks of lines of a patch on a background thread
+ *
+ * Lines are tokenized on their own with a tokenizer that knows the
+ * keywords, strings, comments and numbers of the common C like languages,
+ * so comments spanning several lines are only coloured on their first
+ * line. Deleted and added lines that replace each other are paired up in
+ * order and the words between their common start and end are marked as
+ * changed.
+ *
+ * Only the blocks that are asked for are highlighted, so the cost depends
+ * on how much of the patch is looked at rather than on its size.
+ */
+class patch_highlighter
+{
+public:
+	/*!
+	 * \brief Callback receiving a highlighted block, called on the highlighter thread
+	 * \param generation The generation of the patch the block belongs to
+	 * \param block_index The index of the block
+	 * \param block The highlighting of the lines in the block
+	 */
+	using block_callback = std::function<void(uint64_t generation, size_t block_index, std::shared_ptr<const patch_highlight_block> block)>;
+
+	/*!
+	 * \brief Start the highlighter thread
+	 */
+	patch_highlighter();
+
+	patch_highlighter(const patch_highlighter &) = delete;
+	patch_highlighter &operator=(const patch_highlighter &) = delete;
+	patch_highlighter(patch_highlighter &&) = delete;
+	patch_highlighter &operator=(patch_highlighter &&) = delete;
+
+	/*!
+	 * \brief Drop the pending blocks and stop the highlighter thread
+	 */
+	~patch_highlighter();
+
+	/*!
+	 * \brief Set the patch that blocks are highlighted from, dropping the blocks requested for the previous one
+	 * \param patch The patch, or nullptr
+	 * \param callback The function to give the highlighted blocks to
+	 * \return The generation of the patch
+	 */
+	uint64_t set_patch(std::shared_ptr<const diff_patch> patch, block_callback callback);
+
+	/*!
+	 * \brief Request blocks of the current patch, replacing the blocks requested before
+	 * \param block_indices The blocks to highlight, in the order they are wanted
+	 */
+	void request_blocks(std::vector<size_t> block_indices);
+
+	/*!
+	 * \brief Highlight a block of lines of a patch
+	 * \param patch The patch the lines are in
+	 * \param block_index The index of the block
+	 * \return The highlighting of the lines in the block
+	 */
+	static std::shared_ptr<patch_highlight_block> highlight_block(const diff_patch &patch, size_t block_index);
+
+private:
+	std::mutex mutex;
+	std::condition_variable requests_changed;
+	bool stopping = false;
+	std::shared_ptr<const diff_patch> patch;
+	block_callback callback;
+	/* popped from the back */
+	std::vector<size_t> pending_blocks;
+	std::atomic<uint64_t> generation;
+
+	/* started last, once everything it uses is constructed */
+	std::thread thread;
+
+	void run();
+};
+
+#endif /* PATCH_HIGHLIGHTER_H */
@@ -16,61 +16,519 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include <assert.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include <git2.h>
 
+#include <QDirIterator>
+#include <QFile>
+#include <QRegularExpression>
+#include <QtAlgorithms>
+
 #include "compat/cpp_git.h"
+#include "util/error.h"
+#include "util/trace.h"
 
 #include "ref_map.h"
 
+/* the ref namespaces that are loaded along with the length of their prefix */
+static const std::pair<const char *, size_t> ref_namespaces[] = {
+	{ "refs/heads/", sizeof("refs/heads/") - 1 },
+	{ "refs/tags/", sizeof("refs/tags/") - 1 },
+	{ "refs/remotes/", sizeof("refs/remotes/") - 1 },
+};
+
+/* the number of loose ref files each thread reads at a time */
+constexpr size_t loose_ref_chunk_size = 64;
+
+/* the maximum size of a loose ref file that is read */
+constexpr qint64 loose_ref_max_size = 4096;
+
+/* returns the length of the namespace prefix of the ref name, or 0 if the ref is not loaded */
+static size_t get_shorthand_offset(const char *name, size_t name_len)
+{
+	for (const auto &ns : ref_namespaces)
+		if (name_len > ns.second && memcmp(name, ns.first, ns.second) == 0)
+			return ns.second;
+
+	return 0;
+}
+
+static bool is_tag_name(const char *name, size_t name_len)
+{
+	return name_len > sizeof("refs/tags/") - 1 && memcmp(name, "refs/tags/", sizeof("refs/tags/") - 1) == 0;
+}
+
+/* peel the target of a ref to a commit, if it is an annotated tag */
+static bool peel_to_commit(git_repository *repo, git_oid &target)
+{
+	git_object *obj = nullptr;
+	if (git_object_lookup(&obj, repo, &target, GIT_OBJ_ANY) != 0)
+		return false;
+
+	git_object *peeled_obj = nullptr;
+	int err = git_object_peel(&peeled_obj, obj, GIT_OBJ_COMMIT);
+	if (err == 0)
+		git_oid_cpy(&target, git_object_id(peeled_obj));
+
+	git_object_free(peeled_obj);
+	git_object_free(obj);
+	return err == 0;
+}
+
 ref_map::ref_map(const git::repository &repo)
 {
-	/* create an iterator to go through the refs */
-	auto it = repo.get_reference_iterator();
+	TRACE_SCOPE("ref_map::ref_map");
+
+	const std::string common_dir = repo.commondir();
 
-	while (!it.finished()) {
-		git::reference ref = it.get_reference();
+	/* the loose refs are read in the background while the packed refs are parsed */
+	std::vector<loose_ref> loose_refs;
+	std::thread loose_thread([&loose_refs, &common_dir] () {
+		loose_refs = read_loose_refs(common_dir);
+	});
 
-		if (!(ref.is_branch() || ref.is_tag() || ref.is_remote())) {
-			++it;
+	struct packed_ref {
+		const char *name;
+		size_t name_len;
+		git_oid target;
+		bool peeled;
+	};
+	std::vector<packed_ref> packed_refs;
+
+	QFile packed_refs_file(QFile::decodeName((common_dir + "packed-refs").c_str()));
+	const uchar *packed_refs_data = nullptr;
+	if (packed_refs_file.open(QIODevice::ReadOnly) && packed_refs_file.size() > 0)
+		packed_refs_data = packed_refs_file.map(0, packed_refs_file.size());
+
+	if (packed_refs_data != nullptr) {
+		parse_packed_refs(reinterpret_cast<const char *>(packed_refs_data), packed_refs_file.size(),
+				[&packed_refs] (const char *name, size_t name_len, const git_oid &target, bool peeled) {
+			if (get_shorthand_offset(name, name_len) != 0)
+				packed_refs.push_back({ name, name_len, target, peeled });
+		});
+	}
+
+	loose_thread.join();
+
+	refs.reserve(loose_refs.size() + packed_refs.size());
+
+	/* loose refs take priority over packed refs with the same name */
+	std::vector<const loose_ref *> symbolic_refs;
+	std::vector<std::string> hidden_names;
+	for (loose_ref &ref : loose_refs) {
+		if (!ref.symbolic_target.empty()) {
+			symbolic_refs.push_back(&ref);
+			continue;
+		}
+
+		/* a tag which does not point at a commit is left out, but it still replaces the packed one */
+		if (is_tag_name(ref.name.c_str(), ref.name.size()) && !peel_to_commit(repo._ptr(), ref.target)) {
+			hidden_names.push_back(ref.name);
 			continue;
 		}
 
-		const git_oid *id = ref.target();
+		add_ref(ref.name.c_str(), ref.name.size(), ref.target, refs.end());
+	}
+
+	std::sort(hidden_names.begin(), hidden_names.end());
+
+	/* tags can also point at trees and blobs, the type of an already peeled target is read
+	 * from the object header so that no objects are created for the packed tags */
+	const git::odb odb = repo.odb();
 
-		git::reference resolved_ref(nullptr);
-		if (id == NULL) {
-			resolved_ref = ref.resolve();
-			id = resolved_ref.target();
+	for (packed_ref &ref : packed_refs) {
+		if (is_tag_name(ref.name, ref.name_len)) {
+			if (!hidden_names.empty() && std::binary_search(hidden_names.begin(), hidden_names.end(), std::string(ref.name, ref.name_len)))
+				continue;
+
+			if (ref.peeled ? odb.read_type(&ref.target) != GIT_OBJ_COMMIT : !peel_to_commit(repo._ptr(), ref.target))
+				continue;
 		}
 
-		git_object *peeled_obj = NULL;
-		if (ref.is_tag()) {
-			git_reference_peel(&peeled_obj, ref._ptr(), GIT_OBJ_COMMIT);
-			id = git_object_id(peeled_obj);
+		add_ref(ref.name, ref.name_len, ref.target, refs.end());
+	}
+
+	sort_refs();
+
+	/* resolve the symbolic refs last so they can find their targets among the other refs */
+	for (const loose_ref *ref : symbolic_refs) {
+		const char *target_name = ref->symbolic_target.c_str();
+		auto target_it = std::lower_bound(refs.begin(), refs.end(), target_name,
+				[] (const struct ref &lhs, const char *rhs) { return name_less(lhs.name, rhs); });
+
+		git_oid target;
+		if (target_it != refs.end() && strcmp(target_it->name, target_name) == 0)
+			target = target_it->target;
+		else if (git_reference_name_to_id(&target, repo._ptr(), target_name) != 0)
+			continue;
+
+		/* there are only a few symbolic refs so they are inserted in place, replacing any packed ref */
+		const size_t shorthand_offset = get_shorthand_offset(ref->name.c_str(), ref->name.size());
+		auto it = std::lower_bound(refs.begin(), refs.end(), ref->name.c_str(),
+				[] (const struct ref &lhs, const char *rhs) { return name_less(lhs.name, rhs); });
+		if (it != refs.end() && strcmp(it->name, ref->name.c_str()) == 0)
+			it->target = target;
+		else if (shorthand_offset != 0)
+			add_ref(ref->name.c_str(), ref->name.size(), target, it);
+	}
+
+	/* all of the refs start active */
+	active_refs.assign((refs.size() + 63) / 64, 0);
+	set_refs_active(0, refs.size(), true);
+
+	/* build the index of the refs by their targets */
+	refs_by_target.resize(refs.size());
+	for (uint32_t i = 0; i < refs.size(); i++)
+		refs_by_target[i] = i;
+
+	std::sort(refs_by_target.begin(), refs_by_target.end(), [this] (uint32_t lhs, uint32_t rhs) {
+		const int cmp = git_oid_cmp(&refs[lhs].target, &refs[rhs].target);
+		return cmp < 0 || (cmp == 0 && lhs < rhs);
+	});
+}
+
+std::pair<ref_map::target_iterator, ref_map::target_iterator> ref_map::find_target(const git_oid &target) const
+{
+	struct target_cmp {
+		const std::vector<ref> &refs;
+
+		bool operator()(uint32_t lhs, const git_oid &rhs) const
+		{
+			return git_oid_cmp(&refs[lhs].target, &rhs) < 0;
+		}
+
+		bool operator()(const git_oid &lhs, uint32_t rhs) const
+		{
+			return git_oid_cmp(&lhs, &refs[rhs].target) < 0;
 		}
+	};
+
+	return std::equal_range(refs_by_target.begin(), refs_by_target.end(), target, target_cmp{ refs });
+}
+
+void ref_map::set_refs_active(size_t begin, size_t end, bool is_active)
+{
+	while (begin < end) {
+		/* set the bits from begin up to the end of its word or end, whichever is first */
+		const size_t word_end = std::min(end, (begin / 64 + 1) * 64);
+		const size_t num_bits = word_end - begin;
+		const uint64_t mask = (num_bits == 64 ? ~(uint64_t)0 : (((uint64_t)1 << num_bits) - 1)) << (begin % 64);
 
-		assert(id != NULL);
+		if (is_active)
+			active_refs[begin / 64] |= mask;
+		else
+			active_refs[begin / 64] &= ~mask;
 
-		const char *shorthand = ref.name();
-		std::pair<git::reference, bool> *pair_ref =
-			&refs.insert(std::make_pair(*id, std::make_pair(std::move(ref), true)))->second;
-		refs_ordered.insert(std::make_pair(shorthand, std::make_pair(*id, pair_ref)));
+		begin = word_end;
+	}
+}
 
-		git_object_free(peeled_obj);
+size_t ref_map::count_active_refs(size_t begin, size_t end) const
+{
+	size_t count = 0;
+	while (begin < end) {
+		const size_t word_end = std::min(end, (begin / 64 + 1) * 64);
+		const size_t num_bits = word_end - begin;
+		const uint64_t mask = (num_bits == 64 ? ~(uint64_t)0 : (((uint64_t)1 << num_bits) - 1)) << (begin % 64);
 
-		++it;
+		count += qPopulationCount(static_cast<quint64>(active_refs[begin / 64] & mask));
+		begin = word_end;
 	}
+
+	return count;
 }
 
-ref_map::~ref_map()
+size_t ref_map::set_refs_active_matching(const std::string &pattern, ref_pattern_syntax syntax, bool is_active)
 {
-	refs_ordered.clear();
-	refs.clear();
+	size_t num_matched = 0;
+
+	/* the matching refs are usually next to each other, so runs of them are set at once */
+	size_t run_begin = 0, run_end = 0;
+	const auto add_match = [&] (size_t index) {
+		if (index != run_end) {
+			set_refs_active(run_begin, run_end, is_active);
+			run_begin = index;
+		}
+
+		run_end = index + 1;
+		num_matched++;
+	};
+
+	if (syntax == ref_pattern_syntax::REGEX) {
+		const QRegularExpression regex(QString::fromStdString(pattern));
+		if (!regex.isValid())
+			throw reef_error("invalid regular expression: " + regex.errorString().toStdString());
+
+		for (size_t i = 0; i < refs.size(); i++)
+			if (regex.match(QString::fromUtf8(refs[i].name, refs[i].name_len)).hasMatch())
+				add_match(i);
+	} else {
+		/* only the refs starting with the part of the pattern before the first wildcard can match,
+		 * and they are all next to each other in the sorted refs */
+		const std::string prefix = pattern.substr(0, pattern.find_first_of("*?[\\"));
+		auto it = std::lower_bound(refs.begin(), refs.end(), prefix.c_str(),
+				[] (const struct ref &lhs, const char *rhs) { return name_less(lhs.name, rhs); });
+
+		for (; it != refs.end() && strncmp(it->name, prefix.c_str(), prefix.size()) == 0; it++)
+			if (glob_match(pattern.c_str() + prefix.size(), it->name + prefix.size()))
+				add_match(it - refs.begin());
+	}
+
+	set_refs_active(run_begin, run_end, is_active);
+
+	return num_matched;
 }
 
-void ref_map::set_ref_active(refs_ordered_map::iterator &iter, bool is_active)
+memory_usage ref_map::get_memory_usage() const
 {
-	iter->second.second->second = is_active;
+	const size_t bytes = names.get_stats().reserved_bytes + vector_memory(refs) + vector_memory(refs_by_target) + vector_memory(active_refs);
+	return { "ref_map", bytes, refs.size() };
+}
+
+/* matches c against the character class following a '[', sets class_end to the closing ']',
+ * returns false if the class is not closed */
+static bool match_char_class(const char *pattern, unsigned char c, const char *&class_end, bool &matched)
+{
+	const bool negated = *pattern == '!' || *pattern == '^';
+	if (negated)
+		pattern++;
+
+	/* a ']' straight after the '[' is part of the class */
+	bool found = false;
+	do {
+		if (*pattern == '\0')
+			return false;
+
+		unsigned char low = *pattern;
+		if (low == '\\' && pattern[1] != '\0')
+			low = *++pattern;
+
+		unsigned char high = low;
+		if (pattern[1] == '-' && pattern[2] != ']' && pattern[2] != '\0') {
+			pattern += 2;
+			high = *pattern;
+			if (high == '\\' && pattern[1] != '\0')
+				high = *++pattern;
+		}
+
+		if (low <= c && c <= high)
+			found = true;
+
+		pattern++;
+	} while (*pattern != ']');
+
+	class_end = pattern;
+	matched = found != negated;
+	return true;
+}
+
+bool ref_map::glob_match(const char *pattern, const char *name)
+{
+	for (; *pattern != '\0'; pattern++, name++) {
+		switch (*pattern) {
+		case '*': {
+			/* "**" also matches across directories */
+			const bool cross_dirs = pattern[1] == '*';
+			while (*pattern == '*')
+				pattern++;
+
+			for (;; name++) {
+				if (glob_match(pattern, name))
+					return true;
+
+				if (*name == '\0' || (!cross_dirs && *name == '/'))
+					return false;
+			}
+		}
+		case '?':
+			if (*name == '\0' || *name == '/')
+				return false;
+			break;
+		case '[': {
+			const char *class_end;
+			bool matched;
+			if (match_char_class(pattern + 1, *name, class_end, matched)) {
+				if (*name == '\0' || *name == '/' || !matched)
+					return false;
+
+				pattern = class_end;
+				break;
+			}
+
+			/* an unclosed '[' is matched literally */
+			if (*name != '[')
+				return false;
+			break;
+		}
+		case '\\':
+			if (pattern[1] != '\0')
+				pattern++;
+			/* fall through */
+		default:
+			if (*pattern != *name)
+				return false;
+			break;
+		}
+	}
+
+	return *name == '\0';
+}
+
+bool ref_map::name_less(const char *lhs, const char *rhs)
+{
+	for (; *lhs != '\0' && *lhs == *rhs; lhs++, rhs++);
+
+	/* map '/' to just above the null terminator */
+	const auto rank = [] (unsigned char c) { return c == '/' ? 1 : c == '\0' ? 0 : (unsigned int)c + 1; };
+	return rank(*lhs) < rank(*rhs);
+}
+
+void ref_map::parse_packed_refs(const char *data, size_t size,
+		const std::function<void(const char *name, size_t name_len, const git_oid &target, bool peeled)> &callback)
+{
+	const char *ptr = data;
+	const char *end = data + size;
+
+	/* the ref on the previous line, which is reported once we know whether a peeled line follows */
+	const char *name = nullptr;
+	size_t name_len = 0;
+	git_oid target;
+
+	bool tags_peeled = false;
+	bool fully_peeled = false;
+
+	while (ptr < end) {
+		const char *line_end = static_cast<const char *>(memchr(ptr, '\n', end - ptr));
+		if (line_end == nullptr)
+			line_end = end;
+
+		const size_t line_len = line_end - ptr;
+
+		if (*ptr == '#') {
+			/* the header lists the traits of the file */
+			const std::string header(ptr, line_len);
+			const std::string traits = header + " ";
+			tags_peeled = traits.find(" peeled ") != std::string::npos;
+			fully_peeled = traits.find(" fully-peeled ") != std::string::npos;
+		} else if (*ptr == '^') {
+			/* a bad peeled line leaves the tag to be peeled by the caller */
+			git_oid peeled_target;
+			if (name != nullptr && line_len > GIT_OID_HEXSZ
+					&& git_oid_fromstrn(&peeled_target, ptr + 1, GIT_OID_HEXSZ) == 0)
+				callback(name, name_len, peeled_target, true);
+			else if (name != nullptr)
+				callback(name, name_len, target, false);
+
+			name = nullptr;
+		} else {
+			if (name != nullptr)
+				callback(name, name_len, target, fully_peeled || (tags_peeled && is_tag_name(name, name_len)));
+
+			name = nullptr;
+			if (line_len > GIT_OID_HEXSZ + 1 && ptr[GIT_OID_HEXSZ] == ' '
+					&& git_oid_fromstrn(&target, ptr, GIT_OID_HEXSZ) == 0) {
+				name = ptr + GIT_OID_HEXSZ + 1;
+				name_len = line_len - GIT_OID_HEXSZ - 1;
+			}
+		}
+
+		ptr = line_end + 1;
+	}
+
+	if (name != nullptr)
+		callback(name, name_len, target, fully_peeled || (tags_peeled && is_tag_name(name, name_len)));
+}
+
+void ref_map::add_ref(const char *name, size_t name_len, const git_oid &target, std::vector<ref>::iterator pos)
+{
+	char *stored_name = names.allocate<char>(name_len + 1);
+	memcpy(stored_name, name, name_len);
+	stored_name[name_len] = '\0';
+
+	ref new_ref;
+	new_ref.name = stored_name;
+	new_ref.name_len = name_len;
+	new_ref.shorthand_offset = get_shorthand_offset(name, name_len);
+	new_ref.target = target;
+	refs.insert(pos, new_ref);
+}
+
+void ref_map::sort_refs()
+{
+	/* the order of refs with the same name is kept, so the first one added is the one that stays */
+	std::stable_sort(refs.begin(), refs.end(), [] (const ref &lhs, const ref &rhs) {
+		return name_less(lhs.name, rhs.name);
+	});
+
+	refs.erase(std::unique(refs.begin(), refs.end(), [] (const ref &lhs, const ref &rhs) {
+		return strcmp(lhs.name, rhs.name) == 0;
+	}), refs.end());
+}
+
+std::vector<ref_map::loose_ref> ref_map::read_loose_refs(const std::string &refs_dir)
+{
+	/* list the files first, the slow part is opening and reading each one */
+	std::vector<std::string> file_names;
+	const QDir base_dir(QFile::decodeName(refs_dir.c_str()));
+	for (const auto &ns : ref_namespaces) {
+		QDirIterator it(base_dir.filePath(QString::fromLatin1(ns.first)), QDir::Files | QDir::Hidden,
+				QDirIterator::Subdirectories);
+		while (it.hasNext()) {
+			std::string name = QFile::encodeName(base_dir.relativeFilePath(it.next())).toStdString();
+
+			/* skip the files which cannot be refs, such as the ".lock" files left while a ref is updated */
+			if (git_reference_is_valid_name(name.c_str()))
+				file_names.push_back(std::move(name));
+		}
+	}
+
+	const size_t num_chunks = (file_names.size() + loose_ref_chunk_size - 1) / loose_ref_chunk_size;
+	const size_t num_threads = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), num_chunks);
+
+	/* each thread takes the next chunk of files until there are none left */
+	std::atomic<size_t> next_chunk(0);
+	std::vector<std::vector<loose_ref>> thread_refs(num_threads);
+
+	const auto read_files = [&] (std::vector<loose_ref> &loose_refs) {
+		for (size_t chunk = next_chunk++; chunk < num_chunks; chunk = next_chunk++) {
+			const size_t chunk_end = std::min((chunk + 1) * loose_ref_chunk_size, file_names.size());
+			for (size_t i = chunk * loose_ref_chunk_size; i < chunk_end; i++) {
+				QFile file(QFile::decodeName((refs_dir + file_names[i]).c_str()));
+				if (!file.open(QIODevice::ReadOnly))
+					continue;
+
+				const QByteArray contents = file.read(loose_ref_max_size).trimmed();
+
+				loose_ref ref;
+				ref.name = std::move(file_names[i]);
+				if (contents.startsWith("ref: ")) {
+					ref.symbolic_target = contents.mid(sizeof("ref: ") - 1).trimmed().toStdString();
+					if (ref.symbolic_target.empty())
+						continue;
+				} else if (contents.size() < GIT_OID_HEXSZ || git_oid_fromstrn(&ref.target, contents.constData(), GIT_OID_HEXSZ) != 0)
+					continue;
+
+				loose_refs.push_back(std::move(ref));
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < num_threads; i++)
+		threads.emplace_back(read_files, std::ref(thread_refs[i]));
+
+	if (num_threads > 0)
+		read_files(thread_refs[0]);
+
+	for (std::thread &thread : threads)
+		thread.join();
+
+	std::vector<loose_ref> loose_refs;
+	for (std::vector<loose_ref> &refs : thread_refs)
+		loose_refs.insert(loose_refs.end(), std::make_move_iterator(refs.begin()), std::make_move_iterator(refs.end()));
+
+	return loose_refs;
 }
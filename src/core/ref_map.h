@@ -20,95 +20,210 @@
 #ifndef REFS_H
 #define REFS_H
 
+#include <cstdint>
 #include <cstring>
-#include <map>
-#include <unordered_map>
+#include <functional>
+#include <string>
+#include <vector>
 
 #include <git2.h>
 
 #include "compat/cpp_git.h"
+#include "util/arena.h"
+#include "util/memory_usage.h"
 
-/*!
- * \struct git_oid_ref_hash
- * \brief Structure for computing hashes of git_oid
- */
-struct git_oid_ref_hash
-{
-	/*!
-	 * \brief Compute the hash of a git_oid
-	 * \param x The git_oid to hash
-	 * \return The hash of x
-	 */
-	size_t operator()(const git_oid &x) const
-	{
-		size_t hash = 0;
-		for (int i = 0; i < GIT_OID_RAWSZ; i++)
-			hash ^= std::hash<unsigned char>{}(x.id[i]) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
-		return hash;
-	}
-};
-
-/*!
- * \struct git_oid_ref_cmp
- * \brief Structure for comparing git_oid
- */
-struct git_oid_ref_cmp
-{
-	/*!
-	 * \brief Compare two git_oids
-	 * \param lhs The first git_oid to compare
-	 * \param rhs The second git_oid to compare
-	 * \return Boolean comparison result
-	 */
-	bool operator()(const git_oid &lhs, const git_oid &rhs) const
-	{
-		for (size_t i = 0; i < GIT_OID_RAWSZ; i++)
-			if (lhs.id[i] != rhs.id[i]) return false;
-		return true;
-	}
+/*! \brief The syntax of a pattern used to select refs */
+enum class ref_pattern_syntax : char {
+	/*! \brief Shell style wildcards, '*' and '?' do not match '/' while "**" does */
+	GLOB,
+	/*! \brief A regular expression, which can match any part of the name */
+	REGEX,
 };
 
 /*!
  * \class ref_map
  * \brief Class for keeping track of all of the refs in a repo
  *
- * Refs can be accessed through an ordered map by the ref names.
- * Also through an unordered multimap by the git_oid.
+ * Refs are kept in a flat array sorted by their names, so the refs in each
+ * directory of the ref namespace are next to each other. They can also be
+ * found by the git_oid they point to through an index sorted by target.
  * Refs can be activated and de-activated.
+ *
+ * The refs are read straight from the packed-refs file and the loose ref
+ * directories rather than through libgit2 so that no libgit2 object is
+ * created per ref. Only the branches, tags and remote branches are loaded.
  */
 class ref_map {
 public:
 	ref_map(const git::repository &repo);
-	~ref_map();
 
 	/*!
-	 * \struct char_ptr_cmp
-	 * \brief Structure for comparing c strings by pointer
+	 * \struct ref
+	 * \brief Structure describing a single ref, the name is owned by the ref_map
 	 */
-	struct char_ptr_cmp {
+	struct ref {
+		/*! \brief The full name of the ref */
+		const char *name;
+		/*! \brief The length of the name */
+		uint32_t name_len;
+		/*! \brief The offset of the shorthand name in the full name */
+		uint16_t shorthand_offset;
+		/*! \brief The commit the ref points to */
+		git_oid target;
+
 		/*!
-		 * \brief Compare two c strings by their pointers
-		 * \param lhs The first c string to compare
-		 * \param rhs The second c string to compare
-		 * \return Boolean comparison result
+		 * \brief Get the shorthand name of the ref, the same as git_reference_shorthand
+		 * \return The shorthand name
 		 */
-		bool operator()(const char *lhs, const char *rhs) const
+		const char *shorthand() const
 		{
-			return strcmp(lhs, rhs) < 0;
+			return name + shorthand_offset;
 		}
 	};
 
-	using refs_unordered_multimap = std::unordered_multimap<git_oid, std::pair<git::reference, bool>, git_oid_ref_hash, git_oid_ref_cmp>;
-	refs_unordered_multimap refs;
-	using refs_ordered_map = std::map<const char *, std::pair<git_oid, std::pair<git::reference, bool> *>, char_ptr_cmp>;
-	refs_ordered_map refs_ordered;
-	
+	/*! \brief All of the refs, sorted with name_less */
+	std::vector<ref> refs;
+
+	/*! \brief Indices into refs sorted by the target of the ref */
+	std::vector<uint32_t> refs_by_target;
+
+	using target_iterator = std::vector<uint32_t>::const_iterator;
+
+	/*!
+	 * \brief Find the refs pointing to a commit
+	 * \param target The commit to find the refs for
+	 * \return The range of indices into refs pointing to the commit, in order of name
+	 */
+	std::pair<target_iterator, target_iterator> find_target(const git_oid &target) const;
+
+	/*!
+	 * \brief Check whether a ref is active
+	 * \param index The index of the ref in refs
+	 * \return Whether or not the ref is active
+	 */
+	bool is_ref_active(size_t index) const
+	{
+		return (active_refs[index / 64] >> (index % 64)) & 1;
+	}
+
+	/*!
+	 * \brief Change the active status of a range of refs
+	 * \param begin The index of the first ref in refs
+	 * \param end The index after the last ref
+	 * \param is_active Whether or not the refs should be active
+	 */
+	void set_refs_active(size_t begin, size_t end, bool is_active);
+
+	/*!
+	 * \brief Count the active refs in a range
+	 * \param begin The index of the first ref in refs
+	 * \param end The index after the last ref
+	 * \return The number of active refs
+	 */
+	size_t count_active_refs(size_t begin, size_t end) const;
+
+	/*!
+	 * \brief Change the active status of every ref whose full name matches a pattern
+	 *
+	 * Only the refs sharing the literal prefix of a glob pattern are visited.
+	 *
+	 * \param pattern The pattern to match, such as "refs/tags/v1.*"
+	 * \param syntax The syntax of the pattern
+	 * \param is_active Whether or not the matching refs should be active
+	 * \return The number of refs that matched
+	 * \throws reef_error If the pattern is not a valid regular expression
+	 */
+	size_t set_refs_active_matching(const std::string &pattern, ref_pattern_syntax syntax, bool is_active);
+
+	/*!
+	 * \brief Estimate the memory held by the refs and their names
+	 * \return The bytes held and the number of refs
+	 */
+	memory_usage get_memory_usage() const;
+
+	/*!
+	 * \brief Match a ref name against a glob pattern
+	 *
+	 * '*' matches any run of characters other than '/', "**" matches any run
+	 * of characters, '?' matches one character other than '/', "[...]" matches
+	 * one character in the set, "[!...]" one not in the set and '\\' escapes the
+	 * next character.
+	 *
+	 * \param pattern The glob pattern
+	 * \param name The name to match
+	 * \return Whether the whole name matches the pattern
+	 */
+	static bool glob_match(const char *pattern, const char *name);
+
+	/*!
+	 * \brief Compare two ref names, '/' is ordered before every other character
+	 *
+	 * With this order the refs in a directory are sorted the same way as if
+	 * each part of the names was compared separately.
+	 *
+	 * \param lhs The first name to compare
+	 * \param rhs The second name to compare
+	 * \return Whether lhs is ordered before rhs
+	 */
+	static bool name_less(const char *lhs, const char *rhs);
+
+	/*!
+	 * \brief Parse the contents of a packed-refs file
+	 *
+	 * The callback is called once for each ref with the start and length of
+	 * its name, its target and whether the target is already peeled. The
+	 * peeled target is taken from the "^" line following an annotated tag,
+	 * tags without one are known to be peeled when the file says so in its
+	 * header. Malformed lines are skipped, a tag whose "^" line is malformed
+	 * is reported as not peeled.
+	 *
+	 * \param data The contents of the file
+	 * \param size The size of the contents
+	 * \param callback The function to call for each ref
+	 */
+	static void parse_packed_refs(const char *data, size_t size,
+			const std::function<void(const char *name, size_t name_len, const git_oid &target, bool peeled)> &callback);
+
+private:
+	/*!
+	 * \struct loose_ref
+	 * \brief Structure holding a loose ref file after it has been read
+	 */
+	struct loose_ref {
+		/*! \brief The name of the ref, relative to the repository */
+		std::string name;
+		/*! \brief The target of the ref if it is not symbolic */
+		git_oid target;
+		/*! \brief The name of the target ref if it is symbolic, otherwise empty */
+		std::string symbolic_target;
+	};
+
+	/* storage for the ref names */
+	arena names;
+
+	/* one bit per ref in refs, set if the ref is active */
+	std::vector<uint64_t> active_refs;
+
+	/*!
+	 * \brief Copy a ref's name into the name storage and add it to refs
+	 * \param name The full name of the ref
+	 * \param name_len The length of the name
+	 * \param target The commit the ref points to
+	 * \param pos The position in refs to insert the ref at
+	 */
+	void add_ref(const char *name, size_t name_len, const git_oid &target, std::vector<ref>::iterator pos);
+
+	/*!
+	 * \brief Sort the refs by name, keeping the first of any refs with the same name
+	 */
+	void sort_refs();
+
 	/*!
-	 * \brief Change the active status of a ref
-	 * \param iter An iterator in the ordered ref map
-	 * \param is_active Whether or not the ref should be active
+	 * \brief Read all of the loose refs under refs_dir, using multiple threads
+	 * \param refs_dir The directory containing the refs
+	 * \return The loose refs that were read successfully
 	 */
-	void set_ref_active(refs_ordered_map::iterator &iter, bool is_active);
+	static std::vector<loose_ref> read_loose_refs(const std::string &refs_dir);
 };
 
 #endif /* REFS_H */
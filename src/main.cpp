@@ -16,12 +16,28 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
 #include "ui/main_window.h"
+#include "util/trace.h"
 
 #include <QApplication>
 
 int main(int argc, char *argv[])
 {
+	/* a trace of the work done is written to the file given by REEF_TRACE or --trace, once the window is closed */
+	std::string trace_path;
+	if (const char *env_trace_path = std::getenv("REEF_TRACE"))
+		trace_path = env_trace_path;
+	for (int i = 1; i + 1 < argc; i++) {
+		if (std::strcmp(argv[i], "--trace") == 0)
+			trace_path = argv[i + 1];
+	}
+
+	trace_session trace(trace_path);
+
 	QApplication a(argc, argv);
 
 	/* init libgit */
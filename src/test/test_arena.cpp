@@ -0,0 +1,258 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <QTest>
+
+#include <cstring>
+#include <vector>
+
+#include "util/arena.h"
+
+/* a type with a stricter alignment than anything the arena hands out by default */
+struct alignas(64) cache_line {
+	char bytes[64];
+};
+
+/* returns whether ptr is aligned to alignment */
+static bool is_aligned(const void *ptr, size_t alignment)
+{
+	return reinterpret_cast<uintptr_t>(ptr) % alignment == 0;
+}
+
+/* class for testing the arena and its allocator */
+class test_arena : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	/* every allocation is aligned for its type, even after an odd sized one */
+	void test_alignment()
+	{
+		arena a(1024);
+
+		for (int i = 0; i < 8; i++) {
+			char *c = a.allocate<char>(1 + i);
+			QVERIFY(c != nullptr);
+
+			QVERIFY(is_aligned(a.allocate<uint16_t>(), alignof(uint16_t)));
+			QVERIFY(is_aligned(a.allocate<uint32_t>(3), alignof(uint32_t)));
+			QVERIFY(is_aligned(a.allocate<double>(), alignof(double)));
+			QVERIFY(is_aligned(a.allocate<cache_line>(), alignof(cache_line)));
+			QVERIFY(is_aligned(a.allocate_bytes(1, 128), 128));
+		}
+
+		/* oversized allocations are aligned as well */
+		QVERIFY(is_aligned(a.allocate<cache_line>(8), alignof(cache_line)));
+		QVERIFY(is_aligned(a.allocate_bytes(1000, 256), 256));
+	}
+
+	/* the allocations do not overlap, so each keeps what was written to it */
+	void test_no_overlap()
+	{
+		arena a(1024);
+		std::vector<std::pair<unsigned char *, size_t>> allocations;
+
+		for (size_t i = 0; i < 200; i++) {
+			const size_t size = 1 + (i * 37) % 300;
+			unsigned char *ptr = a.allocate<unsigned char>(size);
+			memset(ptr, static_cast<int>(i), size);
+			allocations.emplace_back(ptr, size);
+		}
+
+		for (size_t i = 0; i < allocations.size(); i++)
+			for (size_t j = 0; j < allocations[i].second; j++)
+				QCOMPARE(allocations[i].first[j], static_cast<unsigned char>(i));
+	}
+
+	/* anything larger than a quarter of a block gets a block of its own */
+	void test_large_allocations()
+	{
+		arena a(1024);
+
+		a.allocate_bytes(256, 1);
+		QCOMPARE(a.get_stats().num_blocks, (size_t)1);
+		QCOMPARE(a.get_stats().num_large_blocks, (size_t)0);
+		QCOMPARE(a.get_stats().reserved_bytes, (size_t)1024);
+
+		/* the large block has room for the alignment padding */
+		a.allocate_bytes(257, 8);
+		QCOMPARE(a.get_stats().num_blocks, (size_t)1);
+		QCOMPARE(a.get_stats().num_large_blocks, (size_t)1);
+		QCOMPARE(a.get_stats().reserved_bytes, (size_t)(1024 + 257 + 7));
+
+		/* the standard block carries on being filled after a large allocation */
+		a.allocate_bytes(256, 1);
+		a.allocate_bytes(256, 1);
+		a.allocate_bytes(256, 1);
+		QCOMPARE(a.get_stats().num_blocks, (size_t)1);
+
+		a.allocate_bytes(1, 1);
+		QCOMPARE(a.get_stats().num_blocks, (size_t)2);
+
+		a.allocate<uint64_t>(1000);
+		QCOMPARE(a.get_stats().num_large_blocks, (size_t)2);
+		QCOMPARE(a.get_stats().reserved_bytes, (size_t)(2 * 1024 + 257 + 7 + 8000 + 7));
+	}
+
+	/* deallocate only frees large blocks, in any order */
+	void test_deallocate()
+	{
+		arena a(1024);
+
+		char *small = a.allocate<char>(16);
+		char *first = a.allocate<char>(2000);
+		char *second = a.allocate<char>(3000);
+		char *third = a.allocate<char>(4000);
+		QCOMPARE(a.get_stats().num_large_blocks, (size_t)3);
+		QCOMPARE(a.get_stats().reserved_bytes, (size_t)(1024 + 2000 + 3000 + 4000));
+
+		/* memory from a standard block is kept */
+		a.deallocate(small);
+		QCOMPARE(a.get_stats().num_blocks, (size_t)1);
+		QCOMPARE(a.get_stats().reserved_bytes, (size_t)(1024 + 2000 + 3000 + 4000));
+
+		/* a pointer into the middle of a large block frees the block */
+		a.deallocate(second + 1500);
+		QCOMPARE(a.get_stats().num_large_blocks, (size_t)2);
+		QCOMPARE(a.get_stats().reserved_bytes, (size_t)(1024 + 2000 + 4000));
+
+		a.deallocate(first);
+		QCOMPARE(a.get_stats().num_large_blocks, (size_t)1);
+		QCOMPARE(a.get_stats().reserved_bytes, (size_t)(1024 + 4000));
+
+		/* freeing the same block again does nothing */
+		a.deallocate(first);
+		QCOMPARE(a.get_stats().num_large_blocks, (size_t)1);
+
+		memset(third, 0, 4000);
+		a.deallocate(third);
+		QCOMPARE(a.get_stats().num_large_blocks, (size_t)0);
+		QCOMPARE(a.get_stats().reserved_bytes, (size_t)1024);
+
+		/* the peak is not lowered by freeing */
+		QCOMPARE(a.get_stats().peak_reserved_bytes, (size_t)(1024 + 2000 + 3000 + 4000));
+
+		/* the allocations themselves are still counted */
+		QCOMPARE(a.get_stats().num_allocations, (size_t)4);
+		QCOMPARE(a.get_stats().allocated_bytes, (size_t)(16 + 2000 + 3000 + 4000));
+	}
+
+	/* the counters track the allocations without the alignment padding */
+	void test_stats()
+	{
+		arena a(1024);
+		QCOMPARE(a.get_stats().num_allocations, (size_t)0);
+		QCOMPARE(a.get_stats().allocated_bytes, (size_t)0);
+		QCOMPARE(a.get_stats().num_blocks, (size_t)0);
+		QCOMPARE(a.get_stats().reserved_bytes, (size_t)0);
+		QCOMPARE(a.get_stats().peak_reserved_bytes, (size_t)0);
+
+		a.allocate<char>(3);
+		a.allocate<uint64_t>(2);
+		a.allocate_bytes(5, 64);
+		QCOMPARE(a.get_stats().num_allocations, (size_t)3);
+		QCOMPARE(a.get_stats().allocated_bytes, (size_t)(3 + 16 + 5));
+		QCOMPARE(a.get_stats().num_blocks, (size_t)1);
+		QCOMPARE(a.get_stats().reserved_bytes, (size_t)1024);
+		QCOMPARE(a.get_stats().peak_reserved_bytes, (size_t)1024);
+
+		/* an allocation which does not fit in what is left of the block starts a new one */
+		a.allocate<char>(250);
+		a.allocate<char>(250);
+		a.allocate<char>(250);
+		a.allocate<char>(250);
+		QCOMPARE(a.get_stats().num_allocations, (size_t)7);
+		QCOMPARE(a.get_stats().num_blocks, (size_t)2);
+		QCOMPARE(a.get_stats().reserved_bytes, (size_t)2048);
+	}
+
+	/* clearing keeps only the first block, which is reused */
+	void test_clear()
+	{
+		arena a(1024);
+
+		/* clearing an empty arena keeps it empty */
+		a.clear();
+		QCOMPARE(a.get_stats().num_blocks, (size_t)0);
+		QCOMPARE(a.get_stats().reserved_bytes, (size_t)0);
+
+		char *first = a.allocate<char>(100);
+		for (int i = 0; i < 20; i++)
+			a.allocate<char>(200);
+		a.allocate<char>(5000);
+		QVERIFY(a.get_stats().num_blocks > 1);
+		QCOMPARE(a.get_stats().num_large_blocks, (size_t)1);
+		const size_t peak = a.get_stats().peak_reserved_bytes;
+		QCOMPARE(peak, a.get_stats().reserved_bytes);
+
+		a.clear();
+		QCOMPARE(a.get_stats().num_allocations, (size_t)0);
+		QCOMPARE(a.get_stats().allocated_bytes, (size_t)0);
+		QCOMPARE(a.get_stats().num_blocks, (size_t)1);
+		QCOMPARE(a.get_stats().num_large_blocks, (size_t)0);
+		QCOMPARE(a.get_stats().reserved_bytes, (size_t)1024);
+		QCOMPARE(a.get_stats().peak_reserved_bytes, peak);
+
+		/* the next allocation starts at the beginning of the kept block */
+		QCOMPARE(a.allocate<char>(100), first);
+		QCOMPARE(a.get_stats().num_allocations, (size_t)1);
+		QCOMPARE(a.get_stats().num_blocks, (size_t)1);
+	}
+
+	/* a vector growing through the allocator gives back the large blocks it no longer uses */
+	void test_allocator()
+	{
+		arena a(1024);
+
+		{
+			std::vector<uint32_t, arena_allocator<uint32_t>> values{ arena_allocator<uint32_t>(a) };
+			for (uint32_t i = 0; i < 10000; i++)
+				values.push_back(i);
+
+			for (uint32_t i = 0; i < 10000; i++)
+				QCOMPARE(values[i], i);
+
+			QCOMPARE(a.get_stats().num_large_blocks, (size_t)1);
+		}
+
+		QCOMPARE(a.get_stats().num_large_blocks, (size_t)0);
+		QVERIFY(arena_allocator<uint32_t>(a) == arena_allocator<char>(a));
+	}
+
+	/* blocks backed by huge pages are used and released the same way */
+	void test_huge_pages()
+	{
+		const size_t block_size = 4 * 1024 * 1024;
+		arena a(block_size, true);
+
+		char *ptr = a.allocate<char>(1024);
+		memset(ptr, 1, 1024);
+		char *large = a.allocate<char>(block_size);
+		memset(large, 2, block_size);
+		QCOMPARE(a.get_stats().reserved_bytes, block_size * 2);
+
+		a.deallocate(large);
+		QCOMPARE(a.get_stats().reserved_bytes, block_size);
+
+		a.clear();
+		QCOMPARE(a.allocate<char>(1024), ptr);
+	}
+};
+
+QTEST_MAIN(test_arena)
+#include "test_arena.moc"
@@ -0,0 +1,241 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <QTest>
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "core/diff_cache.h"
+
+/* a key with every byte of the commit id set to commit and of the parent id set to parent */
+static diff_key make_key(unsigned char commit, unsigned char parent = 0, bool find_similar = false, bool combined = false)
+{
+	diff_key key;
+	memset(key.commit_id.id, commit, sizeof(key.commit_id.id));
+	memset(key.parent_id.id, parent, sizeof(key.parent_id.id));
+	key.find_similar = find_similar;
+	key.combined = combined;
+	return key;
+}
+
+/* count modified files, all with the same path so that each list takes the same space in the cache */
+static std::vector<diff_file> make_files(size_t count, const std::string &path = "file.txt")
+{
+	diff_file file;
+	file.status = GIT_DELTA_MODIFIED;
+	memset(&file.old_id, 1, sizeof(file.old_id));
+	memset(&file.new_id, 2, sizeof(file.new_id));
+	file.old_path = path;
+	file.new_path = path;
+
+	return std::vector<diff_file>(count, file);
+}
+
+/* a patch with count lines of the given length */
+static std::shared_ptr<const diff_patch> make_patch(size_t count, size_t length)
+{
+	auto patch = std::make_shared<diff_patch>();
+	const std::string content(length, 'x');
+	for (size_t i = 0; i < count; i++)
+		patch->add_line(GIT_DIFF_LINE_ADDITION, content.data(), content.size());
+
+	return patch;
+}
+
+/* the size in the cache of the files from make_files(count) */
+static size_t entry_size(size_t count)
+{
+	diff_cache cache(SIZE_MAX);
+	cache.insert_files(make_key(1), make_files(count));
+	return cache.size();
+}
+
+/* class for testing the least recently used eviction of the diff cache */
+class test_diff_cache : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	/* once full, the cache evicts the diffs in the order they were inserted */
+	void test_eviction_order()
+	{
+		diff_cache cache(entry_size(1) * 3);
+
+		cache.insert_files(make_key(1), make_files(1));
+		cache.insert_files(make_key(2), make_files(1));
+		cache.insert_files(make_key(3), make_files(1));
+		QCOMPARE(cache.num_entries(), (size_t)3);
+		QCOMPARE(cache.size(), entry_size(1) * 3);
+
+		cache.insert_files(make_key(4), make_files(1));
+		QCOMPARE(cache.num_entries(), (size_t)3);
+		QVERIFY(cache.find_files(make_key(1)) == nullptr);
+
+		cache.insert_files(make_key(5), make_files(1));
+		QCOMPARE(cache.num_entries(), (size_t)3);
+		QVERIFY(cache.find_files(make_key(2)) == nullptr);
+
+		/* replacing the files of a diff makes it the most recently used */
+		cache.insert_files(make_key(3), make_files(1));
+		cache.insert_files(make_key(6), make_files(1));
+		QCOMPARE(cache.num_entries(), (size_t)3);
+		QVERIFY(cache.find_files(make_key(4)) == nullptr);
+
+		QVERIFY(cache.find_files(make_key(3)) != nullptr);
+		QVERIFY(cache.find_files(make_key(5)) != nullptr);
+		QVERIFY(cache.find_files(make_key(6)) != nullptr);
+		QCOMPARE(cache.size(), entry_size(1) * 3);
+	}
+
+	/* finding the files, a patch or the stats of a diff moves it to the front, so it is evicted last */
+	void test_lookup_moves_to_front()
+	{
+		diff_cache cache(entry_size(1) * 3);
+
+		cache.insert_files(make_key(1), make_files(1));
+		cache.insert_files(make_key(2), make_files(1));
+		cache.insert_files(make_key(3), make_files(1));
+
+		/* 1 is now the most recently used, so 2 goes first */
+		QVERIFY(cache.find_files(make_key(1)) != nullptr);
+		cache.insert_files(make_key(4), make_files(1));
+		QVERIFY(cache.find_files(make_key(2)) == nullptr);
+
+		/* the order is now 4, 1, 3, looking up a patch moves 3 to the front */
+		QVERIFY(cache.find_patch(make_key(3), 0) == nullptr);
+		cache.insert_files(make_key(5), make_files(1));
+		QVERIFY(cache.find_files(make_key(1)) == nullptr);
+
+		/* the order is now 5, 3, 4, looking up stats moves 4 to the front */
+		QVERIFY(cache.find_stats(make_key(4)) == nullptr);
+		cache.insert_files(make_key(6), make_files(1));
+		QVERIFY(cache.find_files(make_key(3)) == nullptr);
+
+		/* looking up a diff that is not cached changes nothing, so 5 goes next */
+		QVERIFY(cache.find_files(make_key(7)) == nullptr);
+		cache.insert_files(make_key(8), make_files(1));
+		QVERIFY(cache.find_files(make_key(5)) == nullptr);
+
+		QVERIFY(cache.find_files(make_key(4)) != nullptr);
+		QVERIFY(cache.find_files(make_key(6)) != nullptr);
+		QVERIFY(cache.find_files(make_key(8)) != nullptr);
+	}
+
+	/* the same commit and parent diffed with different options are cached separately */
+	void test_separate_keys()
+	{
+		diff_cache cache(SIZE_MAX);
+
+		cache.insert_files(make_key(1, 2, false, false), make_files(1, "plain"));
+		cache.insert_files(make_key(1, 2, true, false), make_files(1, "similar"));
+		cache.insert_files(make_key(1, 2, false, true), make_files(1, "combined"));
+		cache.insert_files(make_key(1, 2, true, true), make_files(1, "similar combined"));
+		cache.insert_files(make_key(1, 3), make_files(1, "other parent"));
+		cache.insert_files(make_key(2, 1), make_files(1, "swapped"));
+		QCOMPARE(cache.num_entries(), (size_t)6);
+
+		QCOMPARE(cache.find_files(make_key(1, 2, false, false))->at(0).new_path, std::string("plain"));
+		QCOMPARE(cache.find_files(make_key(1, 2, true, false))->at(0).new_path, std::string("similar"));
+		QCOMPARE(cache.find_files(make_key(1, 2, false, true))->at(0).new_path, std::string("combined"));
+		QCOMPARE(cache.find_files(make_key(1, 2, true, true))->at(0).new_path, std::string("similar combined"));
+		QCOMPARE(cache.find_files(make_key(1, 3))->at(0).new_path, std::string("other parent"));
+		QCOMPARE(cache.find_files(make_key(2, 1))->at(0).new_path, std::string("swapped"));
+
+		/* the patches and stats belong to the key they were inserted with */
+		auto patch = make_patch(1, 10);
+		cache.insert_patch(make_key(1, 2, true, false), 0, patch);
+		QVERIFY(cache.find_patch(make_key(1, 2, true, false), 0) == patch);
+		QVERIFY(cache.find_patch(make_key(1, 2, false, false), 0) == nullptr);
+		QVERIFY(cache.find_patch(make_key(1, 2, true, true), 0) == nullptr);
+
+		diff_stats stats;
+		stats.computed = true;
+		stats.additions = 3;
+		cache.insert_stats(make_key(1, 2, false, true), 0, { stats });
+		QCOMPARE(cache.find_stats(make_key(1, 2, false, true))->at(0).additions, (uint32_t)3);
+		QVERIFY(cache.find_stats(make_key(1, 2, false, false)) == nullptr);
+		QVERIFY(cache.find_stats(make_key(1, 2, true, true)) == nullptr);
+
+		/* replacing the files of one key drops its patches but leaves the other keys alone */
+		cache.insert_files(make_key(1, 2, true, false), make_files(1, "similar again"));
+		QCOMPARE(cache.num_entries(), (size_t)6);
+		QVERIFY(cache.find_patch(make_key(1, 2, true, false), 0) == nullptr);
+		QCOMPARE(cache.find_stats(make_key(1, 2, false, true))->at(0).additions, (uint32_t)3);
+	}
+
+	/* the cache is trimmed to its byte limit by evicting the least recently used diffs */
+	void test_byte_limit()
+	{
+		const size_t small = entry_size(1);
+		const size_t large = entry_size(10);
+		QVERIFY(large > small * 2);
+
+		/* room for two small diffs and a bit */
+		diff_cache cache(small * 2 + small / 2);
+
+		cache.insert_files(make_key(1), make_files(1));
+		cache.insert_files(make_key(2), make_files(1));
+		QCOMPARE(cache.num_entries(), (size_t)2);
+		QCOMPARE(cache.size(), small * 2);
+
+		/* a third does not fit, so the first is evicted */
+		cache.insert_files(make_key(3), make_files(1));
+		QCOMPARE(cache.num_entries(), (size_t)2);
+		QCOMPARE(cache.size(), small * 2);
+		QVERIFY(cache.find_files(make_key(1)) == nullptr);
+
+		/* a patch is counted with its diff, growing 3 past the limit evicts 2 but not 3 itself */
+		auto patch = make_patch(4, 8);
+		cache.insert_patch(make_key(3), 0, patch);
+		QCOMPARE(cache.num_entries(), (size_t)1);
+		QVERIFY(cache.find_files(make_key(2)) == nullptr);
+		QVERIFY(cache.find_patch(make_key(3), 0) == patch);
+		QVERIFY(cache.size() > small);
+
+		/* inserting the same patch again adds nothing */
+		const size_t with_patch = cache.size();
+		cache.insert_patch(make_key(3), 0, make_patch(4, 8));
+		QCOMPARE(cache.size(), with_patch);
+
+		/* patches and stats for diffs that are not cached or for files out of range are dropped */
+		cache.insert_patch(make_key(1), 0, make_patch(1, 1));
+		cache.insert_patch(make_key(3), 1, make_patch(1, 1));
+		cache.insert_stats(make_key(1), 0, { diff_stats() });
+		cache.insert_stats(make_key(3), 1, { diff_stats() });
+		QCOMPARE(cache.num_entries(), (size_t)1);
+		QCOMPARE(cache.size(), with_patch);
+
+		/* a diff bigger than the whole cache is kept on its own until the next one comes in */
+		cache.insert_files(make_key(4), make_files(10));
+		QCOMPARE(cache.num_entries(), (size_t)1);
+		QCOMPARE(cache.size(), large);
+		QVERIFY(cache.find_files(make_key(3)) == nullptr);
+
+		cache.insert_files(make_key(5), make_files(1));
+		QCOMPARE(cache.num_entries(), (size_t)1);
+		QCOMPARE(cache.size(), small);
+		QVERIFY(cache.find_files(make_key(4)) == nullptr);
+		QVERIFY(cache.find_files(make_key(5)) != nullptr);
+	}
+};
+
+QTEST_MAIN(test_diff_cache)
+#include "test_diff_cache.moc"
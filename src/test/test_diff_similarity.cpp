@@ -0,0 +1,288 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "core/diff_similarity.h"
+#include "util/preferences.h"
+
+/* a line of length bytes including its newline, filled with c */
+static QByteArray line(char c, int length)
+{
+	return QByteArray(length - 1, c) + "\n";
+}
+
+/* class for testing the pairing of renamed and copied files */
+class test_diff_similarity : public QObject
+{
+	Q_OBJECT
+
+	/* write content to the object database as a blob */
+	git_oid write_blob(const QByteArray &content) const
+	{
+		git_oid id;
+		if (git_odb_write(&id, odb->_ptr(), content.constData(), content.size(), GIT_OBJ_BLOB) != 0)
+			memset(&id, 0, sizeof(id));
+
+		return id;
+	}
+
+	diff_file added(const char *path, const QByteArray &content) const
+	{
+		diff_file file{ GIT_DELTA_ADDED, {}, write_blob(content), path, path, {} };
+		return file;
+	}
+
+	diff_file deleted(const char *path, const QByteArray &content) const
+	{
+		diff_file file{ GIT_DELTA_DELETED, write_blob(content), {}, path, path, {} };
+		return file;
+	}
+
+	diff_file modified(const char *path, const QByteArray &old_content, const QByteArray &new_content) const
+	{
+		diff_file file{ GIT_DELTA_MODIFIED, write_blob(old_content), write_blob(new_content), path, path, {} };
+		return file;
+	}
+
+	/* describe each file as "<status> <old path> <new path>" */
+	static QStringList describe(const std::vector<diff_file> &files)
+	{
+		QStringList result;
+		for (const diff_file &file : files) {
+			const char status = git_diff_status_char(file.status);
+			result.append(QString("%1 %2 %3").arg(QString::fromLatin1(&status, 1),
+					QString::fromStdString(file.old_path), QString::fromStdString(file.new_path)));
+		}
+
+		return result;
+	}
+
+	/* pair up the files of a request which is never cancelled */
+	bool find_similar(std::vector<diff_file> &files) const
+	{
+		const std::atomic<uint64_t> generation(1);
+		return find_similar_files(*repo, files, generation, 1);
+	}
+
+	git::git_library_lock lock;
+	QTemporaryDir repo_dir;
+	std::unique_ptr<git::repository> repo;
+	std::unique_ptr<git::odb> odb;
+
+private slots:
+	/* the blobs of the files are written to an empty repository */
+	void initTestCase()
+	{
+		QVERIFY(repo_dir.isValid());
+
+		git_repository *init_repo = nullptr;
+		QCOMPARE(git_repository_init(&init_repo, QFile::encodeName(repo_dir.path()).constData(), 0), 0);
+		git_repository_free(init_repo);
+
+		repo.reset(new git::repository(QFile::encodeName(repo_dir.path()).constData()));
+		odb.reset(new git::odb(repo->odb()));
+	}
+
+	/* files with the same blob id are paired without reading the blobs */
+	void test_exact_match()
+	{
+		const QByteArray content = line('a', 20) + line('b', 30);
+
+		/* an added file with the content of a deleted one is a rename */
+		std::vector<diff_file> files = { deleted("old.txt", content), added("new.txt", content) };
+		QVERIFY(find_similar(files));
+		QCOMPARE(describe(files), QStringList({ "R old.txt new.txt" }));
+		QVERIFY(git_oid_equal(&files[0].old_id, &files[0].new_id));
+
+		/* and one with the old content of a modified file is a copy */
+		files = { modified("file.txt", content, line('c', 10)), added("copy.txt", content) };
+		QVERIFY(find_similar(files));
+		QCOMPARE(describe(files), QStringList({ "M file.txt file.txt", "C file.txt copy.txt" }));
+
+		/* a deleted file is preferred over a modified one with the same content, so it becomes a rename */
+		files = { modified("file.txt", content, line('c', 10)), deleted("old.txt", content), added("new.txt", content) };
+		QVERIFY(find_similar(files));
+		QCOMPARE(describe(files), QStringList({ "M file.txt file.txt", "R old.txt new.txt" }));
+
+		/* a deleted file is renamed once, the other files with its content are copies */
+		files = { deleted("old.txt", content), added("a.txt", content), added("b.txt", content) };
+		QVERIFY(find_similar(files));
+		QCOMPARE(describe(files), QStringList({ "R old.txt a.txt", "C old.txt b.txt" }));
+
+		/* empty and binary files are never scored, but are still paired when identical */
+		const QByteArray binary("\0\1\2\3\n", 5);
+		files = { deleted("empty", ""), deleted("old.bin", binary), added("empty2", ""), added("new.bin", binary) };
+		QVERIFY(find_similar(files));
+		QCOMPARE(describe(files), QStringList({ "R empty empty2", "R old.bin new.bin" }));
+	}
+
+	/* define the cases for a deleted file and an added file with different content */
+	void test_score_data()
+	{
+		QTest::addColumn<QByteArray>("old_content");
+		QTest::addColumn<QByteArray>("new_content");
+		QTest::addColumn<bool>("renamed");
+
+		const int threshold = preferences::similarity_threshold;
+
+		/* lines of ten bytes, so each line is ten percent of the file */
+		QByteArray ten_lines;
+		for (char c = 'a'; c < 'a' + 10; c++)
+			ten_lines += line(c, 10);
+
+		QByteArray changed_line = ten_lines;
+		changed_line[5 * 10] = 'X';
+		QTest::newRow("near rename") << ten_lines << changed_line << true;
+
+		QByteArray reversed;
+		for (char c = 'a' + 9; c >= 'a'; c--)
+			reversed += line(c, 10);
+		QTest::newRow("lines moved") << ten_lines << reversed << true;
+
+		QByteArray mostly_changed = ten_lines;
+		for (int i = 0; i < 6; i++)
+			mostly_changed[i * 10] = 'X';
+		QTest::newRow("below threshold") << ten_lines << mostly_changed << false;
+
+		QByteArray other_lines;
+		for (char c = 'k'; c < 'k' + 10; c++)
+			other_lines += line(c, 10);
+		QTest::newRow("nothing shared") << ten_lines << other_lines << false;
+
+		/* the score is the percentage of bytes of the bigger file in shared lines, with 100 byte files */
+		QTest::newRow("at threshold") << line('s', threshold) + line('a', 100 - threshold)
+				<< line('s', threshold) + line('b', 100 - threshold) << true;
+		QTest::newRow("just below threshold") << line('s', threshold - 1) + line('a', 101 - threshold)
+				<< line('s', threshold - 1) + line('b', 101 - threshold) << false;
+
+		/* a line that hashes the same only counts as many times as it appears in both files */
+		const QByteArray repeated = line('r', 25) + line('r', 25) + line('r', 25) + line('r', 25);
+		QTest::newRow("repeated lines shared") << repeated << line('r', 25) + line('r', 25) + line('u', 50) << true;
+		QTest::newRow("repeated lines not counted twice") << repeated << line('r', 25) + line('u', 75) << false;
+
+		/* a last line without a newline is not the same line as one with it */
+		QTest::newRow("missing newline") << line('a', 50) + line('b', 50)
+				<< line('a', 50) + QByteArray(50, 'b') << true;
+		QTest::newRow("missing newline below threshold") << line('a', 40) + line('b', 60)
+				<< line('a', 40) + QByteArray(60, 'b') << false;
+
+		/* only files whose sizes are close enough to reach the threshold are scored, which includes those at the limit */
+		const int limit_size = 100 * 100 / threshold;
+		QTest::newRow("source at size limit") << line('s', 100) + line('a', limit_size - 100)
+				<< line('s', 100) << true;
+		QTest::newRow("destination at size limit") << line('s', 100)
+				<< line('s', 100) + line('b', limit_size - 100) << true;
+		QTest::newRow("source past size limit") << line('s', 100) + line('a', limit_size - 99)
+				<< line('s', 100) << false;
+		QTest::newRow("destination past size limit") << line('s', 100)
+				<< line('s', 100) + line('b', limit_size - 99) << false;
+		QTest::newRow("source far bigger") << line('s', 100) + line('a', 1000) << line('s', 100) << false;
+
+		/* binary files are only paired when identical */
+		QByteArray binary = ten_lines;
+		binary[1] = '\0';
+		QByteArray changed_binary = binary;
+		changed_binary[5 * 10] = 'X';
+		QTest::newRow("binary") << binary << changed_binary << false;
+	}
+
+	/* the added file is a rename of the deleted one when the score reaches the threshold */
+	void test_score()
+	{
+		QFETCH(QByteArray, old_content);
+		QFETCH(QByteArray, new_content);
+		QFETCH(bool, renamed);
+
+		std::vector<diff_file> files = { deleted("old.txt", old_content), added("new.txt", new_content) };
+		QVERIFY(find_similar(files));
+
+		if (renamed)
+			QCOMPARE(describe(files), QStringList({ "R old.txt new.txt" }));
+		else
+			QCOMPARE(describe(files), QStringList({ "D old.txt old.txt", "A new.txt new.txt" }));
+	}
+
+	/* the best match of a deleted file is its rename and the others are copies */
+	void test_best_match()
+	{
+		QByteArray ten_lines;
+		for (char c = 'a'; c < 'a' + 10; c++)
+			ten_lines += line(c, 10);
+
+		QByteArray one_changed = ten_lines;
+		one_changed[0] = 'X';
+		QByteArray three_changed = one_changed;
+		three_changed[10] = 'X';
+		three_changed[20] = 'X';
+
+		std::vector<diff_file> files = {
+			added("far.txt", three_changed),
+			deleted("old.txt", ten_lines),
+			added("near.txt", one_changed),
+		};
+		QVERIFY(find_similar(files));
+		QCOMPARE(describe(files), QStringList({ "C old.txt far.txt", "R old.txt near.txt" }));
+
+		/* the old side of a modified file is a source as well, but it is only ever copied */
+		files = { modified("file.txt", ten_lines, line('z', 10)), added("copy.txt", one_changed) };
+		QVERIFY(find_similar(files));
+		QCOMPARE(describe(files), QStringList({ "M file.txt file.txt", "C file.txt copy.txt" }));
+
+		/* each added file takes its own best match */
+		QByteArray other_lines;
+		for (char c = 'k'; c < 'k' + 10; c++)
+			other_lines += line(c, 10);
+		QByteArray other_changed = other_lines;
+		other_changed[0] = 'X';
+
+		files = {
+			deleted("a.txt", ten_lines),
+			deleted("b.txt", other_lines),
+			added("b2.txt", other_changed),
+			added("a2.txt", one_changed),
+		};
+		QVERIFY(find_similar(files));
+		QCOMPARE(describe(files), QStringList({ "R b.txt b2.txt", "R a.txt a2.txt" }));
+	}
+
+	/* a request that is out of date leaves the files unchanged */
+	void test_cancelled()
+	{
+		QByteArray ten_lines;
+		for (char c = 'a'; c < 'a' + 10; c++)
+			ten_lines += line(c, 10);
+		QByteArray one_changed = ten_lines;
+		one_changed[0] = 'X';
+
+		std::vector<diff_file> files = { deleted("old.txt", ten_lines), added("new.txt", one_changed) };
+		const std::atomic<uint64_t> current_generation(2);
+		QVERIFY(!find_similar_files(*repo, files, current_generation, 1));
+		QCOMPARE(describe(files), QStringList({ "D old.txt old.txt", "A new.txt new.txt" }));
+	}
+};
+
+QTEST_MAIN(test_diff_similarity)
+#include "test_diff_similarity.moc"
@@ -18,6 +18,12 @@
 
 #include <QTest>
 
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <random>
+#include <set>
+
 #include "core/graph.h"
 
 char32_t test_line_drawing_chars[] = {
@@ -53,21 +59,28 @@ struct test_graph_step
 	const unsigned int id_of_commit;
 	const unsigned int num_parents;
 	const char32_t *expected;
+	std::vector<unsigned int> merge_target_ids;
+	const unsigned int first_parent_target_id;
 
 	test_graph_step(std::unordered_set<unsigned int> &&duplicate_ids,
 			std::vector<unsigned int> &&new_parent_ids,
 			const unsigned int id_of_commit,
 			const unsigned int num_parents,
-			const char32_t *expected) :
+			const char32_t *expected,
+			std::vector<unsigned int> &&merge_target_ids = {},
+			const unsigned int first_parent_target_id = NO_MERGE_TARGET) :
 		duplicate_ids(std::move(duplicate_ids)),
 		new_parent_ids(std::move(new_parent_ids)),
 		id_of_commit(id_of_commit),
 		num_parents(num_parents),
-		expected(expected)
+		expected(expected),
+		merge_target_ids(std::move(merge_target_ids)),
+		first_parent_target_id(first_parent_target_id)
 	{}
 };
 
 Q_DECLARE_METATYPE(std::vector<test_graph_step>)
+Q_DECLARE_METATYPE(graph_lane_policy)
 
 /* class for executing the graph tests */
 class test_graph : public QObject
@@ -75,26 +88,106 @@ class test_graph : public QObject
 	Q_OBJECT
 
 private:
+	/* decode a row of graph_chars into the line drawing characters */
+	static std::u32string decode_graph_row(const graph_char *buf, size_t size)
+	{
+		std::u32string decoded;
+		for (size_t i = 0; i < size; i++)
+			decoded.push_back(test_line_drawing_chars[buf[i].flags]);
+		return decoded;
+	}
+
+	/* generate the commit_graph_info structures the way commit_list would for a random history */
+	static std::vector<commit_graph_info> generate_random_history(unsigned int seed, size_t num_rows, graph_lane_policy policy)
+	{
+		std::mt19937 rng(seed);
+		std::vector<commit_graph_info> graphs;
+
+		/* commits waiting to be shown, ordered by their position in the history, with their branch ids */
+		std::multimap<unsigned long, unsigned int> pending;
+		unsigned int next_id = 0;
+
+		for (unsigned long i = 0; i < 4; i++)
+			pending.emplace(i * 8, next_id++);
+
+		while (graphs.size() < num_rows && !pending.empty()) {
+			const unsigned long position = pending.begin()->first;
+
+			commit_graph_info graph_info;
+			graph_info.id_of_commit = pending.begin()->second;
+			graph_info.num_duplicates = 0;
+			pending.erase(pending.begin());
+
+			while (!pending.empty() && pending.begin()->first == position) {
+				graph_info.duplicate_ids.insert(pending.begin()->second);
+				graph_info.num_duplicates++;
+				pending.erase(pending.begin());
+			}
+
+			const unsigned int kind = rng() % 32;
+			if (kind == 0 && !pending.empty())
+				graph_info.num_parents = 0;
+			else if (kind < 6)
+				graph_info.num_parents = 2;
+			else if (kind < 8)
+				graph_info.num_parents = 3;
+			else
+				graph_info.num_parents = 1;
+
+			/* parents which land on a position already waiting become duplicates later on */
+			std::set<unsigned long> parent_positions;
+			while (parent_positions.size() < graph_info.num_parents)
+				parent_positions.insert(position + 1 + rng() % 24);
+
+			bool first_parent = true;
+			for (unsigned long parent_position : parent_positions) {
+				if (first_parent) {
+					if (policy == graph_lane_policy::COMPACT) {
+						auto target = pending.find(parent_position);
+						if (target != pending.end())
+							graph_info.first_parent_target_id = target->second;
+					}
+
+					pending.emplace(parent_position, graph_info.id_of_commit);
+					first_parent = false;
+				} else {
+					if (policy == graph_lane_policy::COMPACT) {
+						auto target = pending.find(parent_position);
+						graph_info.merge_target_ids.push_back(target != pending.end() ? target->second : NO_MERGE_TARGET);
+					}
+
+					graph_info.new_parent_ids.push_back(next_id);
+					pending.emplace(parent_position, next_id++);
+				}
+			}
+
+			/* occasionally start a new branch further down */
+			if (rng() % 64 == 0)
+				pending.emplace(position + 1 + rng() % 24, next_id++);
+
+			graphs.push_back(std::move(graph_info));
+		}
+
+		return graphs;
+	}
+
 	/* execute one step of the graph test case */
 	void run_graph_test_step(graph_list &glist, test_graph_step &step)
 	{
 		commit_graph_info graph_info;
 		graph_info.duplicate_ids = std::move(step.duplicate_ids);
 		graph_info.new_parent_ids = std::move(step.new_parent_ids);
+		graph_info.merge_target_ids = std::move(step.merge_target_ids);
+		graph_info.first_parent_target_id = step.first_parent_target_id;
 		graph_info.id_of_commit = step.id_of_commit;
 		graph_info.num_parents = step.num_parents;
 		graph_info.num_duplicates = graph_info.duplicate_ids.size();
 
-		graph_char buf[preferences::max_line_length];
+		std::vector<graph_char> buf;
 		size_t graph_size = glist.compute_graph(graph_info, buf);
 
-		char32_t decoded_buf[preferences::max_line_length];
-		for (size_t i = 0; i < graph_size; i++)
-			decoded_buf[i] = test_line_drawing_chars[buf[i].flags];
-
-		size_t expected_size = std::char_traits<char32_t>::length(step.expected);
-		QCOMPARE(graph_size, expected_size);
-		QCOMPARE(memcmp(decoded_buf, step.expected, expected_size * sizeof(char32_t)), 0);
+		QCOMPARE(graph_size, buf.size());
+		QCOMPARE(decode_graph_row(buf.data(), graph_size), std::u32string(step.expected));
 	}
 
 private slots:
@@ -336,6 +429,219 @@ private slots:
 		for (test_graph_step &step : steps)
 			run_graph_test_step(glist, step);
 	}
+
+	/* define the graph test cases for graph_lane_policy::COMPACT */
+	void run_graph_compact_test_data()
+	{
+		QTest::addColumn<std::vector<test_graph_step>>("steps");
+
+		/* test merge into a branch waiting on the same parent
+		 * •
+		 * │ •
+		 * •─┤
+		 * │ •
+		 */
+		QTest::newRow("test_merge_into_waiting_branch") << std::vector<test_graph_step>({
+			/* duplicate_ids, new_parent_ids, id_of_commit, num_parents, expected_string, merge_target_ids */
+			test_graph_step({},    {},    1, 1, U"• "),
+			test_graph_step({},    {},    2, 1, U"│ • "),
+			test_graph_step({},    { 3 }, 1, 2, U"•─┤ ", { 2 }),
+			test_graph_step({ 3 }, {},    2, 1, U"│ • "),
+		});
+
+		/* test merge target on the left can not be used
+		 * •
+		 * │ •
+		 * │ •─┐
+		 * •─│─┘
+		 * │ •
+		 */
+		QTest::newRow("test_merge_target_on_left") << std::vector<test_graph_step>({
+			/* duplicate_ids, new_parent_ids, id_of_commit, num_parents, expected_string, merge_target_ids */
+			test_graph_step({},    {},    1, 1, U"• "),
+			test_graph_step({},    {},    2, 1, U"│ • "),
+			test_graph_step({},    { 3 }, 2, 2, U"│ •─┐ ", { 1 }),
+			test_graph_step({ 3 }, {},    1, 1, U"•─│─┘ "),
+			test_graph_step({},    {},    2, 1, U"│ • "),
+		});
+
+		/* test merge reuses an ending lane before an empty lane
+		 * •
+		 * │ •
+		 * │ │ •
+		 * │ I │
+		 * •───┤
+		 * • ┌─┘
+		 */
+		QTest::newRow("test_merge_reuses_ending_lane") << std::vector<test_graph_step>({
+			/* duplicate_ids, new_parent_ids, id_of_commit, num_parents, expected_string, merge_target_ids */
+			test_graph_step({},    {},    1, 1, U"• "),
+			test_graph_step({},    {},    2, 1, U"│ • "),
+			test_graph_step({},    {},    3, 1, U"│ │ • "),
+			test_graph_step({},    {},    2, 0, U"│ I │ "),
+			test_graph_step({ 3 }, { 4 }, 1, 2, U"•───┤ ", { NO_MERGE_TARGET }),
+			test_graph_step({},    {},    1, 1, U"• ┌─┘ "),
+		});
+
+		/* test branch ends at a branch waiting on its first parent, a later merge reuses its lane
+		 * •
+		 * │ •
+		 * │ │ •
+		 * │ │ │ •
+		 * │ •─│─┤
+		 * •─┐ │ │
+		 * │ • │ │
+		 * │ │ │ •
+		 */
+		QTest::newRow("test_branch_ends_at_waiting_branch") << std::vector<test_graph_step>({
+			/* duplicate_ids, new_parent_ids, id_of_commit, num_parents, expected_string, merge_target_ids, first_parent_target_id */
+			test_graph_step({},    {},    1, 1, U"• "),
+			test_graph_step({},    {},    2, 1, U"│ • "),
+			test_graph_step({},    {},    3, 1, U"│ │ • "),
+			test_graph_step({},    {},    4, 1, U"│ │ │ • "),
+			test_graph_step({},    {},    2, 1, U"│ •─│─┤ ", {}, 4),
+			test_graph_step({},    { 5 }, 1, 2, U"•─┐ │ │ ", { NO_MERGE_TARGET }),
+			test_graph_step({},    {},    5, 1, U"│ • │ │ "),
+			test_graph_step({ 2 }, {},    4, 1, U"│ │ │ • "),
+		});
+
+		/* test branch waiting on the first parent on the left can not be used
+		 * •
+		 * │ •
+		 * │ •
+		 * •─┘
+		 */
+		QTest::newRow("test_first_parent_target_on_left") << std::vector<test_graph_step>({
+			/* duplicate_ids, new_parent_ids, id_of_commit, num_parents, expected_string, merge_target_ids, first_parent_target_id */
+			test_graph_step({},    {}, 1, 1, U"• "),
+			test_graph_step({},    {}, 2, 1, U"│ • "),
+			test_graph_step({},    {}, 2, 1, U"│ • ", {}, 1),
+			test_graph_step({ 2 }, {}, 1, 1, U"•─┘ "),
+		});
+	}
+
+	/* execute the graph test case using graph_lane_policy::COMPACT */
+	void run_graph_compact_test()
+	{
+		QFETCH(std::vector<test_graph_step>, steps);
+
+		graph_list glist;
+		glist.set_lane_policy(graph_lane_policy::COMPACT);
+
+		for (test_graph_step &step : steps)
+			run_graph_test_step(glist, step);
+	}
+
+	/* check that rows wider than a text line are drawn in full */
+	void run_graph_wide_test()
+	{
+		const size_t num_branches = preferences::max_line_length;
+
+		graph_list glist;
+		std::vector<graph_char> buf;
+		for (unsigned int id = 0; id < num_branches; id++) {
+			commit_graph_info graph_info;
+			graph_info.id_of_commit = id;
+			graph_info.num_parents = 1;
+			graph_info.num_duplicates = 0;
+
+			buf.clear();
+			QCOMPARE(glist.compute_graph(graph_info, buf), (size_t)(id + 1) * 2);
+		}
+
+		std::u32string expected;
+		for (size_t i = 0; i + 1 < num_branches; i++)
+			expected += U"│ ";
+		expected += U"• ";
+
+		QCOMPARE(decode_graph_row(buf.data(), buf.size()), expected);
+	}
+
+	/* define the random histories for the compute_graph checks */
+	void run_graph_random_test_data()
+	{
+		QTest::addColumn<unsigned int>("seed");
+		QTest::addColumn<graph_lane_policy>("policy");
+
+		for (unsigned int seed = 1; seed <= 8; seed++) {
+			QTest::newRow(qPrintable(QString("first_fit_seed_%1").arg(seed))) << seed << graph_lane_policy::FIRST_FIT;
+			QTest::newRow(qPrintable(QString("compact_seed_%1").arg(seed))) << seed << graph_lane_policy::COMPACT;
+		}
+	}
+
+	/* check that drawing a random history marks one commit per row */
+	void run_graph_random_test()
+	{
+		QFETCH(unsigned int, seed);
+		QFETCH(graph_lane_policy, policy);
+
+		std::vector<commit_graph_info> graphs = generate_random_history(seed, 5000, policy);
+
+		graph_list glist;
+		glist.set_lane_policy(policy);
+		std::vector<graph_char> buf;
+		for (commit_graph_info &graph_info : graphs) {
+			buf.clear();
+			size_t graph_size = glist.compute_graph(graph_info, buf);
+			QCOMPARE(graph_size, buf.size());
+
+			size_t num_marks = 0;
+			for (const graph_char &c : buf)
+				num_marks += (c.flags & G_MARK) != 0;
+			QCOMPARE(num_marks, (size_t)1);
+		}
+	}
+
+	/* define the random histories for the graph_layout checks */
+	void run_graph_layout_test_data()
+	{
+		run_graph_random_test_data();
+	}
+
+	/* check that laying out a random history in batches on another thread matches drawing it row by row */
+	void run_graph_layout_test()
+	{
+		QFETCH(unsigned int, seed);
+		QFETCH(graph_lane_policy, policy);
+
+		/* compute_graph uses up the duplicate ids, so each graph_list gets its own copy */
+		std::vector<commit_graph_info> graphs = generate_random_history(seed, 5000, policy);
+		std::vector<commit_graph_info> layout_graphs = graphs;
+
+		graph_list glist;
+		glist.set_lane_policy(policy);
+		graph_list layout_glist;
+		layout_glist.set_lane_policy(policy);
+		graph_layout layout(layout_glist);
+
+		std::mt19937 rng(seed);
+		std::vector<graph_char> buf;
+		size_t batch_begin = 0;
+		while (batch_begin < graphs.size()) {
+			/* batches of varying sizes, including empty ones */
+			const size_t batch_size = std::min<size_t>(rng() % 300, graphs.size() - batch_begin);
+			layout.start(std::vector<commit_graph_info>(std::make_move_iterator(layout_graphs.begin() + batch_begin),
+					std::make_move_iterator(layout_graphs.begin() + batch_begin + batch_size)));
+
+			/* the same rows are drawn one by one while the batch is laid out */
+			buf.clear();
+			std::vector<size_t> row_ends;
+			for (size_t i = batch_begin; i < batch_begin + batch_size; i++) {
+				glist.compute_graph(graphs[i], buf);
+				row_ends.push_back(buf.size());
+			}
+
+			const graph_rows &rows = layout.wait();
+			QVERIFY(rows.row_ends == row_ends);
+			QCOMPARE(rows.chars.size(), buf.size());
+			for (size_t i = 0; i < buf.size(); i++) {
+				QCOMPARE(rows.chars[i].flags, buf[i].flags);
+				QCOMPARE(rows.chars[i].color, buf[i].color);
+			}
+
+			batch_begin += batch_size;
+		}
+	}
 };
 
 QTEST_MAIN(test_graph)
@@ -0,0 +1,153 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <QImage>
+#include <QPainter>
+#include <QTest>
+
+#include <vector>
+
+#include "core/graph.h"
+#include "ui/graph_painter.h"
+
+/* the size of the graph column and of the rows in the commit view with the default font */
+constexpr int column_width = 150;
+constexpr int row_height = 20;
+constexpr int visible_rows = 40;
+
+/* returns rows of num_lanes lanes, a commit moving across the lanes and merging with the next two every few rows */
+static std::vector<std::vector<graph_char>> make_rows(size_t num_rows, size_t num_lanes)
+{
+	std::vector<std::vector<graph_char>> rows(num_rows);
+
+	for (size_t r = 0; r < num_rows; r++) {
+		const size_t commit_lane = (r * 7) % num_lanes;
+
+		for (size_t lane = 0; lane < num_lanes; lane++) {
+			const unsigned char color = static_cast<unsigned char>(lane % 7);
+			const bool merged = r % 5 == 0 && lane >= commit_lane && lane < commit_lane + 2;
+
+			rows[r].push_back({ lane == commit_lane ? G_MARK : (unsigned char)(G_UPPER | G_LOWER), color });
+			rows[r].push_back({ merged ? (unsigned char)(G_LEFT | G_RIGHT) : G_EMPTY, color });
+		}
+	}
+
+	return rows;
+}
+
+/* returns a transparent image the size of a row at pixel_ratio */
+static QImage make_image(int height, qreal pixel_ratio)
+{
+	QImage image((int)(column_width * pixel_ratio), (int)(height * pixel_ratio), QImage::Format_ARGB32_Premultiplied);
+	image.setDevicePixelRatio(pixel_ratio);
+	image.fill(Qt::transparent);
+	return image;
+}
+
+/* returns the image of a row painted by gpainter */
+static QImage paint_row(graph_painter &gpainter, const std::vector<graph_char> &row, qreal pixel_ratio = 1.0)
+{
+	QImage image = make_image(row_height, pixel_ratio);
+	QPainter painter(&image);
+	gpainter.paint(&painter, QRect(0, 0, column_width, row_height), span<const graph_char>(row.data(), row.size()));
+	painter.end();
+	return image;
+}
+
+/* class for testing the painting of the graph */
+class test_graph_painter : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	/* a row copied from the cache is the same as the row painted the first time */
+	void test_cached_rows()
+	{
+		graph_painter gpainter;
+		const auto rows = make_rows(2, 10);
+
+		const QImage first = paint_row(gpainter, rows[0]);
+		QCOMPARE(paint_row(gpainter, rows[0]), first);
+		QCOMPARE(gpainter.get_memory_usage().objects, (size_t)1);
+
+		QVERIFY(paint_row(gpainter, rows[1]) != first);
+		QCOMPARE(gpainter.get_memory_usage().objects, (size_t)2);
+
+		/* a new pixel ratio rebuilds the atlas and drops the rows painted from the old one */
+		const QImage scaled = paint_row(gpainter, rows[0], 2.0);
+		QCOMPARE(scaled.size(), first.size() * 2);
+		QCOMPARE(gpainter.get_memory_usage().objects, (size_t)1);
+		QCOMPARE(paint_row(gpainter, rows[0], 2.0), scaled);
+	}
+
+	/* scrolling by a lane paints the row as if its first lane was not there */
+	void test_first_lane()
+	{
+		graph_painter scrolled;
+		graph_painter reference;
+		const auto rows = make_rows(1, 10);
+		const std::vector<graph_char> rest(rows[0].begin() + 2, rows[0].end());
+
+		scrolled.set_first_lane(1);
+		QCOMPARE(paint_row(scrolled, rows[0]), paint_row(reference, rest));
+
+		/* scrolling past the last lane paints nothing */
+		scrolled.set_first_lane(10);
+		QCOMPARE(paint_row(scrolled, rows[0]), make_image(row_height, 1.0));
+	}
+
+	/* the lanes are two characters, each half as wide as the row is high */
+	void test_lanes_in_width()
+	{
+		QCOMPARE(graph_painter::lanes_in_width(150, 20), 7);
+		QCOMPARE(graph_painter::lanes_in_width(19, 20), 0);
+		QCOMPARE(graph_painter::lanes_in_width(150, 0), 0);
+	}
+
+	void benchmark_scroll_data()
+	{
+		QTest::addColumn<qreal>("pixel_ratio");
+
+		QTest::newRow("1x") << 1.0;
+		QTest::newRow("2x") << 2.0;
+	}
+
+	/* scrolling three rows at a time through a graph of 40 lanes, repainting the visible rows each time */
+	void benchmark_scroll()
+	{
+		QFETCH(qreal, pixel_ratio);
+
+		graph_painter gpainter;
+		const auto rows = make_rows(2000, 40);
+		QImage image = make_image(row_height * visible_rows, pixel_ratio);
+
+		QBENCHMARK {
+			QPainter painter(&image);
+			for (size_t first = 0; first + visible_rows <= rows.size(); first += 3) {
+				for (int i = 0; i < visible_rows; i++) {
+					const auto &row = rows[first + i];
+					gpainter.paint(&painter, QRect(0, i * row_height, column_width, row_height),
+							span<const graph_char>(row.data(), row.size()));
+				}
+			}
+		}
+	}
+};
+
+QTEST_MAIN(test_graph_painter)
+#include "test_graph_painter.moc"
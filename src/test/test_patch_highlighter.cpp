@@ -0,0 +1,332 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <QTest>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "core/patch_highlighter.h"
+#include "util/preferences.h"
+
+/* a patch of the lines, each given as its origin and its content */
+static diff_patch make_patch(const std::vector<std::pair<char, std::string>> &lines)
+{
+	diff_patch patch;
+	for (const auto &line : lines)
+		patch.add_line(line.first, line.second.data(), line.second.size());
+
+	return patch;
+}
+
+/* the text of a line of the patch between two byte offsets */
+static QString line_text(const diff_patch &patch, size_t line, uint32_t begin, uint32_t end)
+{
+	return QString::fromUtf8(patch.text.data() + patch.lines[line].offset + begin, static_cast<int>(end - begin));
+}
+
+static QString kind_name(highlight_kind kind)
+{
+	switch (kind) {
+	case highlight_kind::KEYWORD:
+		return "keyword";
+	case highlight_kind::STRING:
+		return "string";
+	case highlight_kind::COMMENT:
+		return "comment";
+	case highlight_kind::NUMBER:
+		return "number";
+	}
+
+	return "unknown";
+}
+
+/* the highlighting of every line of the patch, block by block */
+static std::vector<line_highlight> highlight_lines(const diff_patch &patch)
+{
+	std::vector<line_highlight> lines;
+	for (size_t i = 0; i * preferences::highlight_block_size < patch.lines.size(); i++) {
+		const std::shared_ptr<patch_highlight_block> block = patch_highlighter::highlight_block(patch, i);
+		lines.insert(lines.end(), block->lines.begin(), block->lines.end());
+	}
+
+	return lines;
+}
+
+/* the changed part of each line of the patch, or "-" for a line without one */
+static QStringList changed_text(const diff_patch &patch)
+{
+	const std::vector<line_highlight> lines = highlight_lines(patch);
+
+	QStringList changed;
+	for (size_t i = 0; i < lines.size(); i++) {
+		if (lines[i].changed_begin == lines[i].changed_end && lines[i].changed_begin == 0)
+			changed.append("-");
+		else
+			changed.append(line_text(patch, i, lines[i].changed_begin, lines[i].changed_end));
+	}
+
+	return changed;
+}
+
+/* class for testing the highlighting of the lines of patches */
+class test_patch_highlighter : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	/* define the lines to tokenize and the tokens they are expected to have, as "<kind> <text>" */
+	void test_tokenize_data()
+	{
+		QTest::addColumn<QByteArray>("line");
+		QTest::addColumn<QStringList>("expected");
+
+		QTest::newRow("plain") << QByteArray("a = b + c;") << QStringList();
+		QTest::newRow("keyword and number") << QByteArray("int x = 42;")
+				<< QStringList({ "keyword int", "number 42" });
+
+		/* "in" and "int" are both keywords, the words they start are not */
+		QTest::newRow("keyword prefixes") << QByteArray("in int into integer i inte")
+				<< QStringList({ "keyword in", "keyword int" });
+		QTest::newRow("keyword with suffix") << QByteArray("intx int_ int2 yields")
+				<< QStringList();
+		QTest::newRow("first and last keywords") << QByteArray("and yield") << QStringList({ "keyword and", "keyword yield" });
+		QTest::newRow("keyword case") << QByteArray("Int INT") << QStringList();
+		QTest::newRow("keyword next to punctuation") << QByteArray("(int)x;return;")
+				<< QStringList({ "keyword int", "keyword return" });
+		QTest::newRow("multibyte identifier") << QByteArray("\xc3\xbcint int\xc3\xbc int")
+				<< QStringList({ "keyword int" });
+
+		QTest::newRow("string") << QByteArray("s = \"int\" + 'c' + `t`;")
+				<< QStringList({ "string \"int\"", "string 'c'", "string `t`" });
+		QTest::newRow("escaped quote") << QByteArray("\"a \\\" int\" int")
+				<< QStringList({ "string \"a \\\" int\"", "keyword int" });
+		QTest::newRow("other quote in string") << QByteArray("\"it's\" 'say \"hi\"'")
+				<< QStringList({ "string \"it's\"", "string 'say \"hi\"'" });
+		QTest::newRow("unterminated string") << QByteArray("int s = \"abc int")
+				<< QStringList({ "keyword int", "string \"abc int" });
+		QTest::newRow("unterminated string ending in escape") << QByteArray("s = \"abc\\")
+				<< QStringList({ "string \"abc\\" });
+		QTest::newRow("lone quote") << QByteArray("x = \"") << QStringList({ "string \"" });
+
+		QTest::newRow("line comment") << QByteArray("x = 1; // int \"a\"")
+				<< QStringList({ "number 1", "comment // int \"a\"" });
+		QTest::newRow("hash comment") << QByteArray("\t # int x") << QStringList({ "comment # int x" });
+		QTest::newRow("hash after code") << QByteArray("x # 1") << QStringList({ "number 1" });
+		QTest::newRow("block comment") << QByteArray("int /* int */ x /**/ 2")
+				<< QStringList({ "keyword int", "comment /* int */", "comment /**/", "number 2" });
+		QTest::newRow("unterminated block comment") << QByteArray("return /* int \"a")
+				<< QStringList({ "keyword return", "comment /* int \"a" });
+		QTest::newRow("block comment closed by its opening") << QByteArray("/*/ int")
+				<< QStringList({ "comment /*/ int" });
+		QTest::newRow("block comment ending at line end") << QByteArray("x /* a */")
+				<< QStringList({ "comment /* a */" });
+		QTest::newRow("comment start in string") << QByteArray("\"/*\" int")
+				<< QStringList({ "string \"/*\"", "keyword int" });
+
+		QTest::newRow("numbers") << QByteArray("0x1f 1.5e3 7u x1")
+				<< QStringList({ "number 0x1f", "number 1.5e3", "number 7u" });
+	}
+
+	/* the tokens of the line are coloured by kind */
+	void test_tokenize()
+	{
+		QFETCH(QByteArray, line);
+		QFETCH(QStringList, expected);
+
+		const diff_patch patch = make_patch({ { GIT_DIFF_LINE_CONTEXT, std::string(line.constData(), line.size()) } });
+		const std::shared_ptr<patch_highlight_block> block = patch_highlighter::highlight_block(patch, 0);
+		QCOMPARE(block->lines.size(), (size_t)1);
+
+		QStringList tokens;
+		for (uint32_t i = 0; i < block->lines[0].num_spans; i++) {
+			const highlight_span &span = block->spans[block->lines[0].first_span + i];
+			tokens.append(kind_name(span.kind) + " " + line_text(patch, 0, span.begin, span.end));
+		}
+
+		QCOMPARE(tokens, expected);
+	}
+
+	/* hunk headers are not tokenized */
+	void test_tokenize_hunk_header()
+	{
+		const diff_patch patch = make_patch({
+			{ GIT_DIFF_LINE_HUNK_HDR, "@@ -1,2 +1,2 @@ int main()" },
+			{ GIT_DIFF_LINE_CONTEXT, "int main()" },
+		});
+
+		const std::shared_ptr<patch_highlight_block> block = patch_highlighter::highlight_block(patch, 0);
+		QCOMPARE(block->lines[0].num_spans, (uint32_t)0);
+		QCOMPARE(block->lines[1].num_spans, (uint32_t)1);
+	}
+
+	/* define the deleted and added lines and the parts of them expected to be marked as changed */
+	void test_changed_words_data()
+	{
+		QTest::addColumn<QByteArray>("old_line");
+		QTest::addColumn<QByteArray>("new_line");
+		QTest::addColumn<QString>("old_changed");
+		QTest::addColumn<QString>("new_changed");
+
+		QTest::newRow("word replaced") << QByteArray("int a = 1;") << QByteArray("int a = 2;") << QString("1") << QString("2");
+		QTest::newRow("whole words") << QByteArray("counter++;") << QByteArray("count++;") << QString("counter") << QString("count");
+		QTest::newRow("word inserted") << QByteArray("f(a, b);") << QByteArray("f(a, c, b);") << QString("") << QString("c, ");
+		QTest::newRow("word removed") << QByteArray("f(a, c, b);") << QByteArray("f(a, b);") << QString("c, ") << QString("");
+		QTest::newRow("several words") << QByteArray("if (a && b) {") << QByteArray("if (c || d) {")
+				<< QString("a && b") << QString("c || d");
+		QTest::newRow("spaces changed") << QByteArray("x = 1;") << QByteArray("x  = 1;") << QString(" ") << QString("  ");
+		QTest::newRow("end changed") << QByteArray("return a;") << QByteArray("return b") << QString("a;") << QString("b");
+		QTest::newRow("start changed") << QByteArray("a = x;") << QByteArray("b = x;") << QString("a") << QString("b");
+		QTest::newRow("repeated words") << QByteArray("a a a") << QByteArray("a a") << QString(" a") << QString("");
+
+		/* a line with nothing in common with its partner is left plain */
+		QTest::newRow("nothing in common") << QByteArray("abc") << QByteArray("xyz") << QString("-") << QString("-");
+		QTest::newRow("empty line") << QByteArray("") << QByteArray("abc") << QString("-") << QString("-");
+	}
+
+	/* the words between the common start and end of a deleted line and the added line replacing it are changed */
+	void test_changed_words()
+	{
+		QFETCH(QByteArray, old_line);
+		QFETCH(QByteArray, new_line);
+		QFETCH(QString, old_changed);
+		QFETCH(QString, new_changed);
+
+		const diff_patch patch = make_patch({
+			{ GIT_DIFF_LINE_DELETION, std::string(old_line.constData(), old_line.size()) },
+			{ GIT_DIFF_LINE_ADDITION, std::string(new_line.constData(), new_line.size()) },
+		});
+
+		QCOMPARE(changed_text(patch), QStringList({ old_changed, new_changed }));
+	}
+
+	/* the nth deleted line of a run is paired with the nth added line, the rest are left plain */
+	void test_pairing()
+	{
+		/* more deleted lines than added lines */
+		diff_patch patch = make_patch({
+			{ GIT_DIFF_LINE_CONTEXT, "x = 0;" },
+			{ GIT_DIFF_LINE_DELETION, "x = 1;" },
+			{ GIT_DIFF_LINE_DELETION, "x = 2;" },
+			{ GIT_DIFF_LINE_DELETION, "x = 3;" },
+			{ GIT_DIFF_LINE_ADDITION, "x = 10;" },
+			{ GIT_DIFF_LINE_ADDITION, "x = 20;" },
+			{ GIT_DIFF_LINE_CONTEXT, "x = 4;" },
+		});
+		QCOMPARE(changed_text(patch), QStringList({ "-", "1", "2", "-", "10", "20", "-" }));
+
+		/* more added lines than deleted lines */
+		patch = make_patch({
+			{ GIT_DIFF_LINE_DELETION, "x = 1;" },
+			{ GIT_DIFF_LINE_ADDITION, "x = 10;" },
+			{ GIT_DIFF_LINE_ADDITION, "x = 20;" },
+			{ GIT_DIFF_LINE_ADDITION, "x = 30;" },
+		});
+		QCOMPARE(changed_text(patch), QStringList({ "1", "10", "-", "-" }));
+
+		/* only added or only deleted lines have nothing to pair with */
+		patch = make_patch({
+			{ GIT_DIFF_LINE_ADDITION, "x = 1;" },
+			{ GIT_DIFF_LINE_ADDITION, "x = 2;" },
+			{ GIT_DIFF_LINE_CONTEXT, "y" },
+			{ GIT_DIFF_LINE_DELETION, "x = 1;" },
+			{ GIT_DIFF_LINE_DELETION, "x = 2;" },
+		});
+		QCOMPARE(changed_text(patch), QStringList({ "-", "-", "-", "-", "-" }));
+
+		/* added lines followed by deleted lines are not a replacement */
+		patch = make_patch({
+			{ GIT_DIFF_LINE_ADDITION, "x = 1;" },
+			{ GIT_DIFF_LINE_DELETION, "x = 2;" },
+		});
+		QCOMPARE(changed_text(patch), QStringList({ "-", "-" }));
+
+		/* and neither are deleted and added lines mixed together */
+		patch = make_patch({
+			{ GIT_DIFF_LINE_DELETION, "x = 1;" },
+			{ GIT_DIFF_LINE_ADDITION, "x = 10;" },
+			{ GIT_DIFF_LINE_DELETION, "x = 2;" },
+			{ GIT_DIFF_LINE_ADDITION, "x = 20;" },
+		});
+		QCOMPARE(changed_text(patch), QStringList({ "-", "-", "-", "-" }));
+
+		/* each run separated by a context line or a hunk header is paired on its own */
+		patch = make_patch({
+			{ GIT_DIFF_LINE_DELETION, "x = 1;" },
+			{ GIT_DIFF_LINE_ADDITION, "x = 10;" },
+			{ GIT_DIFF_LINE_HUNK_HDR, "@@ -10 +10 @@" },
+			{ GIT_DIFF_LINE_DELETION, "y = 2;" },
+			{ GIT_DIFF_LINE_DELETION, "y = 3;" },
+			{ GIT_DIFF_LINE_CONTEXT, "z" },
+			{ GIT_DIFF_LINE_ADDITION, "y = 30;" },
+		});
+		QCOMPARE(changed_text(patch), QStringList({ "1", "10", "-", "-", "-", "-", "-" }));
+	}
+
+	/* a run crossing the boundary of a block is paired the same from either block */
+	void test_pairing_across_blocks()
+	{
+		std::vector<std::pair<char, std::string>> lines;
+		for (size_t i = 0; i + 2 < preferences::highlight_block_size; i++)
+			lines.emplace_back(GIT_DIFF_LINE_CONTEXT, "context");
+		for (int i = 0; i < 4; i++)
+			lines.emplace_back(GIT_DIFF_LINE_DELETION, "x = " + std::to_string(i) + ";");
+		for (int i = 0; i < 4; i++)
+			lines.emplace_back(GIT_DIFF_LINE_ADDITION, "x = " + std::to_string(i + 10) + ";");
+
+		const diff_patch patch = make_patch(lines);
+		const QStringList changed = changed_text(patch);
+		const QStringList run = changed.mid(static_cast<int>(preferences::highlight_block_size - 2));
+		QCOMPARE(run, QStringList({ "0", "1", "2", "3", "10", "11", "12", "13" }));
+	}
+
+	/* the changes within lines are only found for runs of up to intra_line_max_run lines */
+	void test_long_runs()
+	{
+		const size_t max_run = preferences::intra_line_max_run;
+
+		for (size_t run_length : { max_run, max_run + 1 }) {
+			const size_t num_deletions = run_length / 2;
+
+			std::vector<std::pair<char, std::string>> lines;
+			lines.emplace_back(GIT_DIFF_LINE_CONTEXT, "context");
+			for (size_t i = 0; i < num_deletions; i++)
+				lines.emplace_back(GIT_DIFF_LINE_DELETION, "x = " + std::to_string(i) + ";");
+			for (size_t i = num_deletions; i < run_length; i++)
+				lines.emplace_back(GIT_DIFF_LINE_ADDITION, "x = " + std::to_string(i) + ";");
+			lines.emplace_back(GIT_DIFF_LINE_CONTEXT, "context");
+
+			const diff_patch patch = make_patch(lines);
+			const std::vector<line_highlight> highlights = highlight_lines(patch);
+			QCOMPARE(highlights.size(), run_length + 2);
+
+			/* every line of the run is checked, since each block looks for the run from its own first line */
+			size_t num_changed = 0;
+			for (const line_highlight &highlight : highlights)
+				if (highlight.changed_begin != highlight.changed_end)
+					num_changed++;
+
+			QCOMPARE(num_changed, run_length <= max_run ? num_deletions * 2 : (size_t)0);
+		}
+	}
+};
+
+QTEST_MAIN(test_patch_highlighter)
+#include "test_patch_highlighter.moc"
@@ -0,0 +1,213 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <QTest>
+
+#include <random>
+#include <vector>
+
+#include "util/range_set.h"
+
+/* writes the ranges in set as "[begin, end)" separated by spaces, so a failed comparison shows all of them */
+static QString ranges_string(const range_set &set)
+{
+	QStringList ranges;
+	for (const range_set::range &r : set.get_ranges())
+		ranges.append(QStringLiteral("[%1, %2)").arg(r.begin).arg(r.end));
+
+	return ranges.join(" ");
+}
+
+/* class for testing the range set */
+class test_range_set : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	/* inserted ranges are merged with the ranges they overlap or touch, but not with ones past a gap */
+	void test_insert()
+	{
+		range_set set;
+
+		/* empty ranges are ignored */
+		set.insert(5, 5);
+		set.insert(6, 2);
+		QVERIFY(set.empty());
+
+		set.insert(10, 20);
+		set.insert(30, 40);
+		QCOMPARE(ranges_string(set), QString("[10, 20) [30, 40)"));
+
+		/* a range ending where another begins is merged with it */
+		set.insert(5, 10);
+		QCOMPARE(ranges_string(set), QString("[5, 20) [30, 40)"));
+
+		/* and so is one beginning where another ends */
+		set.insert(40, 45);
+		QCOMPARE(ranges_string(set), QString("[5, 20) [30, 45)"));
+
+		/* a gap of one keeps the ranges apart */
+		set.insert(21, 29);
+		QCOMPARE(ranges_string(set), QString("[5, 20) [21, 29) [30, 45)"));
+
+		/* filling the gaps merges every range into one */
+		set.insert(20, 21);
+		QCOMPARE(ranges_string(set), QString("[5, 29) [30, 45)"));
+		set.insert(29, 30);
+		QCOMPARE(ranges_string(set), QString("[5, 45)"));
+
+		/* a range inside another changes nothing */
+		set.insert(10, 15);
+		QCOMPARE(ranges_string(set), QString("[5, 45)"));
+
+		/* a range covering several others replaces them */
+		set.insert(50, 60);
+		set.insert(70, 80);
+		set.insert(0, 100);
+		QCOMPARE(ranges_string(set), QString("[0, 100)"));
+	}
+
+	/* erasing from the middle of a range splits it in two */
+	void test_erase_split()
+	{
+		range_set set;
+		set.insert(0, 100);
+
+		set.erase(40, 60);
+		QCOMPARE(ranges_string(set), QString("[0, 40) [60, 100)"));
+
+		/* erasing a single integer leaves a gap of one */
+		set.erase(10, 11);
+		QCOMPARE(ranges_string(set), QString("[0, 10) [11, 40) [60, 100)"));
+
+		/* erasing from the edges of a range shortens it without splitting */
+		set.erase(11, 15);
+		set.erase(90, 100);
+		QCOMPARE(ranges_string(set), QString("[0, 10) [15, 40) [60, 90)"));
+
+		/* erasing what is not in the set changes nothing, including the gaps and empty ranges */
+		set.erase(40, 60);
+		set.erase(100, 200);
+		set.erase(20, 20);
+		set.erase(30, 25);
+		QCOMPARE(ranges_string(set), QString("[0, 10) [15, 40) [60, 90)"));
+	}
+
+	/* erasing across several ranges removes the ones inside and keeps what sticks out of the outer ones */
+	void test_erase_across()
+	{
+		range_set set;
+		set.insert(0, 10);
+		set.insert(20, 30);
+		set.insert(40, 50);
+		set.insert(60, 70);
+		set.insert(80, 90);
+
+		set.erase(25, 65);
+		QCOMPARE(ranges_string(set), QString("[0, 10) [20, 25) [65, 70) [80, 90)"));
+
+		/* ranges exactly covered by the erased one are removed entirely */
+		set.erase(20, 25);
+		QCOMPARE(ranges_string(set), QString("[0, 10) [65, 70) [80, 90)"));
+
+		/* the erased range may begin and end in gaps */
+		set.erase(60, 75);
+		QCOMPARE(ranges_string(set), QString("[0, 10) [80, 90)"));
+
+		set.erase(5, 85);
+		QCOMPARE(ranges_string(set), QString("[0, 5) [85, 90)"));
+
+		set.erase(0, 1000);
+		QVERIFY(set.empty());
+	}
+
+	/* the begin of a range is in the set, the end is not */
+	void test_contains()
+	{
+		range_set set;
+		QVERIFY(!set.contains(0));
+
+		set.insert(0, 1);
+		set.insert(10, 20);
+		set.insert(21, 22);
+
+		QVERIFY(set.contains(0));
+		QVERIFY(!set.contains(1));
+		QVERIFY(!set.contains(9));
+		QVERIFY(set.contains(10));
+		QVERIFY(set.contains(15));
+		QVERIFY(set.contains(19));
+		QVERIFY(!set.contains(20));
+		QVERIFY(set.contains(21));
+		QVERIFY(!set.contains(22));
+		QVERIFY(!set.contains(UINT64_MAX));
+
+		/* the edges of the ranges left by a split */
+		set.erase(12, 14);
+		QVERIFY(set.contains(11));
+		QVERIFY(!set.contains(12));
+		QVERIFY(!set.contains(13));
+		QVERIFY(set.contains(14));
+
+		set.clear();
+		QVERIFY(set.empty());
+		QVERIFY(!set.contains(15));
+	}
+
+	/* random inserts and erases give the same integers as a set of flags */
+	void test_random()
+	{
+		const uint64_t size = 200;
+		std::mt19937 generator(1234);
+		std::uniform_int_distribution<uint64_t> value_dist(0, size);
+		std::bernoulli_distribution insert_dist(0.6);
+
+		range_set set;
+		std::vector<bool> flags(size, false);
+
+		for (int i = 0; i < 2000; i++) {
+			uint64_t begin = value_dist(generator);
+			uint64_t end = value_dist(generator);
+			if (begin > end)
+				std::swap(begin, end);
+
+			const bool insert = insert_dist(generator);
+			if (insert)
+				set.insert(begin, end);
+			else
+				set.erase(begin, end);
+
+			for (uint64_t j = begin; j < end; j++)
+				flags[j] = insert;
+
+			for (uint64_t j = 0; j < size; j++)
+				QCOMPARE(set.contains(j), static_cast<bool>(flags[j]));
+
+			/* the ranges stay sorted, non empty and apart from each other */
+			const std::vector<range_set::range> &ranges = set.get_ranges();
+			for (size_t j = 0; j < ranges.size(); j++) {
+				QVERIFY(ranges[j].begin < ranges[j].end);
+				if (j > 0)
+					QVERIFY(ranges[j - 1].end < ranges[j].begin);
+			}
+		}
+	}
+};
+
+QTEST_MAIN(test_range_set)
+#include "test_range_set.moc"
@@ -0,0 +1,234 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <QTest>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "util/reef_string.h"
+
+/* the ASCII text around the bytes under test, long enough to fill several blocks on either side */
+static const char filler[] = "Merge branch 'feature/decoder' into main, fixing the build on older compilers";
+
+/* encodes a code point the way UTF-8 would, without rejecting surrogates so the decoder sees them */
+static void append_code_point(std::string &str, uint32_t codepoint)
+{
+	if (codepoint < 0x80) {
+		str += static_cast<char>(codepoint);
+	} else if (codepoint < 0x800) {
+		str += static_cast<char>(0xC0 | (codepoint >> 6));
+		str += static_cast<char>(0x80 | (codepoint & 0x3F));
+	} else if (codepoint < 0x10000) {
+		str += static_cast<char>(0xE0 | (codepoint >> 12));
+		str += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+		str += static_cast<char>(0x80 | (codepoint & 0x3F));
+	} else {
+		str += static_cast<char>(0xF0 | (codepoint >> 18));
+		str += static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F));
+		str += static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F));
+		str += static_cast<char>(0x80 | (codepoint & 0x3F));
+	}
+}
+
+/* class for checking the vectorized UTF-8 decoder against the scalar one */
+class test_reef_string : public QObject
+{
+	Q_OBJECT
+
+	/* returns whether both decoders give the same characters when appending str at the position start */
+	template<size_t BUF_SIZE>
+	static bool decodes_same(const std::string &str, size_t start = 0)
+	{
+		QChar expected[BUF_SIZE];
+		QChar actual[BUF_SIZE];
+		size_t expected_size = start;
+		size_t actual_size = start;
+
+		add_utf8_str_to_buf_scalar(expected, str.data(), str.size(), expected_size);
+		add_utf8_str_to_buf(actual, str.data(), str.size(), actual_size);
+
+		return expected_size == actual_size && std::equal(expected + start, expected + expected_size, actual + start);
+	}
+
+	/* builds the string with bytes placed after offset bytes of ASCII and followed by more ASCII */
+	static std::string surround(const std::string &bytes, size_t offset)
+	{
+		return std::string(filler, offset) + bytes + filler;
+	}
+
+	static std::vector<std::string> benchmark_lines(const char *sample)
+	{
+		/* roughly the length of commit summaries */
+		std::vector<std::string> lines(1024);
+		for (size_t i = 0; i < lines.size(); i++) {
+			while (lines[i].size() < 40 + i % 40)
+				lines[i] += sample;
+		}
+
+		return lines;
+	}
+
+private slots:
+	/* every code point, including the surrogates the decoder rejects, at every block position */
+	void test_code_points()
+	{
+		for (uint32_t codepoint = 0; codepoint <= 0x10FFFF; codepoint++) {
+			std::string bytes;
+			append_code_point(bytes, codepoint);
+
+			const std::string str = surround(bytes, codepoint % 40);
+			if (!decodes_same<128>(str))
+				QFAIL(qPrintable(QStringLiteral("code point %1 decoded differently").arg(codepoint, 0, 16)));
+		}
+	}
+
+	/* every pair of bytes at every position in the first two blocks */
+	void test_byte_pairs()
+	{
+		for (uint32_t pair = 0; pair <= 0xFFFF; pair++) {
+			const char bytes[] = { static_cast<char>(pair >> 8), static_cast<char>(pair) };
+
+			for (size_t offset = 0; offset <= 33; offset++) {
+				if (!decodes_same<128>(surround(std::string(bytes, 2), offset)))
+					QFAIL(qPrintable(QStringLiteral("bytes %1 at %2 decoded differently").arg(pair, 4, 16, QLatin1Char('0')).arg(offset)));
+			}
+		}
+	}
+
+	/* every run of three bytes starting with a lead byte, straddling the end of the first AVX2 block,
+	 * runs starting with any other byte are decoded or rejected one byte in and are covered by the pairs */
+	void test_byte_triples()
+	{
+		std::string str = std::string(filler, 31) + "..." + std::string(filler, 32);
+		for (uint32_t triple = 0xC00000; triple <= 0xFFFFFF; triple++) {
+			str[31] = static_cast<char>(triple >> 16);
+			str[32] = static_cast<char>(triple >> 8);
+			str[33] = static_cast<char>(triple);
+
+			if (!decodes_same<128>(str))
+				QFAIL(qPrintable(QStringLiteral("bytes %1 decoded differently").arg(triple, 6, 16, QLatin1Char('0'))));
+		}
+	}
+
+	/* text that fills the buffer, with surrogate pairs that only half fit */
+	void test_full_buffer()
+	{
+		std::string four_bytes;
+		append_code_point(four_bytes, 0x1F600);
+
+		for (size_t offset = 0; offset < 40; offset++) {
+			for (size_t start = 0; start < 40; start++) {
+				QVERIFY(decodes_same<40>(surround(four_bytes, offset), start));
+				QVERIFY(decodes_same<40>(std::string(filler, offset), start));
+			}
+		}
+	}
+
+	/* the null terminated version stops at the first null byte */
+	void test_null_terminated()
+	{
+		std::string str = surround("\xC3\xA9", 20);
+		str[35] = '\0';
+
+		QChar expected[128];
+		QChar actual[128];
+		size_t expected_size = 0;
+		size_t actual_size = 0;
+
+		add_utf8_str_to_buf_scalar(expected, str.data(), strlen(str.data()), expected_size);
+		add_utf8_str_to_buf(actual, str.c_str(), actual_size);
+
+		QCOMPARE(actual_size, expected_size);
+		QCOMPARE(QString(actual, static_cast<int>(actual_size)), QString(expected, static_cast<int>(expected_size)));
+		QCOMPARE(actual_size, size_t(34));
+	}
+
+	/* random mixes of ASCII, multi byte characters and stray bytes */
+	void test_random_text()
+	{
+		std::mt19937 generator(42);
+		std::uniform_int_distribution<uint32_t> kind(0, 9);
+		std::uniform_int_distribution<uint32_t> ascii(0x20, 0x7E);
+		std::uniform_int_distribution<uint32_t> codepoint(0x80, 0x10FFFF);
+		std::uniform_int_distribution<uint32_t> byte(0, 0xFF);
+		std::uniform_int_distribution<size_t> length(0, 200);
+
+		for (int i = 0; i < 100000; i++) {
+			std::string str;
+			const size_t str_length = length(generator);
+			while (str.size() < str_length) {
+				const uint32_t k = kind(generator);
+				if (k < 7)
+					str += static_cast<char>(ascii(generator));
+				else if (k < 9)
+					append_code_point(str, codepoint(generator));
+				else if (i % 2)
+					str += static_cast<char>(byte(generator));
+			}
+
+			QVERIFY(decodes_same<64>(str));
+			QVERIFY(decodes_same<256>(str));
+		}
+	}
+
+	void benchmark_decode_data()
+	{
+		QTest::addColumn<QByteArray>("sample");
+		QTest::addColumn<bool>("vectorized");
+
+		const char *ascii = "Fix the refresh of the ref list after a fetch ";
+		const char *latin = "Corrige l'affichage des références ";
+		const char *cjk = "修复获取后引用列表的刷新 ";
+
+		QTest::newRow("ascii_scalar") << QByteArray(ascii) << false;
+		QTest::newRow("ascii_vectorized") << QByteArray(ascii) << true;
+		QTest::newRow("latin_scalar") << QByteArray(latin) << false;
+		QTest::newRow("latin_vectorized") << QByteArray(latin) << true;
+		QTest::newRow("cjk_scalar") << QByteArray(cjk) << false;
+		QTest::newRow("cjk_vectorized") << QByteArray(cjk) << true;
+	}
+
+	/* decodes a screen's worth of summaries many times over */
+	void benchmark_decode()
+	{
+		QFETCH(QByteArray, sample);
+		QFETCH(bool, vectorized);
+
+		const std::vector<std::string> lines = benchmark_lines(sample.constData());
+		QChar buf[256];
+		size_t total = 0;
+
+		QBENCHMARK {
+			for (const std::string &line : lines) {
+				size_t size = 0;
+				if (vectorized)
+					add_utf8_str_to_buf(buf, line.data(), line.size(), size);
+				else
+					add_utf8_str_to_buf_scalar(buf, line.data(), line.size(), size);
+				total += size;
+			}
+		}
+
+		QVERIFY(total > 0);
+	}
+};
+
+QTEST_MAIN(test_reef_string)
+#include "test_reef_string.moc"
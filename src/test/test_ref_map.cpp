@@ -0,0 +1,478 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <QFile>
+#include <QTemporaryDir>
+#include <QTest>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+
+#include "core/ref_map.h"
+#include "util/error.h"
+
+/* object ids used as the targets in the packed-refs test cases */
+#define OID_A "1111111111111111111111111111111111111111"
+#define OID_B "2222222222222222222222222222222222222222"
+#define OID_C "3333333333333333333333333333333333333333"
+#define OID_D "abcdefabcdefabcdefabcdefabcdefabcdefabcd"
+
+/* the refs in the repository used for the pattern matching tests */
+static const char *const pattern_test_refs[] = {
+	"refs/heads/feature-2",
+	"refs/heads/feature/deep/y",
+	"refs/heads/feature/x",
+	"refs/heads/featured",
+	"refs/heads/main",
+	"refs/heads/release-1.0",
+	"refs/heads/x",
+	"refs/heads/y",
+	"refs/remotes/origin/feature/release-3",
+	"refs/remotes/origin/main",
+	"refs/remotes/origin/release-1.0",
+	"refs/remotes/origin/release-2.0/fix",
+	"refs/remotes/upstream/release-2.0",
+};
+
+Q_DECLARE_METATYPE(ref_pattern_syntax)
+
+/* class for testing the parsing and matching of refs in the ref_map */
+class test_ref_map : public QObject
+{
+	Q_OBJECT
+
+	/* parse the packed-refs contents and describe each ref as "<name> <target> <peeled>" */
+	static QStringList parse(const QByteArray &data)
+	{
+		QStringList refs;
+		ref_map::parse_packed_refs(data.constData(), data.size(),
+				[&refs] (const char *name, size_t name_len, const git_oid &target, bool peeled) {
+			char target_str[GIT_OID_HEXSZ + 1];
+			git_oid_fmt(target_str, &target);
+			target_str[GIT_OID_HEXSZ] = '\0';
+
+			refs.append(QString("%1 %2 %3").arg(QString::fromUtf8(name, static_cast<int>(name_len)),
+					QString::fromLatin1(target_str), QString::fromLatin1(peeled ? "peeled" : "unpeeled")));
+		});
+		return refs;
+	}
+
+	/* the names of the active refs, sorted */
+	QStringList active_ref_names() const
+	{
+		QStringList names;
+		for (size_t i = 0; i < refs->refs.size(); i++)
+			if (refs->is_ref_active(i))
+				names.append(QString::fromUtf8(refs->refs[i].name));
+
+		std::sort(names.begin(), names.end());
+		return names;
+	}
+
+	/* format the object id as hex */
+	static QByteArray oid_hex(const git_oid &oid)
+	{
+		char str[GIT_OID_HEXSZ + 1];
+		git_oid_fmt(str, &oid);
+		str[GIT_OID_HEXSZ] = '\0';
+		return QByteArray(str);
+	}
+
+	/* create an empty repository in dir */
+	static bool init_repository(const QTemporaryDir &dir)
+	{
+		git_repository *init_repo = nullptr;
+		if (git_repository_init(&init_repo, QFile::encodeName(dir.path()).constData(), 0) != 0)
+			return false;
+
+		git_repository_free(init_repo);
+		return true;
+	}
+
+	/* write the packed-refs file of the repository in dir */
+	static bool write_packed_refs(const QTemporaryDir &dir, const QByteArray &packed_refs)
+	{
+		QFile packed_refs_file(dir.filePath(".git/packed-refs"));
+		if (!packed_refs_file.open(QIODevice::WriteOnly))
+			return false;
+
+		return packed_refs_file.write(packed_refs) == packed_refs.size();
+	}
+
+	/* write a commit of the tree to the object database */
+	static bool write_commit(const git::odb &odb, const git_oid &tree_id, const QByteArray &message, git_oid &commit_id)
+	{
+		const QByteArray commit_data = "tree " + oid_hex(tree_id) + "\n"
+				"author A <a@example.com> 0 +0000\n"
+				"committer A <a@example.com> 0 +0000\n"
+				"\n" + message + "\n";
+		return git_odb_write(&commit_id, odb._ptr(), commit_data.constData(), commit_data.size(), GIT_OBJ_COMMIT) == 0;
+	}
+
+	git::git_library_lock lock;
+	QTemporaryDir repo_dir;
+	std::unique_ptr<git::repository> repo;
+	std::unique_ptr<ref_map> refs;
+
+private slots:
+	/* create a repository holding only packed branches, so no objects are needed */
+	void initTestCase()
+	{
+		QVERIFY(repo_dir.isValid());
+		QVERIFY(init_repository(repo_dir));
+
+		QByteArray packed_refs("# pack-refs with: peeled fully-peeled sorted \n");
+		for (const char *name : pattern_test_refs)
+			packed_refs.append(OID_A " ").append(name).append("\n");
+		QVERIFY(write_packed_refs(repo_dir, packed_refs));
+
+		repo.reset(new git::repository(QFile::encodeName(repo_dir.path()).constData()));
+		refs.reset(new ref_map(*repo));
+		QCOMPARE(refs->refs.size(), sizeof(pattern_test_refs) / sizeof(pattern_test_refs[0]));
+	}
+
+	/* define the packed-refs test cases */
+	void test_parse_packed_refs_data()
+	{
+		QTest::addColumn<QByteArray>("data");
+		QTest::addColumn<QStringList>("expected");
+
+		QTest::newRow("empty") << QByteArray() << QStringList();
+
+		/* without a header only the tags followed by a "^" line are known to be peeled */
+		QTest::newRow("no_header") << QByteArray(
+				OID_A " refs/heads/main\n"
+				OID_B " refs/tags/v1.0\n"
+				"^" OID_C "\n"
+				OID_A " refs/tags/light\n")
+			<< QStringList({
+				"refs/heads/main " OID_A " unpeeled",
+				"refs/tags/v1.0 " OID_C " peeled",
+				"refs/tags/light " OID_A " unpeeled",
+			});
+
+		/* "peeled" covers the tags only, "fully-peeled" covers every ref */
+		QTest::newRow("peeled") << QByteArray(
+				"# pack-refs with: peeled sorted \n"
+				OID_A " refs/heads/main\n"
+				OID_A " refs/tags/light\n"
+				OID_B " refs/tags/v1.0\n"
+				"^" OID_C "\n")
+			<< QStringList({
+				"refs/heads/main " OID_A " unpeeled",
+				"refs/tags/light " OID_A " peeled",
+				"refs/tags/v1.0 " OID_C " peeled",
+			});
+
+		QTest::newRow("fully_peeled") << QByteArray(
+				"# pack-refs with: peeled fully-peeled sorted \n"
+				OID_A " refs/heads/main\n"
+				OID_D " refs/remotes/origin/main\n")
+			<< QStringList({
+				"refs/heads/main " OID_A " peeled",
+				"refs/remotes/origin/main " OID_D " peeled",
+			});
+
+		/* the trait has to be a whole word */
+		QTest::newRow("unknown_traits") << QByteArray(
+				"# pack-refs with: unpeeled fully-peeled-ish\n"
+				OID_A " refs/tags/light\n")
+			<< QStringList({ "refs/tags/light " OID_A " unpeeled" });
+
+		QTest::newRow("no_trailing_newline") << QByteArray(
+				OID_A " refs/heads/main\n"
+				OID_B " refs/heads/last")
+			<< QStringList({
+				"refs/heads/main " OID_A " unpeeled",
+				"refs/heads/last " OID_B " unpeeled",
+			});
+
+		QTest::newRow("no_trailing_newline_after_peeled") << QByteArray(
+				OID_B " refs/tags/v1.0\n"
+				"^" OID_C)
+			<< QStringList({ "refs/tags/v1.0 " OID_C " peeled" });
+
+		/* a bad line is skipped along with any "^" line following it */
+		QTest::newRow("malformed") << QByteArray(
+				"\n"
+				"1111 refs/heads/short\n"
+				OID_A "refs/heads/no_space\n"
+				"zzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzz refs/heads/not_hex\n"
+				"^" OID_C "\n"
+				OID_A "\n"
+				OID_A " \n"
+				OID_B " refs/tags/v1.0\n"
+				"^1234\n"
+				OID_D " refs/heads/good\n")
+			<< QStringList({
+				"refs/tags/v1.0 " OID_B " unpeeled",
+				"refs/heads/good " OID_D " unpeeled",
+			});
+
+		QTest::newRow("peeled_without_ref") << QByteArray(
+				"^" OID_C "\n"
+				OID_A " refs/heads/main\n")
+			<< QStringList({ "refs/heads/main " OID_A " unpeeled" });
+	}
+
+	/* parse the packed-refs contents and compare the refs that were found */
+	void test_parse_packed_refs()
+	{
+		QFETCH(QByteArray, data);
+		QFETCH(QStringList, expected);
+
+		QCOMPARE(parse(data), expected);
+	}
+
+	/* peeled packed tags are kept only when they point at a commit, which is found without creating any objects */
+	void test_peeled_tags()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QVERIFY(init_repository(dir));
+
+		git::repository tag_repo(QFile::encodeName(dir.path()).constData());
+		const git::odb odb = tag_repo.odb();
+		git_oid tree_id, blob_id, commit_id;
+		QCOMPARE(git_odb_write(&tree_id, odb._ptr(), "", 0, GIT_OBJ_TREE), 0);
+		QCOMPARE(git_odb_write(&blob_id, odb._ptr(), "blob\n", 5, GIT_OBJ_BLOB), 0);
+		QVERIFY(write_commit(odb, tree_id, "commit", commit_id));
+
+		const QByteArray commit_hex = oid_hex(commit_id);
+		QVERIFY(write_packed_refs(dir, "# pack-refs with: peeled fully-peeled sorted \n"
+				+ commit_hex + " refs/heads/main\n"
+				OID_A " refs/tags/annotated\n"
+				"^" + commit_hex + "\n"
+				+ oid_hex(blob_id) + " refs/tags/blob\n"
+				+ commit_hex + " refs/tags/commit\n"
+				OID_B " refs/tags/missing\n"
+				+ oid_hex(tree_id) + " refs/tags/tree\n"));
+
+		/* libgit2 keeps the commits and trees it parses in its cache */
+		const size_t cached_memory = git::cached_memory();
+		ref_map tag_refs(tag_repo);
+		QCOMPARE(git::cached_memory(), cached_memory);
+
+		QStringList names;
+		for (const ref_map::ref &ref : tag_refs.refs) {
+			names.append(QString::fromUtf8(ref.name));
+			QVERIFY(git_oid_equal(&ref.target, &commit_id));
+		}
+
+		QCOMPARE(names, QStringList({ "refs/heads/main", "refs/tags/annotated", "refs/tags/commit" }));
+	}
+
+	/* loads a repository with many peeled packed tags, each pointing at its own commit */
+	void benchmark_peeled_tags()
+	{
+		QTemporaryDir dir;
+		QVERIFY(dir.isValid());
+		QVERIFY(init_repository(dir));
+
+		git::repository tag_repo(QFile::encodeName(dir.path()).constData());
+		const git::odb odb = tag_repo.odb();
+		git_oid tree_id;
+		QCOMPARE(git_odb_write(&tree_id, odb._ptr(), "", 0, GIT_OBJ_TREE), 0);
+
+		const size_t num_tags = 2000;
+		QByteArray packed_refs("# pack-refs with: peeled fully-peeled sorted \n");
+		for (size_t i = 0; i < num_tags; i++) {
+			const QByteArray name = "v" + QByteArray::number((qulonglong)(num_tags + i));
+			git_oid commit_id;
+			QVERIFY(write_commit(odb, tree_id, name, commit_id));
+			packed_refs.append(oid_hex(commit_id)).append(" refs/tags/").append(name).append("\n");
+		}
+		QVERIFY(write_packed_refs(dir, packed_refs));
+
+		QBENCHMARK {
+			ref_map tag_refs(tag_repo);
+			QCOMPARE(tag_refs.refs.size(), num_tags);
+		}
+	}
+
+	/* define the name order test cases */
+	void test_name_less_data()
+	{
+		QTest::addColumn<QString>("lhs");
+		QTest::addColumn<QString>("rhs");
+		QTest::addColumn<bool>("expected");
+
+		/* '/' comes before every other character, the rest are compared as bytes */
+		QTest::newRow("slash_dash") << "a/b" << "a-b" << true;
+		QTest::newRow("dash_slash") << "a-b" << "a/b" << false;
+		QTest::newRow("dash_dot") << "a-b" << "a.b" << true;
+		QTest::newRow("dot_dash") << "a.b" << "a-b" << false;
+		QTest::newRow("slash_dot") << "a/b" << "a.b" << true;
+		QTest::newRow("slash_space") << "a/b" << "a b" << true;
+		QTest::newRow("nested_slash_dash") << "refs/heads/feature/x" << "refs/heads/feature-2" << true;
+
+		/* a prefix is ordered before the longer names, including those continuing with '/' */
+		QTest::newRow("prefix_slash") << "a" << "a/b" << true;
+		QTest::newRow("slash_prefix") << "a/b" << "a" << false;
+		QTest::newRow("prefix_dash") << "a" << "a-b" << true;
+		QTest::newRow("prefix_empty") << "" << "a" << true;
+
+		QTest::newRow("equal") << "a/b" << "a/b" << false;
+		QTest::newRow("empty") << "" << "" << false;
+
+		/* bytes above 0x7f are compared unsigned */
+		QTest::newRow("non_ascii") << "a/z" << QString::fromUtf8("a/\xc3\xa9") << true;
+		QTest::newRow("non_ascii_reverse") << QString::fromUtf8("a/\xc3\xa9") << "a/z" << false;
+	}
+
+	/* compare the two names */
+	void test_name_less()
+	{
+		QFETCH(QString, lhs);
+		QFETCH(QString, rhs);
+		QFETCH(bool, expected);
+
+		QCOMPARE(ref_map::name_less(lhs.toUtf8().constData(), rhs.toUtf8().constData()), expected);
+	}
+
+	/* sorting with name_less keeps the names in a directory together */
+	void test_name_less_sort()
+	{
+		std::vector<std::string> names = { "b", "a.b", "a/c", "a-b", "a", "ab", "a/b/c", "a/b" };
+		std::sort(names.begin(), names.end(), [] (const std::string &lhs, const std::string &rhs) {
+			return ref_map::name_less(lhs.c_str(), rhs.c_str());
+		});
+
+		QVERIFY(names == std::vector<std::string>({ "a", "a/b", "a/b/c", "a/c", "a-b", "a.b", "ab", "b" }));
+	}
+
+	/* define the glob test cases */
+	void test_glob_match_data()
+	{
+		QTest::addColumn<QString>("pattern");
+		QTest::addColumn<QString>("name");
+		QTest::addColumn<bool>("expected");
+
+		QTest::newRow("star_dir") << "refs/remotes/*/release-*" << "refs/remotes/origin/release-1.0" << true;
+		QTest::newRow("star_dir_nested") << "refs/remotes/*/release-*" << "refs/remotes/origin/feature/release-3" << false;
+		QTest::newRow("star_dir_trailing") << "refs/remotes/*/release-*" << "refs/remotes/origin/release-2.0/fix" << false;
+		QTest::newRow("star_empty") << "refs/heads/main*" << "refs/heads/main" << true;
+		QTest::newRow("star_slash") << "refs/*" << "refs/heads/main" << false;
+		QTest::newRow("double_star") << "refs/**" << "refs/remotes/origin/main" << true;
+		QTest::newRow("double_star_middle") << "refs/**/main" << "refs/remotes/origin/main" << true;
+		QTest::newRow("double_star_suffix") << "refs/**/main" << "refs/remotes/origin/main2" << false;
+		QTest::newRow("question") << "refs/heads/?" << "refs/heads/x" << true;
+		QTest::newRow("question_long") << "refs/heads/?" << "refs/heads/xy" << false;
+		QTest::newRow("question_slash") << "refs/heads?x" << "refs/heads/x" << false;
+		QTest::newRow("class") << "refs/heads/[a-cx]" << "refs/heads/x" << true;
+		QTest::newRow("class_miss") << "refs/heads/[a-c]" << "refs/heads/x" << false;
+		QTest::newRow("negated_class") << "refs/heads/[!x]" << "refs/heads/y" << true;
+		QTest::newRow("negated_class_miss") << "refs/heads/[!x]" << "refs/heads/x" << false;
+		QTest::newRow("negated_class_slash") << "refs/heads[!x]x" << "refs/heads/x" << false;
+		QTest::newRow("class_bracket") << "refs/heads/[]]" << "refs/heads/]" << true;
+		QTest::newRow("unclosed_class") << "refs/heads/[abc" << "refs/heads/[abc" << true;
+		QTest::newRow("unclosed_class_miss") << "refs/heads/[abc" << "refs/heads/a" << false;
+		QTest::newRow("escape") << "refs/heads/v\\*" << "refs/heads/v*" << true;
+		QTest::newRow("escape_miss") << "refs/heads/v\\*" << "refs/heads/v1" << false;
+		QTest::newRow("partial") << "refs/heads/mai" << "refs/heads/main" << false;
+	}
+
+	/* match the name against the pattern */
+	void test_glob_match()
+	{
+		QFETCH(QString, pattern);
+		QFETCH(QString, name);
+		QFETCH(bool, expected);
+
+		QCOMPARE(ref_map::glob_match(pattern.toUtf8().constData(), name.toUtf8().constData()), expected);
+	}
+
+	/* define the test cases for activating the refs matching a pattern */
+	void test_set_refs_active_matching_data()
+	{
+		QTest::addColumn<QString>("pattern");
+		QTest::addColumn<ref_pattern_syntax>("syntax");
+		QTest::addColumn<QStringList>("expected");
+
+		QTest::newRow("remote_releases") << "refs/remotes/*/release-*" << ref_pattern_syntax::GLOB
+			<< QStringList({ "refs/remotes/origin/release-1.0", "refs/remotes/upstream/release-2.0" });
+
+		QStringList all_refs;
+		for (const char *name : pattern_test_refs)
+			all_refs.append(name);
+		QTest::newRow("double_star") << "refs/**" << ref_pattern_syntax::GLOB << all_refs;
+
+		QTest::newRow("double_star_remotes") << "refs/remotes/**" << ref_pattern_syntax::GLOB
+			<< QStringList({
+				"refs/remotes/origin/feature/release-3",
+				"refs/remotes/origin/main",
+				"refs/remotes/origin/release-1.0",
+				"refs/remotes/origin/release-2.0/fix",
+				"refs/remotes/upstream/release-2.0",
+			});
+
+		/* the literal prefix ends right before a '/', which is ordered before every other character */
+		QTest::newRow("prefix_before_slash") << "refs/heads/feature*" << ref_pattern_syntax::GLOB
+			<< QStringList({ "refs/heads/feature-2", "refs/heads/featured" });
+		QTest::newRow("prefix_with_slash") << "refs/heads/feature/*" << ref_pattern_syntax::GLOB
+			<< QStringList({ "refs/heads/feature/x" });
+
+		QTest::newRow("negated_class") << "refs/heads/[!x]" << ref_pattern_syntax::GLOB
+			<< QStringList({ "refs/heads/y" });
+		QTest::newRow("unclosed_class") << "refs/heads/[x" << ref_pattern_syntax::GLOB << QStringList();
+		QTest::newRow("literal") << "refs/heads/main" << ref_pattern_syntax::GLOB
+			<< QStringList({ "refs/heads/main" });
+		QTest::newRow("literal_partial") << "refs/heads/mai" << ref_pattern_syntax::GLOB << QStringList();
+
+		QTest::newRow("regex") << "release-[0-9]+\\.0$" << ref_pattern_syntax::REGEX
+			<< QStringList({
+				"refs/heads/release-1.0",
+				"refs/remotes/origin/release-1.0",
+				"refs/remotes/upstream/release-2.0",
+			});
+	}
+
+	/* activate only the refs matching the pattern and compare the active refs */
+	void test_set_refs_active_matching()
+	{
+		QFETCH(QString, pattern);
+		QFETCH(ref_pattern_syntax, syntax);
+		QFETCH(QStringList, expected);
+
+		refs->set_refs_active(0, refs->refs.size(), false);
+		QCOMPARE(refs->set_refs_active_matching(pattern.toStdString(), syntax, true), (size_t)expected.size());
+		QCOMPARE(refs->count_active_refs(0, refs->refs.size()), (size_t)expected.size());
+		QCOMPARE(active_ref_names(), expected);
+
+		/* de-activating the same pattern leaves nothing active */
+		refs->set_refs_active_matching(pattern.toStdString(), syntax, false);
+		QCOMPARE(refs->count_active_refs(0, refs->refs.size()), (size_t)0);
+	}
+
+	/* an invalid regular expression is reported instead of matching nothing */
+	void test_set_refs_active_matching_invalid()
+	{
+		bool thrown = false;
+		try {
+			refs->set_refs_active_matching("release-(", ref_pattern_syntax::REGEX, true);
+		} catch (const reef_error &) {
+			thrown = true;
+		}
+
+		QVERIFY(thrown);
+	}
+};
+
+QTEST_MAIN(test_ref_map)
+#include "test_ref_map.moc"
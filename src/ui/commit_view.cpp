@@ -0,0 +1,357 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+#include <QFontMetrics>
+#include <QPainter>
+#include <QScrollBar>
+
+#include "util/trace.h"
+
+#include "commit_view.h"
+
+/* the space between the edges of a column and its text */
+constexpr int text_margin = 4;
+
+/* the space above and below the text of a row */
+constexpr int row_padding = 2;
+
+/* the starting and smallest widths of the graph and refs columns */
+constexpr int default_column_width = 150;
+constexpr int min_column_width = 20;
+
+/* the distance from the line between two columns within which it can be dragged */
+constexpr int column_edge_grab_distance = 3;
+
+commit_view::commit_view(QWidget *parent) :
+	QAbstractScrollArea(parent),
+	column_widths{ default_column_width, default_column_width }
+{
+	const QFontMetrics metrics(font());
+	row_h = std::max(metrics.height() + row_padding * 2, 1);
+
+	setFocusPolicy(Qt::StrongFocus);
+	viewport()->setMouseTracking(true);
+	horizontalScrollBar()->setRange(0, 0);
+
+	update_scroll_bar();
+}
+
+void commit_view::set_controller(const repository_controller *repo_ctrl)
+{
+	set_num_rows(0);
+	this->repo_ctrl = repo_ctrl;
+}
+
+void commit_view::set_first_lane(int lane)
+{
+	gpainter.set_first_lane(lane);
+	viewport()->update();
+}
+
+void commit_view::set_num_rows(uint64_t new_num_rows)
+{
+	/* rows are only ever removed all at once, when the commits are reloaded */
+	const bool rows_removed = new_num_rows < num_rows;
+	num_rows = new_num_rows;
+
+	if (rows_removed) {
+		selection.clear();
+		first_row = 0;
+		anchor = 0;
+	}
+
+	update_scroll_bar();
+	viewport()->update();
+
+	if (rows_removed && current >= 0) {
+		current = -1;
+		emit current_row_changed(current);
+	}
+}
+
+uint64_t commit_view::num_visible_rows() const
+{
+	return std::max(viewport()->height() / row_h, 1);
+}
+
+uint64_t commit_view::max_first_row() const
+{
+	return num_rows > num_visible_rows() ? num_rows - num_visible_rows() : 0;
+}
+
+void commit_view::update_scroll_bar()
+{
+	const uint64_t max_row = max_first_row();
+	first_row = std::min(first_row, max_row);
+
+	/* past INT_MAX rows each step of the scroll bar covers several rows */
+	const int max_value = static_cast<int>(std::min(max_row, uint64_t(INT_MAX)));
+	const int value = max_row <= uint64_t(INT_MAX) ? static_cast<int>(first_row) :
+			static_cast<int>(static_cast<long double>(first_row) * max_value / max_row);
+
+	updating_scroll_bar = true;
+	verticalScrollBar()->setRange(0, max_value);
+	verticalScrollBar()->setPageStep(static_cast<int>(std::min(num_visible_rows(), uint64_t(INT_MAX))));
+	verticalScrollBar()->setSingleStep(1);
+	verticalScrollBar()->setValue(value);
+	updating_scroll_bar = false;
+}
+
+void commit_view::scroll_to_row(uint64_t row)
+{
+	const uint64_t visible_rows = num_visible_rows();
+	if (row < first_row)
+		first_row = row;
+	else if (row >= first_row + visible_rows)
+		first_row = row - visible_rows + 1;
+	else
+		return;
+
+	update_scroll_bar();
+	viewport()->update();
+}
+
+int64_t commit_view::row_at(int y) const
+{
+	if (y < 0)
+		return -1;
+
+	const uint64_t row = first_row + y / row_h;
+	return row < num_rows ? static_cast<int64_t>(row) : -1;
+}
+
+/* returns the column whose right edge is at x, or -1 */
+int commit_view::column_edge_at(int x) const
+{
+	int edge = 0;
+	for (int i = 0; i < 2; i++) {
+		edge += column_widths[i];
+		if (std::abs(x - edge) <= column_edge_grab_distance)
+			return i;
+	}
+
+	return -1;
+}
+
+/* moves the current row to row, extending or toggling the selection like a list view does */
+void commit_view::select_row(uint64_t row, Qt::KeyboardModifiers modifiers)
+{
+	if (modifiers & Qt::ShiftModifier) {
+		selection.clear();
+		selection.insert(std::min(anchor, row), std::max(anchor, row) + 1);
+	} else if (modifiers & Qt::ControlModifier) {
+		if (selection.contains(row))
+			selection.erase(row, row + 1);
+		else
+			selection.insert(row, row + 1);
+		anchor = row;
+	} else {
+		selection.clear();
+		selection.insert(row, row + 1);
+		anchor = row;
+	}
+
+	scroll_to_row(row);
+	viewport()->update();
+
+	if (current != static_cast<int64_t>(row)) {
+		current = row;
+		emit current_row_changed(current);
+	}
+}
+
+void commit_view::paintEvent(QPaintEvent *event)
+{
+	TRACE_SCOPE("commit_view::paintEvent");
+
+	(void) event;
+
+	if (!repo_ctrl || num_rows == 0)
+		return;
+
+	QPainter painter(viewport());
+	painter.setFont(font());
+
+	const QPalette &pal = palette();
+	const int width = viewport()->width();
+	const int refs_x = column_widths[0];
+	const int summary_x = refs_x + column_widths[1];
+	const int text_y = row_padding + painter.fontMetrics().ascent();
+
+	const uint64_t end_row = std::min(first_row + viewport()->height() / row_h + 1, num_rows);
+
+	for (uint64_t row = first_row; row < end_row; row++) {
+		const repository_controller::commit_row commit = repo_ctrl->get_commit_row(row);
+		const int y = (row - first_row) * row_h;
+
+		if (selection.contains(row)) {
+			painter.fillRect(0, y, width, row_h, pal.color(QPalette::Highlight));
+			painter.setPen(pal.color(QPalette::HighlightedText));
+		} else {
+			painter.setPen(pal.color(QPalette::Text));
+		}
+
+		gpainter.paint(&painter, QRect(0, y, column_widths[0], row_h), commit.graph);
+
+		/* the text is cut off at the end of its column rather than elided, which would have to measure it */
+		painter.setClipRect(QRect(refs_x + text_margin, y, column_widths[1] - text_margin * 2, row_h));
+		painter.drawText(refs_x + text_margin, y + text_y, *commit.refs);
+		painter.setClipRect(QRect(summary_x + text_margin, y, width - summary_x - text_margin * 2, row_h));
+		painter.drawText(summary_x + text_margin, y + text_y, *commit.summary);
+		painter.setClipping(false);
+
+		if (current == static_cast<int64_t>(row) && hasFocus()) {
+			painter.setPen(pal.color(QPalette::Highlight));
+			painter.drawRect(0, y, width - 1, row_h - 1);
+		}
+	}
+
+	/* the lines between the columns, which are dragged to resize them */
+	painter.setPen(pal.color(QPalette::Mid));
+	painter.drawLine(refs_x, 0, refs_x, viewport()->height());
+	painter.drawLine(summary_x, 0, summary_x, viewport()->height());
+}
+
+void commit_view::resizeEvent(QResizeEvent *event)
+{
+	QAbstractScrollArea::resizeEvent(event);
+	update_scroll_bar();
+}
+
+void commit_view::scrollContentsBy(int dx, int dy)
+{
+	(void) dx;
+	(void) dy;
+
+	if (updating_scroll_bar)
+		return;
+
+	const uint64_t max_row = max_first_row();
+	const int value = verticalScrollBar()->value();
+	const int max_value = verticalScrollBar()->maximum();
+	if (max_row <= uint64_t(INT_MAX) || max_value == 0)
+		first_row = value;
+	else
+		first_row = static_cast<uint64_t>(static_cast<long double>(value) * max_row / max_value);
+
+	viewport()->update();
+}
+
+void commit_view::mousePressEvent(QMouseEvent *event)
+{
+	if (event->button() != Qt::LeftButton) {
+		QAbstractScrollArea::mousePressEvent(event);
+		return;
+	}
+
+	resizing_column = column_edge_at(event->pos().x());
+	if (resizing_column >= 0)
+		return;
+
+	const int64_t row = row_at(event->pos().y());
+	if (row >= 0)
+		select_row(row, event->modifiers());
+}
+
+void commit_view::mouseMoveEvent(QMouseEvent *event)
+{
+	const int x = event->pos().x();
+
+	if (resizing_column >= 0) {
+		const int column_x = resizing_column == 0 ? 0 : column_widths[0];
+		column_widths[resizing_column] = std::max(x - column_x, min_column_width);
+		viewport()->update();
+
+		if (resizing_column == 0)
+			emit graph_column_resized();
+		return;
+	}
+
+	if (event->buttons() & Qt::LeftButton) {
+		/* dragging extends the selection from the row the drag started on */
+		const int y = std::max(std::min(event->pos().y(), viewport()->height() - 1), 0);
+		const int64_t row = row_at(y);
+		if (row >= 0)
+			select_row(row, Qt::ShiftModifier);
+		return;
+	}
+
+	if (column_edge_at(x) >= 0)
+		viewport()->setCursor(Qt::SplitHCursor);
+	else
+		viewport()->unsetCursor();
+}
+
+void commit_view::mouseReleaseEvent(QMouseEvent *event)
+{
+	(void) event;
+
+	resizing_column = -1;
+}
+
+void commit_view::keyPressEvent(QKeyEvent *event)
+{
+	if (num_rows == 0) {
+		QAbstractScrollArea::keyPressEvent(event);
+		return;
+	}
+
+	const uint64_t row = current >= 0 ? current : 0;
+	const uint64_t last_row = num_rows - 1;
+	const uint64_t page = std::max(num_visible_rows() - 1, uint64_t(1));
+
+	/* only the shift modifier is passed on, so that moving with the keys never toggles rows */
+	const Qt::KeyboardModifiers modifiers = event->modifiers() & Qt::ShiftModifier;
+
+	switch (event->key()) {
+	case Qt::Key_Up:
+		select_row(row > 0 ? row - 1 : 0, modifiers);
+		break;
+	case Qt::Key_Down:
+		select_row(current >= 0 ? std::min(row + 1, last_row) : 0, modifiers);
+		break;
+	case Qt::Key_PageUp:
+		select_row(row > page ? row - page : 0, modifiers);
+		break;
+	case Qt::Key_PageDown:
+		select_row(std::min(row + page, last_row), modifiers);
+		break;
+	case Qt::Key_Home:
+		select_row(0, modifiers);
+		break;
+	case Qt::Key_End:
+		select_row(last_row, modifiers);
+		break;
+	case Qt::Key_A:
+		if (event->modifiers() & Qt::ControlModifier) {
+			selection.clear();
+			selection.insert(0, num_rows);
+			viewport()->update();
+			break;
+		}
+		QAbstractScrollArea::keyPressEvent(event);
+		break;
+	default:
+		QAbstractScrollArea::keyPressEvent(event);
+		break;
+	}
+}
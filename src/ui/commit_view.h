@@ -0,0 +1,149 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMIT_VIEW_H
+#define COMMIT_VIEW_H
+
+#include <cstdint>
+
+#include <QAbstractScrollArea>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QPaintEvent>
+#include <QResizeEvent>
+
+#include "controller/repository_controller.h"
+#include "util/range_set.h"
+
+#include "graph_painter.h"
+
+/*!
+ * \class commit_view
+ * \brief View of the commit table which paints the visible rows straight from the controller
+ *
+ * Every row has the same height and rows are addressed with 64 bit indices,
+ * so the cost of scrolling does not depend on the number of commits. When
+ * there are more rows than the scroll bar can count, each step of the
+ * scroll bar covers several rows. The selection is kept as a set of ranges
+ * of rows, and the columns are resized by dragging the lines between them.
+ */
+class commit_view : public QAbstractScrollArea
+{
+	Q_OBJECT
+
+public:
+	commit_view(QWidget *parent = nullptr);
+
+	/*!
+	 * \brief Set the controller the rows are read from, clearing the rows and the selection
+	 * \param repo_ctrl The controller, or nullptr to show nothing
+	 */
+	void set_controller(const repository_controller *repo_ctrl);
+
+	/*!
+	 * \brief Get the row the selection was last moved to
+	 * \return The index of the row, or -1 if there is none
+	 */
+	int64_t current_row() const
+	{
+		return current;
+	}
+
+	/*!
+	 * \brief Get the height of every row
+	 * \return The height in pixels
+	 */
+	int row_height() const
+	{
+		return row_h;
+	}
+
+	/*!
+	 * \brief Get the width of the graph column
+	 * \return The width in pixels
+	 */
+	int graph_column_width() const
+	{
+		return column_widths[0];
+	}
+
+	/*!
+	 * \brief Set the first lane of the graph to paint, lanes to the left of it are scrolled out of view
+	 * \param lane The index of the first visible lane
+	 */
+	void set_first_lane(int lane);
+
+	/*!
+	 * \brief Estimate the memory held to paint the rows
+	 * \return The bytes held by the graph painter and the number of rows it has cached
+	 */
+	memory_usage get_memory_usage() const
+	{
+		return gpainter.get_memory_usage();
+	}
+
+public slots:
+	/*!
+	 * \brief Update the number of rows, the selection is cleared if rows were removed
+	 * \param num_rows The number of rows the controller has
+	 */
+	void set_num_rows(uint64_t num_rows);
+
+signals:
+	void current_row_changed(int64_t row);
+	void graph_column_resized();
+
+protected:
+	void paintEvent(QPaintEvent *event) override;
+	void resizeEvent(QResizeEvent *event) override;
+	void scrollContentsBy(int dx, int dy) override;
+	void mousePressEvent(QMouseEvent *event) override;
+	void mouseMoveEvent(QMouseEvent *event) override;
+	void mouseReleaseEvent(QMouseEvent *event) override;
+	void keyPressEvent(QKeyEvent *event) override;
+
+private:
+	const repository_controller *repo_ctrl = nullptr;
+	uint64_t num_rows = 0;
+	int row_h;
+
+	/* the widths of the graph and refs columns, the summary takes the rest */
+	int column_widths[2];
+	int resizing_column = -1;
+
+	/* the first row on screen is kept here rather than read back from the scroll bar,
+	 * which cannot hold every row index when there are too many rows */
+	uint64_t first_row = 0;
+	bool updating_scroll_bar = false;
+
+	range_set selection;
+	int64_t current = -1;
+	uint64_t anchor = 0;
+
+	graph_painter gpainter;
+
+	uint64_t num_visible_rows() const;
+	uint64_t max_first_row() const;
+	void update_scroll_bar();
+	void scroll_to_row(uint64_t row);
+	int64_t row_at(int y) const;
+	int column_edge_at(int x) const;
+	void select_row(uint64_t row, Qt::KeyboardModifiers modifiers);
+};
+
+#endif /* COMMIT_VIEW_H */
@@ -16,13 +16,13 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include "deselectable_list_view.h"
+#include "deselectable_tree_view.h"
 
-deselectable_list_view::deselectable_list_view(QWidget *parent) :
-	QListView(parent)
+deselectable_tree_view::deselectable_tree_view(QWidget *parent) :
+	QTreeView(parent)
 { }
 
-void deselectable_list_view::mousePressEvent(QMouseEvent *event)
+void deselectable_tree_view::mousePressEvent(QMouseEvent *event)
 {
 	QPoint pos = event->pos();
 	QPersistentModelIndex index = indexAt(pos);
@@ -31,6 +31,6 @@ void deselectable_list_view::mousePressEvent(QMouseEvent *event)
 		model->clearCurrentIndex();
 		model->clearSelection();
 	} else {
-		QListView::mousePressEvent(event);
+		QTreeView::mousePressEvent(event);
 	}
 }
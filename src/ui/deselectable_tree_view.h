@@ -16,23 +16,23 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#ifndef DESELECTABLE_LIST_VIEW_H
-#define DESELECTABLE_LIST_VIEW_H
+#ifndef DESELECTABLE_TREE_VIEW_H
+#define DESELECTABLE_TREE_VIEW_H
 
-#include <QListView>
+#include <QTreeView>
 #include <QMouseEvent>
 
 /*!
- * \class deselectable_list_view
- * \brief Custom version of QListView which deselects rows when an already selected row is clicked again
+ * \class deselectable_tree_view
+ * \brief Custom version of QTreeView which deselects rows when an already selected row is clicked again
  */
-class deselectable_list_view : public QListView
+class deselectable_tree_view : public QTreeView
 {
 	Q_OBJECT
 
 public:
-	deselectable_list_view(QWidget* parent);
+	deselectable_tree_view(QWidget* parent);
 	void mousePressEvent(QMouseEvent *e) override;
 };
 
-#endif /* DESELECTABLE_LIST_VIEW_H */
+#endif /* DESELECTABLE_TREE_VIEW_H */
@@ -1,31 +0,0 @@
-/*
- * Reef - Cross Platform Git Client
- * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
- *
- * This program is free software: you can redistribute it and/or modify
- * it under the terms of the GNU General Public License as published by
- * the Free Software Foundation, either version 3 of the License, or
- * (at your option) any later version.
- *
- * This program is distributed in the hope that it will be useful,
- * but WITHOUT ANY WARRANTY; without even the implied warranty of
- * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
- * GNU General Public License for more details.
- *
- * You should have received a copy of the GNU General Public License
- * along with this program.  If not, see <https://www.gnu.org/licenses/>.
- */
-
-#ifndef GRAPH_DELEGATE_H
-#define GRAPH_DELEGATE_H
-
-#include <QPainter>
-#include <QStyledItemDelegate>
-
-class graph_delegate : public QStyledItemDelegate
-{
-public:
-	void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const override;
-};
-
-#endif /* GRAPH_DELEGATE_H */
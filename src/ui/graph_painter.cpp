@@ -0,0 +1,230 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "core/graph.h"
+#include "util/preferences.h"
+#include "util/trace.h"
+
+#include "graph_painter.h"
+
+const QColor graph_colors[] = {
+	QColor(0, 0, 0),
+	QColor(128, 0, 0),
+	QColor(0, 128, 0),
+	QColor(0, 0, 128),
+	QColor(128, 128, 0),
+	QColor(128, 0, 128),
+	QColor(0, 128, 128)
+};
+
+constexpr int num_graph_colors = sizeof(graph_colors) / sizeof(graph_colors[0]);
+
+/* every combination of the line flags, then the two marks */
+constexpr int num_graph_shapes = 18;
+
+/* width to height ratio for the characters */
+constexpr qreal character_aspect_ratio = 0.5;
+
+/* width of the pen strokes */
+constexpr qreal stroke_width = 1.0;
+
+/* number of characters used to draw each lane */
+constexpr int lane_length = 2;
+
+/* the column of the atlas a character is painted in */
+static int shape_index(unsigned char flags)
+{
+	switch (flags) {
+	case G_MARK:
+		return 16;
+	case G_INITIAL:
+		return 17;
+	default:
+		return flags & (G_LEFT | G_RIGHT | G_UPPER | G_LOWER);
+	}
+}
+
+static void draw_shape(QPainter *painter, unsigned char flags, qreal width, qreal height)
+{
+	const qreal half_height = height / 2.0;
+	const qreal half_width = width / 2.0;
+	const qreal radius = (qreal)half_width / 2.0;
+
+	switch (flags) {
+	case G_MARK:
+		painter->drawEllipse(QPointF(half_width, half_height), radius, radius);
+		break;
+	case G_INITIAL:
+		painter->drawEllipse(QPointF(half_width, half_height), radius, radius);
+		break;
+	default:
+		if (flags & G_LEFT)
+			painter->drawLine(QPointF(0, half_height), QPointF(half_width, half_height));
+		if (flags & G_RIGHT)
+			painter->drawLine(QPointF(half_width, half_height), QPointF(width, half_height));
+		if (flags & G_UPPER)
+			painter->drawLine(QPointF(half_width, 0), QPointF(half_width, half_height));
+		if (flags & G_LOWER)
+			painter->drawLine(QPointF(half_width, half_height), QPointF(half_width, height));
+		break;
+	}
+}
+
+graph_painter::graph_painter() :
+	row_cache(std::max<int>(preferences::graph_row_cache_size / 1024, 1))
+{}
+
+void graph_painter::update_atlas(int height, qreal pixel_ratio)
+{
+	if (height == atlas_height && pixel_ratio == atlas_pixel_ratio)
+		return;
+
+	/* the cached rows were copied from the old atlas */
+	row_cache.clear();
+	atlas_height = height;
+	atlas_pixel_ratio = pixel_ratio;
+
+	/* each cell is a whole number of device pixels so that characters are copied without resampling */
+	const qreal width = height * character_aspect_ratio;
+	const int cell_width = (int)std::ceil(width * pixel_ratio);
+	const int cell_height = (int)std::ceil(height * pixel_ratio);
+
+	atlas = QPixmap(cell_width * num_graph_shapes, cell_height * num_graph_colors);
+	atlas.setDevicePixelRatio(pixel_ratio);
+	atlas.fill(Qt::transparent);
+
+	QPainter painter(&atlas);
+	QBrush brush(Qt::SolidPattern);
+	QPen pen(brush, stroke_width, Qt::SolidLine, Qt::FlatCap, Qt::MiterJoin);
+	painter.setBrush(brush);
+	painter.setRenderHint(QPainter::Antialiasing, true);
+
+	for (int color = 0; color < num_graph_colors; color++) {
+		pen.setColor(graph_colors[color]);
+		painter.setPen(pen);
+
+		for (unsigned int flags = G_EMPTY; flags <= G_INITIAL; flags++) {
+			painter.save();
+			painter.translate(shape_index(flags) * cell_width / pixel_ratio, color * cell_height / pixel_ratio);
+			draw_shape(&painter, flags, width, height);
+			painter.restore();
+		}
+	}
+}
+
+void graph_painter::draw_row(QPainter *painter, const graph_char *graph_str, size_t length, qreal width) const
+{
+	const int cell_width = (int)std::ceil(width * atlas_pixel_ratio);
+	const int cell_height = (int)std::ceil(atlas_height * atlas_pixel_ratio);
+	const QSizeF cell_size(cell_width / atlas_pixel_ratio, cell_height / atlas_pixel_ratio);
+
+	for (size_t i = 0; i < length; i++) {
+		if (graph_str[i].flags == G_EMPTY || graph_str[i].color >= num_graph_colors)
+			continue;
+
+		const QRectF source(shape_index(graph_str[i].flags) * cell_width, graph_str[i].color * cell_height,
+				cell_width, cell_height);
+		painter->drawPixmap(QRectF(QPointF(i * width, 0.0), cell_size), atlas, source);
+	}
+}
+
+void graph_painter::paint(QPainter *painter, const QRect &rect, span<const graph_char> graph)
+{
+	TRACE_SCOPE("graph_painter::paint");
+
+	const graph_char *graph_str = graph.data();
+	const size_t graph_len = graph.size();
+
+	/* calculate the sizes */
+	const qreal height = rect.height();
+	const qreal width = height * character_aspect_ratio;
+	const qreal pixel_ratio = painter->device()->devicePixelRatioF();
+
+	/* only paint the chars in the visible window of lanes */
+	const size_t window_begin = std::min((size_t)first_lane * lane_length, graph_len);
+	const size_t window_end = std::min(window_begin + (size_t)std::ceil(rect.width() / width), graph_len);
+	const size_t window_length = window_end - window_begin;
+	if (window_length == 0 || rect.height() <= 0)
+		return;
+
+	update_atlas(rect.height(), pixel_ratio);
+
+	/* save the painter settings so we can restore later */
+	painter->save();
+	painter->setClipRect(rect);
+	painter->translate(rect.x(), rect.y());
+
+	if (preferences::graph_row_cache_size == 0) {
+		draw_row(painter, graph_str + window_begin, window_length, width);
+		painter->restore();
+		return;
+	}
+
+	/* the rows are cached by the characters they show, the sizes are the same for every row,
+	 * the lookup reads the characters in place and only a row that is inserted copies them */
+	const QByteArray key = QByteArray::fromRawData(reinterpret_cast<const char *>(graph_str + window_begin),
+			window_length * sizeof(graph_char));
+	QPixmap *row = row_cache.object(key);
+	if (!row) {
+		const int row_width = (int)std::ceil(window_length * width * pixel_ratio);
+		const int row_height = (int)std::ceil(height * pixel_ratio);
+		row = new QPixmap(row_width, row_height);
+		row->setDevicePixelRatio(pixel_ratio);
+		row->fill(Qt::transparent);
+
+		QPainter row_painter(row);
+		draw_row(&row_painter, graph_str + window_begin, window_length, width);
+		row_painter.end();
+
+		/* the cost is in KiB like the size the cache was given, a row too big for it is deleted */
+		const int cost = std::max(row_width * row_height * 4 / 1024, 1);
+		if (!row_cache.insert(QByteArray(key.constData(), key.size()), row, cost)) {
+			draw_row(painter, graph_str + window_begin, window_length, width);
+			painter->restore();
+			return;
+		}
+	}
+
+	painter->drawPixmap(QPointF(0.0, 0.0), *row);
+
+	/* restore the painter settings */
+	painter->restore();
+}
+
+void graph_painter::set_first_lane(int lane)
+{
+	first_lane = std::max(lane, 0);
+}
+
+int graph_painter::lanes_in_width(int width, int height)
+{
+	if (height <= 0)
+		return 0;
+
+	return (int)(width / (height * character_aspect_ratio)) / lane_length;
+}
+
+memory_usage graph_painter::get_memory_usage() const
+{
+	/* the costs of the rows are in KiB, the pixmaps are 32 bits per pixel */
+	const size_t atlas_bytes = static_cast<size_t>(atlas.width()) * atlas.height() * 4;
+	return { "graph_row_cache", static_cast<size_t>(row_cache.totalCost()) * 1024 + atlas_bytes, static_cast<size_t>(row_cache.count()) };
+}
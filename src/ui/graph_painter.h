@@ -0,0 +1,89 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRAPH_PAINTER_H
+#define GRAPH_PAINTER_H
+
+#include <cstddef>
+
+#include <QByteArray>
+#include <QCache>
+#include <QPainter>
+#include <QPixmap>
+#include <QRect>
+
+#include "util/memory_usage.h"
+#include "util/span.h"
+
+struct graph_char;
+
+/*!
+ * \class graph_painter
+ * \brief Class painting the rows of the commit graph
+ *
+ * Every shape and colour a graph character can have is painted once into an
+ * atlas for the current row height and device pixel ratio, and rows are
+ * painted by copying characters out of it. Whole rows are also kept in a
+ * cache keyed by their characters, since the same row is often repeated.
+ */
+class graph_painter
+{
+public:
+	graph_painter();
+
+	/*!
+	 * \brief Paint a row of the graph
+	 * \param painter The painter to paint with
+	 * \param rect The cell to paint the row in, the characters are sized to fit its height
+	 * \param graph The characters of the row
+	 */
+	void paint(QPainter *painter, const QRect &rect, span<const graph_char> graph);
+
+	/*!
+	 * \brief Set the first lane of the graph to paint, lanes to the left of it are scrolled out of view
+	 * \param lane The index of the first visible lane
+	 */
+	void set_first_lane(int lane);
+
+	/*!
+	 * \brief Calculate the number of whole lanes that fit in a cell
+	 * \param width The width of the cell
+	 * \param height The height of the cell
+	 * \return The number of lanes
+	 */
+	static int lanes_in_width(int width, int height);
+
+	/*!
+	 * \brief Estimate the memory held by the atlas and the cached rows
+	 * \return The bytes held and the number of rows cached
+	 */
+	memory_usage get_memory_usage() const;
+
+private:
+	int first_lane = 0;
+
+	QPixmap atlas;
+	int atlas_height = 0;
+	qreal atlas_pixel_ratio = 0.0;
+	QCache<QByteArray, QPixmap> row_cache;
+
+	void update_atlas(int height, qreal pixel_ratio);
+	void draw_row(QPainter *painter, const graph_char *graph_str, size_t length, qreal width) const;
+};
+
+#endif /* GRAPH_PAINTER_H */
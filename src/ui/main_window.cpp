@@ -20,8 +20,12 @@
 #include "./ui_main_window.h"
 
 #include "compat/cpp_git.h"
+#include "util/error.h"
+
+#include <algorithm>
 
 #include <QFileDialog>
+#include <QScrollBar>
 
 main_window::main_window(QWidget *parent)
 	: QMainWindow(parent)
@@ -41,8 +45,17 @@ main_window::main_window(QWidget *parent)
 	connect(ui->action_close_repository, &QAction::triggered, this, &main_window::handle_close_repository);
 	connect(ui->action_exit, &QAction::triggered, qApp, QApplication::quit);
 	connect(ui->action_about, &QAction::triggered, this, &main_window::handle_about);
+	connect(ui->action_memory_usage, &QAction::triggered, this, &main_window::handle_memory_usage);
+	connect(ui->action_compact_graph, &QAction::toggled, this, &main_window::handle_compact_graph);
+	connect(ui->action_find_similar, &QAction::toggled, this, &main_window::handle_find_similar);
+	connect(ui->action_combined_diff, &QAction::toggled, this, &main_window::handle_combined_diff);
+
+	connect(ui->ref_pattern_show, &QPushButton::clicked, this, &main_window::handle_ref_pattern_show);
+	connect(ui->ref_pattern_hide, &QPushButton::clicked, this, &main_window::handle_ref_pattern_hide);
+	connect(ui->ref_pattern_edit, &QLineEdit::returnPressed, this, &main_window::handle_ref_pattern_show);
 
-	ui->commit_table->setItemDelegateForColumn(0, &gdelegate);
+	connect(ui->graph_scroll_bar, &QScrollBar::valueChanged, this, &main_window::handle_graph_scroll);
+	connect(ui->commit_table, &commit_view::graph_column_resized, this, &main_window::update_graph_scroll_bar);
 }
 
 main_window::~main_window()
@@ -60,11 +73,15 @@ void main_window::handle_open_repository()
 
 void main_window::handle_close_repository()
 {
-	ui->commit_table->setModel(nullptr);
+	ui->commit_table->set_controller(nullptr);
 	ui->ref_tree->setModel(nullptr);
 	ui->commit_file_list->setModel(nullptr);
 	ui->commit_info->setText(QString());
+	ui->diff_view->set_patch(nullptr);
 	repo_ctrl.reset();
+
+	graph_width = 0;
+	update_graph_scroll_bar();
 }
 
 void main_window::handle_about()
@@ -73,6 +90,20 @@ void main_window::handle_about()
 	about_dialog->show();
 }
 
+void main_window::handle_memory_usage()
+{
+	/* the repository is looked up on every refresh, since it can be opened or closed while the panel is shown */
+	memory_dialog = std::make_unique<memory_window>([this] () {
+		std::vector<memory_usage> usage;
+		if (repo_ctrl)
+			usage = repo_ctrl->get_memory_usage();
+
+		usage.push_back(ui->commit_table->get_memory_usage());
+		return usage;
+	}, this);
+	memory_dialog->show();
+}
+
 void main_window::handle_diff_view_visible(bool visible)
 {
 	if (visible)
@@ -81,6 +112,79 @@ void main_window::handle_diff_view_visible(bool visible)
 		ui->stacked_widget->setCurrentIndex(0);
 }
 
+void main_window::handle_compact_graph(bool checked)
+{
+	if (!repo_ctrl)
+		return;
+
+	repo_ctrl->set_graph_lane_policy(checked ? graph_lane_policy::COMPACT : graph_lane_policy::FIRST_FIT);
+	repo_ctrl->request_reload();
+}
+
+void main_window::handle_find_similar(bool checked)
+{
+	if (!repo_ctrl)
+		return;
+
+	/* the files of the selected commit change with the setting, so they are diffed again */
+	repo_ctrl->set_find_similar(checked);
+	repo_ctrl->handle_commit_row_changed(ui->commit_table->current_row());
+}
+
+void main_window::handle_combined_diff(bool checked)
+{
+	if (!repo_ctrl)
+		return;
+
+	repo_ctrl->set_combined_diff(checked);
+	repo_ctrl->handle_commit_row_changed(ui->commit_table->current_row());
+}
+
+void main_window::handle_ref_pattern_show()
+{
+	set_refs_active_matching(true);
+}
+
+void main_window::handle_ref_pattern_hide()
+{
+	set_refs_active_matching(false);
+}
+
+void main_window::set_refs_active_matching(bool is_active)
+{
+	if (!repo_ctrl || ui->ref_pattern_edit->text().isEmpty())
+		return;
+
+	const ref_pattern_syntax syntax = ui->ref_pattern_regex->isChecked() ?
+			ref_pattern_syntax::REGEX : ref_pattern_syntax::GLOB;
+
+	try {
+		const size_t num_matched = repo_ctrl->set_refs_active_matching(
+				ui->ref_pattern_edit->text().toStdString(), syntax, is_active);
+		ui->statusbar->showMessage(tr("%n ref(s) matched", nullptr, static_cast<int>(num_matched)));
+	} catch (const reef_error &e) {
+		ui->statusbar->showMessage(e.what());
+	}
+}
+
+void main_window::handle_graph_scroll(int value)
+{
+	ui->commit_table->set_first_lane(value);
+}
+
+void main_window::update_graph_scroll_bar()
+{
+	/* each lane takes up two characters in the graph */
+	const int num_lanes = (graph_width + 1) / 2;
+	const int visible_lanes = graph_painter::lanes_in_width(ui->commit_table->graph_column_width(),
+			ui->commit_table->row_height());
+	const int max_lane = std::max(num_lanes - visible_lanes, 0);
+
+	ui->graph_scroll_bar->setRange(0, max_lane);
+	ui->graph_scroll_bar->setPageStep(std::max(visible_lanes, 1));
+	ui->graph_scroll_bar->setVisible(max_lane > 0);
+}
+
 void main_window::load_repo(std::string dir)
 {
 	std::function<void(const QString &)> update_status_func = [this] (const QString &message) {
@@ -96,17 +200,26 @@ void main_window::load_repo(std::string dir)
 
 	repo_ctrl->display_refs();
 
-	ui->commit_table->setModel(repo_ctrl->get_commit_model());
+	ui->commit_table->set_controller(&*repo_ctrl);
 	ui->ref_tree->setModel(repo_ctrl->get_ref_model());
 	ui->commit_file_list->setModel(repo_ctrl->get_commit_file_model());
 
-	connect(ui->commit_table->selectionModel(), &QItemSelectionModel::currentRowChanged, &*repo_ctrl, &repository_controller::handle_commit_table_row_changed);
+	connect(ui->commit_table, &commit_view::current_row_changed, &*repo_ctrl, &repository_controller::handle_commit_row_changed);
+	connect(&*repo_ctrl, &repository_controller::commit_rows_changed, ui->commit_table, &commit_view::set_num_rows);
 	connect(&*repo_ctrl, &repository_controller::commit_info_text_changed, ui->commit_info, &QTextBrowser::setText);
-	connect(ui->commit_file_list->selectionModel(), &QItemSelectionModel::currentRowChanged, &*repo_ctrl, &repository_controller::handle_file_list_row_changed);
-	connect(&*repo_ctrl, &repository_controller::diff_view_text_changed, ui->diff_view, &QTextEdit::setText);
+	connect(ui->commit_file_list->selectionModel(), &QItemSelectionModel::currentChanged, &*repo_ctrl, &repository_controller::handle_file_list_row_changed);
+	connect(&*repo_ctrl, &repository_controller::diff_view_patch_changed, ui->diff_view, &patch_view::set_patch);
 	connect(&*repo_ctrl, &repository_controller::diff_view_visible, this, &main_window::handle_diff_view_visible);
+	connect(&*repo_ctrl, &repository_controller::graph_width_changed, this, [this] (int width) {
+		graph_width = width;
+		update_graph_scroll_bar();
+	});
 
 	qApp->processEvents();
 
-	repo_ctrl->display_commits();
+	repo_ctrl->set_graph_lane_policy(ui->action_compact_graph->isChecked() ?
+			graph_lane_policy::COMPACT : graph_lane_policy::FIRST_FIT);
+	repo_ctrl->set_find_similar(ui->action_find_similar->isChecked());
+	repo_ctrl->set_combined_diff(ui->action_combined_diff->isChecked());
+	repo_ctrl->reload_commits();
 }
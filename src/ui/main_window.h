@@ -24,8 +24,9 @@
 #include "controller/repository_controller.h"
 
 #include "about_window.h"
+#include "commit_view.h"
 #include "dock_widget_title_bar.h"
-#include "graph_delegate.h"
+#include "memory_window.h"
 
 #include <QMainWindow>
 
@@ -45,16 +46,26 @@ public slots:
 	void handle_open_repository();
 	void handle_close_repository();
 	void handle_about();
+	void handle_memory_usage();
 	void handle_diff_view_visible(bool visible);
+	void handle_compact_graph(bool checked);
+	void handle_find_similar(bool checked);
+	void handle_combined_diff(bool checked);
+	void handle_graph_scroll(int value);
+	void handle_ref_pattern_show();
+	void handle_ref_pattern_hide();
+	void update_graph_scroll_bar();
 
 private:
 	Ui::main_window *ui;
 	std::unique_ptr<dock_widget_title_bar> ref_list_title_bar, file_list_title_bar, commit_info_title_bar;
 
-	graph_delegate gdelegate;
 	std::unique_ptr<repository_controller> repo_ctrl;
 	std::unique_ptr<about_window> about_dialog;
+	std::unique_ptr<memory_window> memory_dialog;
+	int graph_width = 0;
 
 	void load_repo(std::string dir);
+	void set_refs_active_matching(bool is_active);
 };
 #endif // MAIN_WINDOW_H
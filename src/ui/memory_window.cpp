@@ -0,0 +1,107 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+
+#include <QClipboard>
+#include <QGuiApplication>
+#include <QTableWidgetItem>
+
+#include "memory_window.h"
+#include "ui_memory_window.h"
+
+#include "util/preferences.h"
+
+static QString format_mib(size_t bytes)
+{
+	return QString::number(bytes / (1024.0 * 1024.0), 'f', 1) + QStringLiteral(" MiB");
+}
+
+memory_window::memory_window(std::function<std::vector<memory_usage>()> get_usage, QWidget *parent) :
+	QDialog(parent),
+	ui(new Ui::memory_window),
+	get_usage(std::move(get_usage))
+{
+	ui->setupUi(this);
+
+	refresh_timer.setInterval(preferences::memory_usage_refresh_interval);
+	connect(&refresh_timer, &QTimer::timeout, this, &memory_window::refresh);
+	connect(ui->dump_button, &QPushButton::clicked, this, &memory_window::dump);
+}
+
+memory_window::~memory_window()
+{
+	delete ui;
+}
+
+QString memory_window::format_usage(const std::vector<memory_usage> &usage)
+{
+	QString text;
+	size_t total = 0;
+	for (const memory_usage &part : usage) {
+		text += QStringLiteral("%1 %2 bytes %3 objects\n").arg(QString::fromUtf8(part.name), -20).arg(part.bytes, 14).arg(part.objects, 12);
+		total += part.bytes;
+	}
+
+	text += QStringLiteral("%1 %2 bytes\n").arg(QStringLiteral("total"), -20).arg(total, 14);
+	return text;
+}
+
+void memory_window::refresh()
+{
+	const std::vector<memory_usage> usage = get_usage();
+
+	/* the last row is the total */
+	ui->usage_table->setRowCount(static_cast<int>(usage.size()) + 1);
+
+	size_t total = 0;
+	for (size_t i = 0; i < usage.size(); i++) {
+		const int row = static_cast<int>(i);
+		ui->usage_table->setItem(row, 0, new QTableWidgetItem(QString::fromUtf8(usage[i].name)));
+		ui->usage_table->setItem(row, 1, new QTableWidgetItem(format_mib(usage[i].bytes)));
+		ui->usage_table->setItem(row, 2, new QTableWidgetItem(QString::number(usage[i].objects)));
+		total += usage[i].bytes;
+	}
+
+	const int total_row = static_cast<int>(usage.size());
+	ui->usage_table->setItem(total_row, 0, new QTableWidgetItem(tr("Total")));
+	ui->usage_table->setItem(total_row, 1, new QTableWidgetItem(format_mib(total)));
+	ui->usage_table->setItem(total_row, 2, new QTableWidgetItem());
+}
+
+void memory_window::dump()
+{
+	const QString text = format_usage(get_usage());
+	std::fputs(text.toUtf8().constData(), stderr);
+	QGuiApplication::clipboard()->setText(text);
+}
+
+void memory_window::showEvent(QShowEvent *event)
+{
+	QDialog::showEvent(event);
+
+	/* the figures are only worked out while they can be seen */
+	refresh();
+	refresh_timer.start();
+}
+
+void memory_window::hideEvent(QHideEvent *event)
+{
+	refresh_timer.stop();
+	QDialog::hideEvent(event);
+}
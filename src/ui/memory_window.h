@@ -0,0 +1,72 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEMORY_WINDOW_H
+#define MEMORY_WINDOW_H
+
+#include <functional>
+#include <vector>
+
+#include <QDialog>
+#include <QTimer>
+
+#include "util/memory_usage.h"
+
+namespace Ui {
+class memory_window;
+}
+
+/*!
+ * \class memory_window
+ * \brief Debug panel listing the memory held by each part of Reef, refreshed while it is shown
+ */
+class memory_window : public QDialog
+{
+	Q_OBJECT
+
+public:
+	/*!
+	 * \brief Create the panel
+	 * \param get_usage The function returning the current usage of each part
+	 * \param parent The parent widget
+	 */
+	explicit memory_window(std::function<std::vector<memory_usage>()> get_usage, QWidget *parent = nullptr);
+	~memory_window();
+
+	/*!
+	 * \brief Format the usage of each part and the total as plain text, one part per line
+	 * \param usage The usage of each part
+	 * \return The text
+	 */
+	static QString format_usage(const std::vector<memory_usage> &usage);
+
+public slots:
+	void refresh();
+	void dump();
+
+protected:
+	void showEvent(QShowEvent *event) override;
+	void hideEvent(QHideEvent *event) override;
+
+private:
+	Ui::memory_window *ui;
+	std::function<std::vector<memory_usage>()> get_usage;
+	QTimer refresh_timer;
+};
+
+#endif // MEMORY_WINDOW_H
@@ -0,0 +1,317 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include <QFontDatabase>
+#include <QFontMetrics>
+#include <QPainter>
+#include <QScrollBar>
+
+#include "util/preferences.h"
+
+#include "patch_view.h"
+
+/* the backgrounds of the added and deleted lines and the hunk headers */
+const QColor added_line_color(220, 255, 220);
+const QColor deleted_line_color(255, 220, 220);
+const QColor hunk_header_color(225, 225, 245);
+
+/* the backgrounds of the words that changed within the added and deleted lines */
+const QColor added_words_color(160, 235, 160);
+const QColor deleted_words_color(245, 170, 170);
+
+/* the colours of the highlighted tokens */
+const QColor keyword_color(0, 0, 160);
+const QColor string_color(160, 60, 0);
+const QColor comment_color(100, 110, 100);
+const QColor number_color(130, 0, 130);
+
+/* the space between the left edge and the text */
+constexpr int text_margin = 4;
+
+patch_view::patch_view(QWidget *parent) :
+	QAbstractScrollArea(parent)
+{
+	setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+
+	const QFontMetrics metrics(font());
+	line_height = std::max(metrics.lineSpacing(), 1);
+	char_width = std::max(metrics.averageCharWidth(), 1);
+
+	update_scroll_bars();
+}
+
+void patch_view::set_patch(std::shared_ptr<const diff_patch> patch)
+{
+	this->patch = std::move(patch);
+
+	/* the blocks of the old patch are dropped, including the ones that are still being highlighted */
+	highlight_blocks.clear();
+	requested_blocks.clear();
+	highlight_generation = highlighter.set_patch(this->patch, [this] (uint64_t generation, size_t block_index,
+			std::shared_ptr<const patch_highlight_block> block) {
+		QMetaObject::invokeMethod(this, [this, generation, block_index, block] () {
+			add_highlight_block(generation, block_index, block);
+		}, Qt::QueuedConnection);
+	});
+
+	update_scroll_bars();
+	verticalScrollBar()->setValue(0);
+	horizontalScrollBar()->setValue(0);
+	request_visible_highlights();
+	viewport()->update();
+}
+
+void patch_view::request_visible_highlights()
+{
+	if (!patch || patch->lines.empty())
+		return;
+
+	const size_t first_line = verticalScrollBar()->value();
+	const size_t end_line = std::min(first_line + viewport()->height() / line_height + 1, patch->lines.size());
+	const size_t first_block = first_line / preferences::highlight_block_size;
+
+	const size_t margin_begin = first_line > preferences::highlight_margin ? first_line - preferences::highlight_margin : 0;
+	const size_t margin_end = std::min(end_line + preferences::highlight_margin, patch->lines.size());
+	const size_t begin_block = margin_begin / preferences::highlight_block_size;
+	const size_t end_block = (margin_end + preferences::highlight_block_size - 1) / preferences::highlight_block_size;
+
+	std::vector<size_t> blocks;
+	for (size_t block = begin_block; block < end_block; block++)
+		if (highlight_blocks.count(block) == 0)
+			blocks.push_back(block);
+
+	/* the blocks on screen are highlighted before the ones in the margin */
+	std::stable_sort(blocks.begin(), blocks.end(), [first_block] (size_t lhs, size_t rhs) {
+		const size_t lhs_distance = lhs > first_block ? lhs - first_block : first_block - lhs;
+		const size_t rhs_distance = rhs > first_block ? rhs - first_block : first_block - rhs;
+		return lhs_distance < rhs_distance;
+	});
+
+	if (blocks == requested_blocks)
+		return;
+
+	requested_blocks = blocks;
+	highlighter.request_blocks(std::move(blocks));
+}
+
+void patch_view::add_highlight_block(uint64_t generation, size_t block_index, std::shared_ptr<const patch_highlight_block> block)
+{
+	/* the block belongs to a patch that is no longer shown */
+	if (generation != highlight_generation)
+		return;
+
+	highlight_blocks[block_index] = std::move(block);
+	requested_blocks.erase(std::remove(requested_blocks.begin(), requested_blocks.end(), block_index), requested_blocks.end());
+
+	/* forget the block furthest from the screen once there are too many */
+	if (highlight_blocks.size() > preferences::highlight_max_blocks) {
+		const size_t first_block = verticalScrollBar()->value() / preferences::highlight_block_size;
+		auto furthest = highlight_blocks.begin();
+		size_t furthest_distance = 0;
+		for (auto it = highlight_blocks.begin(); it != highlight_blocks.end(); it++) {
+			const size_t distance = it->first > first_block ? it->first - first_block : first_block - it->first;
+			if (distance > furthest_distance) {
+				furthest = it;
+				furthest_distance = distance;
+			}
+		}
+
+		highlight_blocks.erase(furthest);
+	}
+
+	viewport()->update();
+}
+
+void patch_view::update_scroll_bars()
+{
+	/* the vertical scroll bar moves by whole lines */
+	const int num_lines = patch ? patch->lines.size() : 0;
+	const int visible_lines = std::max(viewport()->height() / line_height, 1);
+	verticalScrollBar()->setRange(0, std::max(num_lines - visible_lines, 0));
+	verticalScrollBar()->setPageStep(visible_lines);
+	verticalScrollBar()->setSingleStep(1);
+
+	/* the width is estimated from the longest line in bytes, tabs can make a line a little wider */
+	const size_t max_length = patch ? std::min(patch->max_line_length, size_t(preferences::max_line_length)) : 0;
+	const int text_width = max_length * char_width + text_margin * 2;
+	horizontalScrollBar()->setRange(0, std::max(text_width - viewport()->width(), 0));
+	horizontalScrollBar()->setPageStep(viewport()->width());
+	horizontalScrollBar()->setSingleStep(char_width);
+}
+
+void patch_view::paintEvent(QPaintEvent *event)
+{
+	(void) event;
+
+	if (!patch)
+		return;
+
+	QPainter painter(viewport());
+	painter.setFont(font());
+
+	const int x = text_margin - horizontalScrollBar()->value();
+
+	const size_t first_line = verticalScrollBar()->value();
+	const size_t last_line = std::min(first_line + viewport()->height() / line_height + 1, patch->lines.size());
+
+	const patch_highlight_block *block = nullptr;
+	size_t block_index = SIZE_MAX;
+
+	for (size_t i = first_line; i < last_line; i++) {
+		const diff_patch::line &line = patch->lines[i];
+		const int y = (i - first_line) * line_height;
+
+		QColor changed_color;
+		switch (line.origin) {
+		case GIT_DIFF_LINE_ADDITION:
+		case GIT_DIFF_LINE_ADD_EOFNL:
+			painter.fillRect(0, y, viewport()->width(), line_height, added_line_color);
+			changed_color = added_words_color;
+			break;
+		case GIT_DIFF_LINE_DELETION:
+		case GIT_DIFF_LINE_DEL_EOFNL:
+			painter.fillRect(0, y, viewport()->width(), line_height, deleted_line_color);
+			changed_color = deleted_words_color;
+			break;
+		case GIT_DIFF_LINE_HUNK_HDR:
+			painter.fillRect(0, y, viewport()->width(), line_height, hunk_header_color);
+			break;
+		}
+
+		if (i / preferences::highlight_block_size != block_index) {
+			block_index = i / preferences::highlight_block_size;
+			auto it = highlight_blocks.find(block_index);
+			block = it != highlight_blocks.end() ? it->second.get() : nullptr;
+		}
+
+		const line_highlight *highlight = nullptr;
+		const size_t index_in_block = i % preferences::highlight_block_size;
+		if (block != nullptr && index_in_block < block->lines.size())
+			highlight = &block->lines[index_in_block];
+
+		/* only the lines on screen are decoded */
+		const size_t length = std::min(size_t(line.length), size_t(preferences::max_line_length));
+		draw_line(painter, x, y, patch->text.data() + line.offset, length, highlight,
+				block != nullptr ? block->spans.data() : nullptr, changed_color);
+	}
+}
+
+/* draws a line in runs of the same colour, each run is decoded and has its tabs expanded on its own */
+void patch_view::draw_line(QPainter &painter, int x, int y, const char *text, size_t length,
+		const line_highlight *highlight, const highlight_span *spans, const QColor &changed_color)
+{
+	const size_t tab_length = preferences().tab_length;
+	const int ascent = painter.fontMetrics().ascent();
+	const QPen text_pen = painter.pen();
+
+	size_t column = 0;
+	uint32_t span = 0;
+	uint32_t pos = 0;
+
+	while (pos < length) {
+		/* the run ends at the next edge of a span or of the changed words */
+		uint32_t end = length;
+		const highlight_span *current = nullptr;
+		bool changed = false;
+
+		if (highlight != nullptr) {
+			while (span < highlight->num_spans && spans[highlight->first_span + span].end <= pos)
+				span++;
+
+			if (span < highlight->num_spans) {
+				const highlight_span &next = spans[highlight->first_span + span];
+				if (next.begin <= pos) {
+					current = &next;
+					end = std::min(end, next.end);
+				} else {
+					end = std::min(end, next.begin);
+				}
+			}
+
+			if (pos < highlight->changed_begin) {
+				end = std::min(end, highlight->changed_begin);
+			} else if (pos < highlight->changed_end) {
+				end = std::min(end, highlight->changed_end);
+				changed = true;
+			}
+		}
+
+		const QString content = QString::fromUtf8(text + pos, end - pos);
+		const size_t run_column = column;
+
+		/* expand the tabs, since every character of the run is drawn in one go */
+		QString run;
+		run.reserve(content.size());
+		for (const QChar c : content) {
+			if (c == QLatin1Char('\t')) {
+				const size_t num_spaces = tab_length - column % tab_length;
+				run.append(QString(static_cast<int>(num_spaces), QLatin1Char(' ')));
+				column += num_spaces;
+			} else {
+				run.append(c);
+				column++;
+			}
+		}
+
+		const int run_x = x + run_column * char_width;
+		if (changed)
+			painter.fillRect(run_x, y, (column - run_column) * char_width, line_height, changed_color);
+
+		if (current == nullptr) {
+			painter.setPen(text_pen);
+		} else {
+			switch (current->kind) {
+			case highlight_kind::KEYWORD:
+				painter.setPen(keyword_color);
+				break;
+			case highlight_kind::STRING:
+				painter.setPen(string_color);
+				break;
+			case highlight_kind::COMMENT:
+				painter.setPen(comment_color);
+				break;
+			case highlight_kind::NUMBER:
+				painter.setPen(number_color);
+				break;
+			}
+		}
+
+		painter.drawText(run_x, y + ascent, run);
+		pos = end;
+	}
+
+	painter.setPen(text_pen);
+}
+
+void patch_view::resizeEvent(QResizeEvent *event)
+{
+	QAbstractScrollArea::resizeEvent(event);
+	update_scroll_bars();
+	request_visible_highlights();
+}
+
+void patch_view::scrollContentsBy(int dx, int dy)
+{
+	(void) dx;
+	(void) dy;
+
+	request_visible_highlights();
+	viewport()->update();
+}
@@ -0,0 +1,86 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PATCH_VIEW_H
+#define PATCH_VIEW_H
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <QAbstractScrollArea>
+#include <QColor>
+#include <QPaintEvent>
+#include <QPainter>
+#include <QResizeEvent>
+
+#include "core/diff_cache.h"
+#include "core/patch_highlighter.h"
+
+/*!
+ * \class patch_view
+ * \brief Read only view of a diff_patch which only decodes and paints the visible lines
+ *
+ * Every line has the same height, so the cost of showing a patch does not
+ * depend on its size. Lines longer than preferences::max_line_length are cut
+ * off.
+ *
+ * The blocks of lines on screen and a margin around them are highlighted
+ * by a patch_highlighter and kept until they are far from the screen. Lines
+ * are painted plain until their block arrives.
+ */
+class patch_view : public QAbstractScrollArea
+{
+	Q_OBJECT
+
+public:
+	patch_view(QWidget *parent = nullptr);
+
+	/*!
+	 * \brief Show a patch, scrolling back to its start
+	 * \param patch The patch to show, or nullptr to clear the view
+	 */
+	void set_patch(std::shared_ptr<const diff_patch> patch);
+
+protected:
+	void paintEvent(QPaintEvent *event) override;
+	void resizeEvent(QResizeEvent *event) override;
+	void scrollContentsBy(int dx, int dy) override;
+
+private:
+	std::shared_ptr<const diff_patch> patch;
+	int line_height;
+	int char_width;
+
+	/* the highlighted blocks of the patch and the blocks last asked for which have not arrived yet */
+	uint64_t highlight_generation = 0;
+	std::unordered_map<size_t, std::shared_ptr<const patch_highlight_block>> highlight_blocks;
+	std::vector<size_t> requested_blocks;
+
+	/* destroyed first, so it stops calling back before anything else goes away */
+	patch_highlighter highlighter;
+
+	void update_scroll_bars();
+	void request_visible_highlights();
+	void add_highlight_block(uint64_t generation, size_t block_index, std::shared_ptr<const patch_highlight_block> block);
+	void draw_line(QPainter &painter, int x, int y, const char *text, size_t length,
+			const line_highlight *highlight, const highlight_span *spans, const QColor &changed_color);
+};
+
+#endif /* PATCH_VIEW_H */
@@ -0,0 +1,313 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* arena.h */
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+/*!
+ * \struct arena_stats
+ * \brief Counters describing the memory held by an arena
+ */
+struct arena_stats
+{
+	/*! \brief The number of allocations made since the arena was last cleared */
+	size_t num_allocations = 0;
+	/*! \brief The bytes handed out since the arena was last cleared, without alignment padding */
+	size_t allocated_bytes = 0;
+	/*! \brief The number of standard blocks held */
+	size_t num_blocks = 0;
+	/*! \brief The number of oversized allocations held, each in a block of its own */
+	size_t num_large_blocks = 0;
+	/*! \brief The bytes of every block held, used or not */
+	size_t reserved_bytes = 0;
+	/*! \brief The largest reserved_bytes has been */
+	size_t peak_reserved_bytes = 0;
+};
+
+/*!
+ * \class arena
+ * \brief Allocator handing out memory from large blocks, which is all released at once
+ *
+ * Allocations are aligned for their type and are never freed on their own,
+ * except for oversized ones which get a block of their own that
+ * deallocate can return. Clearing the arena destroys nothing, so it must
+ * only hold objects which are trivially destructible or already destroyed.
+ * The first block is kept when the arena is cleared, so that an arena
+ * which is filled and cleared over and over does not go back to the
+ * system each time.
+ *
+ * On Linux the blocks can be backed by transparent huge pages, which cuts
+ * down on TLB misses when walking large amounts of memory.
+ */
+class arena
+{
+public:
+	/*! \brief The size of the blocks when none is given */
+	static constexpr size_t default_block_size = 256 * 1024;
+
+	/*!
+	 * \brief Create an empty arena, no memory is allocated until it is first used
+	 * \param block_size The size of the blocks memory is handed out from
+	 * \param use_huge_pages Whether or not to ask for the blocks to be backed by huge pages
+	 */
+	explicit arena(size_t block_size = default_block_size, bool use_huge_pages = false) :
+		block_size(block_size),
+		use_huge_pages(use_huge_pages)
+	{}
+
+	arena(const arena &) = delete;
+	arena &operator=(const arena &) = delete;
+
+	~arena()
+	{
+		for (const block &b : blocks)
+			free_block(b);
+		for (const block &b : large_blocks)
+			free_block(b);
+	}
+
+	/*!
+	 * \brief Allocate uninitialized memory for an array
+	 * \param num_elements The number of elements in the array
+	 * \return The memory, aligned for T
+	 */
+	template<typename T>
+	T *allocate(size_t num_elements = 1)
+	{
+		if (num_elements > std::numeric_limits<size_t>::max() / sizeof(T))
+			throw std::bad_alloc();
+
+		return static_cast<T *>(allocate_bytes(num_elements * sizeof(T), alignof(T)));
+	}
+
+	/*!
+	 * \brief Allocate uninitialized memory
+	 * \param size The number of bytes to allocate
+	 * \param alignment The alignment of the memory, a power of two
+	 * \return The memory
+	 */
+	void *allocate_bytes(size_t size, size_t alignment)
+	{
+		stats.num_allocations++;
+		stats.allocated_bytes += size;
+
+		/* anything which would waste a large part of a block gets a block of its own */
+		if (size > block_size / 4) {
+			large_blocks.push_back(allocate_block(size + alignment - 1));
+			stats.num_large_blocks++;
+			return align(large_blocks.back().memory, alignment);
+		}
+
+		uint8_t *ptr = current_block_end == nullptr ? nullptr : align(current_ptr, alignment);
+		if (ptr == nullptr || static_cast<size_t>(current_block_end - ptr) < size) {
+			blocks.push_back(allocate_block(block_size));
+			stats.num_blocks++;
+			current_ptr = blocks.back().memory;
+			current_block_end = current_ptr + block_size;
+			ptr = align(current_ptr, alignment);
+		}
+
+		current_ptr = ptr + size;
+		return ptr;
+	}
+
+	/*!
+	 * \brief Give back memory, which is only released if it was an oversized allocation
+	 * \param ptr The memory returned by allocate or allocate_bytes
+	 */
+	void deallocate(void *ptr)
+	{
+		/* the latest oversized allocations are the likeliest to be freed, such as a vector that grew */
+		for (auto it = large_blocks.rbegin(); it != large_blocks.rend(); it++) {
+			if (ptr >= it->memory && ptr < it->memory + it->size) {
+				free_block(*it);
+				large_blocks.erase(std::next(it).base());
+				stats.num_large_blocks--;
+				return;
+			}
+		}
+	}
+
+	/*!
+	 * \brief Release every allocation at once, keeping the first block for reuse
+	 */
+	void clear()
+	{
+		for (size_t i = 1; i < blocks.size(); i++)
+			free_block(blocks[i]);
+		for (const block &b : large_blocks)
+			free_block(b);
+
+		blocks.resize(std::min(blocks.size(), size_t(1)));
+		large_blocks.clear();
+
+		current_ptr = blocks.empty() ? nullptr : blocks.front().memory;
+		current_block_end = blocks.empty() ? nullptr : current_ptr + block_size;
+
+		const size_t peak_reserved_bytes = stats.peak_reserved_bytes;
+		stats = arena_stats();
+		stats.num_blocks = blocks.size();
+		stats.reserved_bytes = blocks.size() * block_size;
+		stats.peak_reserved_bytes = peak_reserved_bytes;
+	}
+
+	/*!
+	 * \brief Get the counters of the memory held by the arena
+	 * \return The counters
+	 */
+	const arena_stats &get_stats() const
+	{
+		return stats;
+	}
+
+private:
+	struct block
+	{
+		uint8_t *memory;
+		size_t size;
+		bool mapped;
+	};
+
+	size_t block_size;
+	bool use_huge_pages;
+
+	std::vector<block> blocks;
+	std::vector<block> large_blocks;
+
+	/* the free part of the latest standard block */
+	uint8_t *current_ptr = nullptr;
+	uint8_t *current_block_end = nullptr;
+
+	arena_stats stats;
+
+	static uint8_t *align(uint8_t *ptr, size_t alignment)
+	{
+		const uintptr_t address = reinterpret_cast<uintptr_t>(ptr);
+		return ptr + ((alignment - address % alignment) % alignment);
+	}
+
+	block allocate_block(size_t size)
+	{
+		block b{ nullptr, size, false };
+
+#ifdef __linux__
+		/* huge pages are only worth asking for when the block spans several of them */
+		constexpr size_t huge_page_size = 2 * 1024 * 1024;
+		if (use_huge_pages && size >= huge_page_size) {
+			void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (memory != MAP_FAILED) {
+				madvise(memory, size, MADV_HUGEPAGE);
+				b.memory = static_cast<uint8_t *>(memory);
+				b.mapped = true;
+			}
+		}
+#endif
+
+		if (b.memory == nullptr)
+			b.memory = new uint8_t[size];
+
+		stats.reserved_bytes += size;
+		stats.peak_reserved_bytes = std::max(stats.peak_reserved_bytes, stats.reserved_bytes);
+
+		return b;
+	}
+
+	void free_block(const block &b)
+	{
+		stats.reserved_bytes -= b.size;
+
+#ifdef __linux__
+		if (b.mapped) {
+			munmap(b.memory, b.size);
+			return;
+		}
+#endif
+
+		delete[] b.memory;
+	}
+};
+
+/*!
+ * \class arena_allocator
+ * \brief Standard library allocator which takes its memory from an arena
+ *
+ * Lets containers such as std::unordered_map keep their nodes in an arena.
+ * Freed memory is only given back if it was an oversized allocation, so
+ * it suits containers which mostly grow until they are destroyed.
+ */
+template<typename T>
+class arena_allocator
+{
+public:
+	using value_type = T;
+
+	arena_allocator(arena &a) :
+		a(&a)
+	{}
+
+	template<typename U>
+	arena_allocator(const arena_allocator<U> &other) :
+		a(other.get_arena())
+	{}
+
+	T *allocate(size_t n)
+	{
+		return a->allocate<T>(n);
+	}
+
+	void deallocate(T *ptr, size_t n)
+	{
+		(void) n;
+		a->deallocate(ptr);
+	}
+
+	arena *get_arena() const
+	{
+		return a;
+	}
+
+	template<typename U>
+	bool operator==(const arena_allocator<U> &other) const
+	{
+		return a == other.get_arena();
+	}
+
+	template<typename U>
+	bool operator!=(const arena_allocator<U> &other) const
+	{
+		return a != other.get_arena();
+	}
+
+private:
+	arena *a;
+};
+
+#endif /* ARENA_H */
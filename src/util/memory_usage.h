@@ -0,0 +1,84 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* memory_usage.h */
+#ifndef MEMORY_USAGE_H
+#define MEMORY_USAGE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*!
+ * \struct memory_usage
+ * \brief The memory held by one part of Reef, for finding out which part is using the most
+ *
+ * The bytes are an estimate of the heap memory the part holds, its own
+ * allocations and the containers it keeps, without allocator overhead.
+ */
+struct memory_usage
+{
+	/*! \brief The name of the part */
+	const char *name;
+	/*! \brief The estimated bytes held */
+	size_t bytes;
+	/*! \brief The number of objects held, what counts as an object depends on the part */
+	size_t objects;
+};
+
+/*!
+ * \brief Estimate the memory held by a vector
+ * \param v The vector
+ * \return The size in bytes of the elements it has room for
+ */
+template<typename T, typename A>
+inline size_t vector_memory(const std::vector<T, A> &v)
+{
+	return v.capacity() * sizeof(T);
+}
+
+/*!
+ * \brief Estimate the memory held by an unordered container, not counting what its elements point to
+ *
+ * Each element is assumed to be in a node with a next pointer and its cached
+ * hash, and each bucket to be a pointer, which is how the common standard
+ * libraries lay them out.
+ *
+ * \param c The container
+ * \return The size in bytes of its nodes and buckets
+ */
+template<typename C>
+inline size_t hash_table_memory(const C &c)
+{
+	return c.size() * (sizeof(typename C::value_type) + sizeof(void *) + sizeof(size_t)) + c.bucket_count() * sizeof(void *);
+}
+
+/*!
+ * \brief Estimate the memory held by a string
+ * \param str The string
+ * \return The size in bytes of its characters, zero if they fit in the string itself
+ */
+inline size_t string_memory(const std::string &str)
+{
+	/* short strings are stored in the string object */
+	const char *object = reinterpret_cast<const char *>(&str);
+	const bool is_local = str.data() >= object && str.data() < object + sizeof(str);
+	return is_local ? 0 : str.capacity() + 1;
+}
+
+#endif /* MEMORY_USAGE_H */
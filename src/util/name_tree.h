@@ -0,0 +1,152 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* name_tree.h */
+#ifndef NAME_TREE_H
+#define NAME_TREE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/*!
+ * \struct name_tree_item
+ * \brief A node in a tree covering a range of sorted '/' separated names
+ *
+ * The name of the node is a slice of the first name in its range.
+ * Directories with a single child are merged into their child. The
+ * children of a node are only created when it is first expanded.
+ */
+struct name_tree_item
+{
+	/*! \brief The range of names under this node */
+	uint32_t begin, end;
+	/*! \brief The start and end of the node's name in the first name */
+	uint32_t name_begin, name_end;
+	/*! \brief The index of the parent node, or name_tree_no_parent */
+	uint32_t parent;
+	/*! \brief The position of the node amongst its siblings */
+	uint32_t index_in_parent;
+	/*! \brief The index of the first child, the children are stored next to each other */
+	uint32_t first_child = 0;
+	/*! \brief The number of children, zero until the children are loaded */
+	uint32_t num_children = 0;
+	/*! \brief Whether or not the children have been loaded */
+	bool children_loaded = false;
+
+	/*!
+	 * \brief Check whether this node is a directory
+	 * \return True if the node covers more than one name
+	 */
+	bool has_children() const
+	{
+		return end - begin > 1;
+	}
+};
+
+/*! \brief The parent of the top level nodes */
+constexpr uint32_t name_tree_no_parent = UINT32_MAX;
+
+/*!
+ * \struct name_tree_name
+ * \brief A name in the range a tree is built over
+ */
+struct name_tree_name
+{
+	const char *name;
+	uint32_t len;
+};
+
+/*!
+ * \brief Append the children of a node to a tree, the caller is responsible for linking them to the node
+ *
+ * The names must be sorted so that the names starting with any given
+ * prefix are next to each other, which plain byte order guarantees.
+ *
+ * \param items The nodes of the tree
+ * \param parent The index of the node, or name_tree_no_parent for the top level
+ * \param begin The first name under the node
+ * \param end One past the last name under the node
+ * \param name_begin The length of the prefix every name under the node shares
+ * \param get_name Function returning the name_tree_name at an index
+ * \return The number of children appended
+ */
+template<typename get_name_func>
+uint32_t add_name_tree_children(std::vector<name_tree_item> &items, uint32_t parent, uint32_t begin, uint32_t end,
+		uint32_t name_begin, const get_name_func &get_name)
+{
+	const uint32_t first_child = items.size();
+
+	/* the names in [begin, end) share everything up to name_begin, each run of names
+	 * sharing the next part of the name becomes a child */
+	uint32_t child_begin = begin;
+	while (child_begin < end) {
+		const name_tree_name first = get_name(child_begin);
+		const char *name = first.name;
+
+		const char *slash = static_cast<const char *>(memchr(name + name_begin, '/', first.len - std::min(name_begin, first.len)));
+		uint32_t name_end = slash != nullptr ? slash - name : std::max(first.len, name_begin);
+
+		uint32_t child_end = child_begin + 1;
+		while (child_end < end) {
+			const name_tree_name next = get_name(child_end);
+			if (next.len < name_end || memcmp(next.name + name_begin, name + name_begin, name_end - name_begin) != 0
+					|| (next.len > name_end && next.name[name_end] != '/'))
+				break;
+
+			child_end++;
+		}
+
+		name_tree_item item;
+		item.begin = child_begin;
+		item.end = child_end;
+		item.name_begin = name_begin;
+		item.parent = parent;
+		item.index_in_parent = items.size() - first_child;
+
+		if (child_end - child_begin == 1) {
+			/* a single name, a directory with only one name in it is merged with the name */
+			item.name_end = first.len;
+		} else {
+			/* merge the directories that only have one child, the names in between the first
+			 * and last ones share the same next directory whenever they do */
+			const name_tree_name last = get_name(child_end - 1);
+			while (name_end + 1 < first.len) {
+				const char *next_slash = static_cast<const char *>(memchr(name + name_end + 1, '/', first.len - name_end - 1));
+				if (next_slash == nullptr)
+					break;
+
+				const uint32_t next_end = next_slash - name;
+				if (last.len <= next_end || memcmp(last.name + name_end, name + name_end, next_end - name_end + 1) != 0)
+					break;
+
+				name_end = next_end;
+			}
+
+			item.name_end = name_end;
+		}
+
+		items.push_back(item);
+		child_begin = child_end;
+	}
+
+	return items.size() - first_child;
+}
+
+#endif /* NAME_TREE_H */
@@ -20,6 +20,14 @@
 #ifndef PREFERENCES_H
 #define PREFERENCES_H
 
+/* the policies for placing new branches in the graph */
+enum class graph_lane_policy : char {
+	/* place new branches in the first free lane to the right of the commit */
+	FIRST_FIT,
+	/* end branches and draw merges into lanes already waiting on the same commit, otherwise reuse a lane ending on the same row first */
+	COMPACT,
+};
+
 class preferences
 {
 public:
@@ -30,12 +38,71 @@ public:
 	/* the maximum length of a timestamp anomaly in the graph */
 	const int graph_approximation_factor = 32;
 
+	/* the policy for placing new branches in the graph */
+	graph_lane_policy lane_policy = graph_lane_policy::FIRST_FIT;
+
+	/* whether or not diffs pair up added files with the files they were renamed or copied from */
+	bool find_similar = false;
+
+	/* whether or not merges are diffed against all of their parents, listing only the files they resolved */
+	bool combined_diff = false;
+
 	/* non user controllable properties */
 	/* the maximum line length */
 	static constexpr size_t max_line_length = 1024;
 
 	/* the interval in milliseconds for often the UI events should be processed */
 	static constexpr long window_update_interval = 50;
+
+	/* the time in milliseconds to wait for more changes to the active refs before reloading the commits */
+	static constexpr int reload_delay = 250;
+
+	/* the estimated memory in bytes the cache of computed diffs and patches is kept under */
+	static constexpr size_t diff_cache_size = 64 * 1024 * 1024;
+
+	/* the number of commits above and below the selected one that are diffed in the background */
+	static constexpr size_t diff_prefetch_distance = 2;
+
+	/* the percentage of a file's content that must match another file for it to count as renamed or copied */
+	static constexpr unsigned int similarity_threshold = 50;
+
+	/* the most added or removed files a diff can have for them to be compared by content when finding renames,
+	 * above this only files with identical content are paired up */
+	static constexpr size_t similarity_file_limit = 1000;
+
+	/* the size in bytes above which files are only paired up with files of identical content */
+	static constexpr size_t similarity_max_file_size = 1024 * 1024;
+
+	/* the number of lines of a patch that are highlighted together */
+	static constexpr size_t highlight_block_size = 128;
+
+	/* the number of lines above and below the visible ones that are highlighted ahead of scrolling */
+	static constexpr size_t highlight_margin = 64;
+
+	/* the most blocks of highlighted lines a patch view keeps */
+	static constexpr size_t highlight_max_blocks = 256;
+
+	/* the longest run of added and deleted lines whose changes within each line are highlighted */
+	static constexpr size_t intra_line_max_run = 1000;
+
+	/* the size in bytes of the blocks the loaded commits are stored in */
+	static constexpr size_t commit_arena_block_size = 1024 * 1024;
+
+	/* the size in bytes of the blocks the commit rows are stored in, and whether or not to back them with huge pages */
+	static constexpr size_t row_arena_block_size = 4 * 1024 * 1024;
+	static constexpr bool row_arena_huge_pages = true;
+
+	/* the number of decoded refs and summaries of the commit rows that are kept for reuse */
+	static constexpr size_t row_text_cache_size = 1024;
+
+	/* the interval in milliseconds the memory usage panel is refreshed at while it is shown */
+	static constexpr int memory_usage_refresh_interval = 1000;
+
+	/* the most spans a trace keeps, the ones after are dropped */
+	static constexpr size_t trace_max_events = 1024 * 1024;
+
+	/* the memory in bytes used to keep painted rows of the graph for reuse, zero paints every row from the atlas */
+	static constexpr size_t graph_row_cache_size = 16 * 1024 * 1024;
 };
 
 #endif /* PREFERENCES_H */
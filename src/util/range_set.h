@@ -0,0 +1,157 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* range_set.h */
+#ifndef RANGE_SET_H
+#define RANGE_SET_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/*!
+ * \class range_set
+ * \brief Set of integers stored as sorted, disjoint, non adjacent half open ranges
+ *
+ * Selecting every row of a huge list takes a single range, so the memory
+ * used depends on how fragmented the set is rather than on how many
+ * integers are in it.
+ */
+class range_set
+{
+public:
+	/*!
+	 * \struct range
+	 * \brief The integers from begin up to but not including end
+	 */
+	struct range
+	{
+		uint64_t begin, end;
+	};
+
+	/*!
+	 * \brief Check whether an integer is in the set
+	 * \param value The integer to look for
+	 * \return True if value is in one of the ranges
+	 */
+	bool contains(uint64_t value) const
+	{
+		auto it = first_ending_after(value);
+		return it != ranges.end() && it->begin <= value;
+	}
+
+	/*!
+	 * \brief Add a range of integers to the set, merging it with the ranges it overlaps or touches
+	 * \param begin The first integer to add
+	 * \param end One past the last integer to add
+	 */
+	void insert(uint64_t begin, uint64_t end)
+	{
+		if (begin >= end)
+			return;
+
+		/* the ranges from first to last overlap or touch the new one */
+		auto first = std::lower_bound(ranges.begin(), ranges.end(), begin, [] (const range &r, uint64_t value) {
+			return r.end < value;
+		});
+		auto last = std::upper_bound(first, ranges.end(), end, [] (uint64_t value, const range &r) {
+			return value < r.begin;
+		});
+
+		if (first != last) {
+			begin = std::min(begin, first->begin);
+			end = std::max(end, (last - 1)->end);
+		}
+
+		first = ranges.erase(first, last);
+		ranges.insert(first, range{ begin, end });
+	}
+
+	/*!
+	 * \brief Remove a range of integers from the set, splitting the range around it if needed
+	 * \param begin The first integer to remove
+	 * \param end One past the last integer to remove
+	 */
+	void erase(uint64_t begin, uint64_t end)
+	{
+		if (begin >= end)
+			return;
+
+		auto first = first_ending_after(begin);
+		auto last = std::lower_bound(first, ranges.end(), end, [] (const range &r, uint64_t value) {
+			return r.begin < value;
+		});
+		if (first == last)
+			return;
+
+		/* keep the parts of the outermost ranges that stick out */
+		const range head{ first->begin, begin };
+		const range tail{ end, (last - 1)->end };
+
+		auto it = ranges.erase(first, last);
+		if (tail.begin < tail.end)
+			it = ranges.insert(it, tail);
+		if (head.begin < head.end)
+			ranges.insert(it, head);
+	}
+
+	/*!
+	 * \brief Remove every integer from the set
+	 */
+	void clear()
+	{
+		ranges.clear();
+	}
+
+	/*!
+	 * \brief Check whether the set has no integers in it
+	 * \return True if the set is empty
+	 */
+	bool empty() const
+	{
+		return ranges.empty();
+	}
+
+	/*!
+	 * \brief Get the ranges in the set
+	 * \return The ranges in ascending order
+	 */
+	const std::vector<range> &get_ranges() const
+	{
+		return ranges;
+	}
+
+private:
+	std::vector<range> ranges;
+
+	std::vector<range>::const_iterator first_ending_after(uint64_t value) const
+	{
+		return std::upper_bound(ranges.begin(), ranges.end(), value, [] (uint64_t v, const range &r) {
+			return v < r.end;
+		});
+	}
+
+	std::vector<range>::iterator first_ending_after(uint64_t value)
+	{
+		return std::upper_bound(ranges.begin(), ranges.end(), value, [] (uint64_t v, const range &r) {
+			return v < r.end;
+		});
+	}
+};
+
+#endif /* RANGE_SET_H */
@@ -20,10 +20,33 @@
 #ifndef REEF_STRING_H
 #define REEF_STRING_H
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <stdexcept>
 
 #include <QString>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define REEF_STRING_SSE2
+#include <emmintrin.h>
+#endif
+
+/* AVX2 is used when the compiler targets it, or when GCC and Clang can check for it at runtime */
+#if defined(REEF_STRING_SSE2) && defined(__AVX2__)
+#define REEF_STRING_AVX2
+#define REEF_STRING_AVX2_FUNCTION
+#include <immintrin.h>
+#elif defined(REEF_STRING_SSE2) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define REEF_STRING_AVX2
+#define REEF_STRING_AVX2_FUNCTION __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
 /*
  * UTF8 Decoder: See http://bjoern.hoehrmann.de/utf-8/decoder/dfa/ for details.
  *
@@ -76,20 +99,125 @@ uint32_t inline utf8_decode(uint32_t* state, uint32_t* codepoint, uint32_t byte)
 
 /* end UTF8 decoder */
 
-/* appends the UTF8 string str to the buffer buf with size n at the position i updating i to the next available position */
+/*
+ * Most of the text decoded is ASCII, which is widened to UTF-16 a block at a
+ * time. A block is widened while the decoder is between code points and
+ * every byte of the block is ASCII, and the decoder takes over from the
+ * first byte that is not, so the text decodes the same either way.
+ */
+namespace reef_string_detail {
+
+/* returns the index of the lowest set bit of a non-zero mask */
+static inline unsigned int lowest_bit(uint32_t mask)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+#ifdef REEF_STRING_SSE2
+/* widens the leading ASCII bytes of the n bytes of str into buf 16 at a time, returning how many were widened */
+static inline size_t widen_ascii_sse2(QChar *buf, const char *str, size_t n)
+{
+	const __m128i zero = _mm_setzero_si128();
+	size_t j = 0;
+	for (; j + 16 <= n; j += 16) {
+		const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(str + j));
+		const uint32_t non_ascii = _mm_movemask_epi8(bytes);
+
+		/* the whole block is stored, the characters after the first non ASCII byte are overwritten by the decoder */
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(buf + j), _mm_unpacklo_epi8(bytes, zero));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(buf + j + 8), _mm_unpackhi_epi8(bytes, zero));
+
+		if (non_ascii)
+			return j + lowest_bit(non_ascii);
+	}
+
+	return j;
+}
+#endif
+
+#ifdef REEF_STRING_AVX2
+/* widens the leading ASCII bytes of the n bytes of str into buf 32 at a time, returning how many were widened */
+REEF_STRING_AVX2_FUNCTION static inline size_t widen_ascii_avx2(QChar *buf, const char *str, size_t n)
+{
+	size_t j = 0;
+	for (; j + 32 <= n; j += 32) {
+		const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(str + j));
+		const uint32_t non_ascii = _mm256_movemask_epi8(bytes);
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(buf + j), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(buf + j + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1)));
+
+		if (non_ascii)
+			return j + lowest_bit(non_ascii);
+	}
+
+	return j + widen_ascii_sse2(buf + j, str + j, n - j);
+}
+#endif
+
+/* widens the leading ASCII bytes of the n bytes of str into buf 8 at a time, returning how many were widened */
+static inline size_t widen_ascii_words(QChar *buf, const char *str, size_t n)
+{
+	size_t j = 0;
+	for (; j + 8 <= n; j += 8) {
+		uint64_t word;
+		memcpy(&word, str + j, sizeof(word));
+		if (word & UINT64_C(0x8080808080808080))
+			break;
+
+		for (size_t k = 0; k < 8; k++)
+			buf[j + k] = QChar(static_cast<ushort>(static_cast<uint8_t>(str[j + k])));
+	}
+
+	return j;
+}
+
+/* the widening function for the CPU, chosen the first time it is needed */
+using widen_ascii_function = size_t (*)(QChar *buf, const char *str, size_t n);
+
+static inline widen_ascii_function select_widen_ascii()
+{
+#if defined(REEF_STRING_AVX2) && defined(__AVX2__)
+	return widen_ascii_avx2;
+#elif defined(REEF_STRING_AVX2)
+	return __builtin_cpu_supports("avx2") ? widen_ascii_avx2 : widen_ascii_sse2;
+#elif defined(REEF_STRING_SSE2)
+	return widen_ascii_sse2;
+#else
+	return widen_ascii_words;
+#endif
+}
+
+static inline size_t widen_ascii(QChar *buf, const char *str, size_t n)
+{
+	static const widen_ascii_function widen = select_widen_ascii();
+	return widen(buf, str, n);
+}
+
+} /* namespace reef_string_detail */
+
+/* appends the UTF8 string str with size n to the buffer buf at the position i updating i to the next available position,
+ * decoding one byte at a time */
 template<size_t BUF_SIZE>
-static inline void add_utf8_str_to_buf(QChar(&buf)[BUF_SIZE], const char str[], size_t &i)
+static inline void add_utf8_str_to_buf_scalar(QChar(&buf)[BUF_SIZE], const char str[], size_t n, size_t &i)
 {
 	uint32_t state = UTF8_ACCEPT;
 	uint32_t codepoint;
-	for (size_t j = 0; i < BUF_SIZE && str[j]; ++j) {
+	for (size_t j = 0; i < BUF_SIZE && j < n; ++j) {
 		if (utf8_decode(&state, &codepoint, reinterpret_cast<const uint8_t&>(str[j])))
 			continue;
 
 		if (codepoint <= 0xFFFF) {
 			buf[i++] = codepoint;
 		} else {
-			if (i > BUF_SIZE - 1)
+			/* both halves of the surrogate pair have to fit */
+			if (i + 1 >= BUF_SIZE)
 				break;
 
 			buf[i++] = 0xD7C0 + (codepoint >> 10);
@@ -98,20 +226,32 @@ static inline void add_utf8_str_to_buf(QChar(&buf)[BUF_SIZE], const char str[],
 	}
 }
 
-/* appends the UTF8 string str with size n to the buffer buf with size n at the position i updating i to the next available position */
+/* appends the UTF8 string str with size n to the buffer buf at the position i updating i to the next available position */
 template<size_t BUF_SIZE>
 static inline void add_utf8_str_to_buf(QChar(&buf)[BUF_SIZE], const char str[], size_t n, size_t &i)
 {
 	uint32_t state = UTF8_ACCEPT;
 	uint32_t codepoint;
 	for (size_t j = 0; i < BUF_SIZE && j < n; ++j) {
+		/* the characters map one to one while they are ASCII, text that is mostly not ASCII stays in the decoder */
+		const size_t room = std::min(n - j, BUF_SIZE - i);
+		if (state == UTF8_ACCEPT && room >= 16 && static_cast<uint8_t>(str[j]) < 0x80) {
+			const size_t ascii = reef_string_detail::widen_ascii(buf + i, str + j, room);
+			i += ascii;
+			j += ascii;
+
+			if (i >= BUF_SIZE || j >= n)
+				break;
+		}
+
 		if (utf8_decode(&state, &codepoint, reinterpret_cast<const uint8_t&>(str[j])))
 			continue;
 
 		if (codepoint <= 0xFFFF) {
 			buf[i++] = codepoint;
 		} else {
-			if (i > BUF_SIZE - 1)
+			/* both halves of the surrogate pair have to fit */
+			if (i + 1 >= BUF_SIZE)
 				break;
 
 			buf[i++] = 0xD7C0 + (codepoint >> 10);
@@ -120,6 +260,14 @@ static inline void add_utf8_str_to_buf(QChar(&buf)[BUF_SIZE], const char str[],
 	}
 }
 
+/* appends the null terminated UTF8 string str to the buffer buf at the position i updating i to the next available position */
+template<size_t BUF_SIZE>
+static inline void add_utf8_str_to_buf(QChar(&buf)[BUF_SIZE], const char str[], size_t &i)
+{
+	/* the length is found first so that the blocks never read past the terminator */
+	add_utf8_str_to_buf(buf, str, strlen(str), i);
+}
+
 /* appends the string str to the buffer buf with size n at the position i updating i to the next available position */
 template<size_t BUF_SIZE>
 static inline void add_str_to_buf(QChar(&buf)[BUF_SIZE], const QChar str[], size_t &i)
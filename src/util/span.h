@@ -0,0 +1,79 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* span.h */
+#ifndef SPAN_H
+#define SPAN_H
+
+#include <cstddef>
+
+/*!
+ * \struct span
+ * \brief Non owning view of a contiguous run of elements
+ *
+ * A span is as cheap to copy as a pointer and a length, so it can be handed
+ * out for memory owned elsewhere, such as an allocator, without copying or
+ * reference counting. It must not outlive the memory it points to.
+ */
+template<typename T>
+struct span
+{
+	/*! \brief The first element */
+	T *ptr = nullptr;
+	/*! \brief The number of elements */
+	size_t len = 0;
+
+	span() = default;
+
+	span(T *ptr, size_t len) :
+		ptr(ptr),
+		len(len)
+	{}
+
+	T *data() const
+	{
+		return ptr;
+	}
+
+	size_t size() const
+	{
+		return len;
+	}
+
+	bool empty() const
+	{
+		return len == 0;
+	}
+
+	T *begin() const
+	{
+		return ptr;
+	}
+
+	T *end() const
+	{
+		return ptr + len;
+	}
+
+	T &operator[](size_t index) const
+	{
+		return ptr[index];
+	}
+};
+
+#endif /* SPAN_H */
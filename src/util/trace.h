@@ -0,0 +1,206 @@
+/*
+ * Reef - Cross Platform Git Client
+ * Copyright (C) 2020-2021 Emmanuel Mathi-Amorim
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* trace.h */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "util/preferences.h"
+
+/*
+ * Timed spans of the work Reef does, written out as a Chrome trace that can
+ * be opened in Perfetto or chrome://tracing. Nothing is recorded unless a
+ * trace_session was started, and a trace_scope then costs a single relaxed
+ * load of a flag.
+ */
+namespace trace_detail {
+
+struct event
+{
+	const char *name;
+	std::chrono::steady_clock::time_point begin;
+	std::chrono::steady_clock::time_point end;
+	uint32_t thread;
+};
+
+struct recorder
+{
+	std::mutex mutex;
+	std::chrono::steady_clock::time_point start;
+	std::vector<event> events;
+	size_t num_dropped = 0;
+};
+
+/* shared by every translation unit, and constant initialized so checking it never has to wait on a guard */
+inline std::atomic<bool> &enabled()
+{
+	static std::atomic<bool> is_enabled(false);
+	return is_enabled;
+}
+
+inline recorder &get_recorder()
+{
+	static recorder rec;
+	return rec;
+}
+
+/* numbers the threads in the order they first record a span */
+inline uint32_t thread_index()
+{
+	static std::atomic<uint32_t> next_index(0);
+	thread_local const uint32_t index = next_index++;
+	return index;
+}
+
+inline void record(const char *name, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+{
+	const uint32_t thread = thread_index();
+
+	recorder &rec = get_recorder();
+	std::lock_guard<std::mutex> lock(rec.mutex);
+
+	/* the session may have ended while the span was open */
+	if (!enabled().load(std::memory_order_relaxed))
+		return;
+
+	if (rec.events.size() >= preferences::trace_max_events) {
+		rec.num_dropped++;
+		return;
+	}
+
+	rec.events.push_back({ name, begin, end, thread });
+}
+
+} /* namespace trace_detail */
+
+/*!
+ * \class trace_scope
+ * \brief Records the time from its construction to its destruction as a span of the trace
+ */
+class trace_scope
+{
+public:
+	/*!
+	 * \brief Start a span if a trace is being recorded
+	 * \param name The name of the span, a string literal without quotes or backslashes since it is written as is
+	 */
+	explicit trace_scope(const char *name) :
+		name(trace_detail::enabled().load(std::memory_order_relaxed) ? name : nullptr)
+	{
+		if (this->name != nullptr)
+			begin = std::chrono::steady_clock::now();
+	}
+
+	trace_scope(const trace_scope &) = delete;
+	trace_scope &operator=(const trace_scope &) = delete;
+
+	~trace_scope()
+	{
+		if (name != nullptr)
+			trace_detail::record(name, begin, std::chrono::steady_clock::now());
+	}
+
+private:
+	const char *name;
+	std::chrono::steady_clock::time_point begin;
+};
+
+/*!
+ * \class trace_session
+ * \brief Records the spans of every thread for as long as it exists, then writes them to a file
+ *
+ * Only one session can exist at a time. The file is in the Chrome trace
+ * event format, with a complete event for each span.
+ */
+class trace_session
+{
+public:
+	/*!
+	 * \brief Start recording
+	 * \param path The file to write the trace to, nothing is recorded if it is empty
+	 */
+	explicit trace_session(std::string path) :
+		path(std::move(path))
+	{
+		if (this->path.empty())
+			return;
+
+		trace_detail::recorder &rec = trace_detail::get_recorder();
+		std::lock_guard<std::mutex> lock(rec.mutex);
+		rec.start = std::chrono::steady_clock::now();
+		rec.events.clear();
+		rec.num_dropped = 0;
+		trace_detail::enabled() = true;
+	}
+
+	trace_session(const trace_session &) = delete;
+	trace_session &operator=(const trace_session &) = delete;
+
+	/*!
+	 * \brief Stop recording and write the trace
+	 */
+	~trace_session()
+	{
+		if (path.empty())
+			return;
+
+		trace_detail::recorder &rec = trace_detail::get_recorder();
+		std::lock_guard<std::mutex> lock(rec.mutex);
+		trace_detail::enabled() = false;
+
+		FILE *file = std::fopen(path.c_str(), "w");
+		if (file == nullptr)
+			return;
+
+		/* the times are in microseconds from the start of the session */
+		auto micros = [&rec] (std::chrono::steady_clock::time_point time) {
+			return std::chrono::duration<double, std::micro>(time - rec.start).count();
+		};
+
+		std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+		for (size_t i = 0; i < rec.events.size(); i++) {
+			const trace_detail::event &e = rec.events[i];
+			std::fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"reef\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+					i > 0 ? ",\n" : "", e.name, e.thread, micros(e.begin), micros(e.end) - micros(e.begin));
+		}
+
+		std::fprintf(file, "\n],\"otherData\":{\"dropped_events\":%zu}}\n", rec.num_dropped);
+		std::fclose(file);
+
+		rec.events = std::vector<trace_detail::event>();
+	}
+
+private:
+	std::string path;
+};
+
+#define TRACE_SCOPE_CONCAT_(a, b) a##b
+#define TRACE_SCOPE_CONCAT(a, b) TRACE_SCOPE_CONCAT_(a, b)
+
+/*! \brief Record the rest of the enclosing block as a span with the given name */
+#define TRACE_SCOPE(name) trace_scope TRACE_SCOPE_CONCAT(trace_scope_, __LINE__)(name)
+
+#endif /* TRACE_H */